@@ -14,6 +14,21 @@
 
 #include <pthread.h>
 #include <sys/sysinfo.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define MAPIO_HAVE_URING
+#endif
+#endif
+#endif
 
 // 原注释：目前发现，对于本赛题的数据，CMT没什么用，可以直接取消，保留TPC就行
 //#define USE_CMT
@@ -48,21 +63,36 @@ long long total_ftl_logic = 0;     // FTL核心逻辑时间
 //决赛添加
 #define DEBUG_FTL // 打印调试信息(主要是预估内存占用)。为了加速，提交时应该注释掉。实际延时影响其实小于0.5%
 #define SMALL_GTD_ARRAY
-#define FAST_DESTROY   // 跳过销毁逻辑
+#define GTD_HIERARCHICAL // GTD位图改为 目录 + 按需分配的叶子位图(每叶4KB)：内存随访问过的LBA范围增长，容量可在运行期配置
+#define FAST_DESTROY   // 旧接口 FTLDestroy(进程随即退出)跳过刷脏页和释放；FTLHandleClose 总是完整释放
 #define FAST_CONSTANTS // 针对决赛的常数优化，可能注释掉一些检查和未实现功能
 //#define FAST_CONSTANTS_PREAD //pread_full更安全可靠，而开启此优化后直接使用pread。优化小于1% (94,92,92 vs 91,93,92)
 #define SETVBUF // 使用更大的输入缓冲区，延时优化约2%~3%
 #define ZERO_COPY_DMA // 使用零拷贝DMA读写SSD文件，需内核支持，优化约1%
-#define CACHE_LINE_OPTIMIZE // 消除结构体填充 (Cache Line 利用率优化)，优化约1%~2%
+#define CACHE_LINE_OPTIMIZE // 消除结构体填充 (Cache Line 利用率优化)，优化约1%~2%；TPC tag 数组按 64B 对齐，一组不跨 cache line
 #define LAST_HIT_OPTIMIZE // 利用最近命中优化TPC查找，优化小于1%
 #define LIKELY_OPTIMIZE // 使用likely和unlikely宏优化分支预测，可能有1%以下的优化
+//#define TPC_PREFETCH // 多流顺序/步长预取映射页：TPC缺失时识别流并预读后续mpn，同时按访问模式切换fadvise提示
+//#define TPC_ENTRY_RETAIN // TPC 淘汰映射页时，把装入后被访问过的少数条目留在一个条目级旁路缓存里，缺失时先查它再读整页(TPFTL/S-FTL 式选择性保留)
+//#define TPC_ZCACHE // TPC 之下的第二级压缩缓存：被淘汰的映射页压缩后留在内存，缺失时先查它再读盘
+//#define HUGEPAGE_BACKING // TPC页池、GTD位图和TaskBatch池改用大页(MAP_HUGETLB，不可用时退化为THP)，并在FTLInit中预先缺页
+//#define HUGEPAGE_GTD_PREFAULT // 连GTD位图也预先缺页：消除计时阶段的GTD缺页，但RSS会增加整个位图大小(16MB)。只对平坦位图(未开 GTD_HIERARCHICAL)有效
+#define MAP_LINEAR_ELISION // 写回时检测 ppn = base + 偏移 的线性映射页，只记录 base 不写盘；读时直接算出结果，不占 TPC 也不读盘
+//#define TPC_MICRO_TLB // TPC组查找前先查一个 8 项全相联 micro-TLB(mpn -> slot)，覆盖在两三个映射页之间交替访问的情形
+#define TPC_HASH_SET_INDEX // TPC组索引改为mpn高位异或折叠，避免mpn相差64整数倍的多条流挤进同一组(8条交错流的测试中TPC命中率 83% -> 99.8%)
+//#define TPC_MISS_CLASSIFY // 用同容量全相联LRU影子缓存区分冲突缺失和容量缺失(仅用于分析，有额外开销)
+//#define HUGEPAGE_MLOCK // 大页区域再 mlock，防止被换出(受 RLIMIT_MEMLOCK 限制，失败只告警)
+//#define MAP_WARM_RESTART // 退出时刷脏页并把 GTD、TPC 热页 mpn、线性页表(及压缩定位表)存入 map.ssd.ckpt；启动时校验通过就恢复并预读热页，沿用上次的 map.ssd
+//#define MAP_DURABLE // 持久模式：修改先记入 map.wal 意图日志，每个窗口成组 fdatasync 一次；WAL 超过上限时做检查点后截断，启动时按检查点 + 重放 WAL 恢复(隐含 MAP_WARM_RESTART)
+//#define MAP_DISK_COMPRESS // map.ssd 中的映射页按压缩缓存同一编码压缩后存入 64B~4KB 的变长槽位，内存中用 mpn -> 槽位的定位表寻址，读写盘字节随压缩率下降
+//#define MAP_DIRECT_IO // map.ssd 以 O_DIRECT 打开，映射页读写绕过内核页缓存，不再在 TPC 之外多缓存一份；所有 I/O 缓冲按 4KB 对齐，文件系统拒绝时退回缓冲 I/O
+//#define MAP_MMAP // map.ssd 整体 mmap，映射条目在映射区中原地读写，由内核页缓存充当翻译缓存(隐含 DISABLE_TPC，用作 TPC 的对照基线)
+//#define MAP_LOG_STRUCTURED // map.ssd 改为日志结构：脏映射页异地追加到当前段，GTD 记录每页的盘上位置，有效页占比低时按有效页最少选段回收(基于完整 GTD，自动关闭位图 GTD)
 
 #define MPN_SENTINEL (~0ULL) // 表示无效的 MPN
 
-#ifdef CACHE_LINE_OPTIMIZE
-// 快速计算实际内存地址；page_pool_base 是基地址，idx 是页索引
+// 快速计算实际内存地址；page_pool_base 是基地址，idx 是页索引(即 TPC slot 号)
 #define GET_TPC_PTR(d, idx) ((d)->page_pool_base + (size_t)(idx) * MAP_PAGE_BYTES)
-#endif
 
 #ifdef LIKELY_OPTIMIZE
 #define likely(x)       __builtin_expect(!!(x), 1)
@@ -72,16 +102,144 @@ long long total_ftl_logic = 0;     // FTL核心逻辑时间
 #define unlikely(x)     (x)
 #endif
 
-#define CHECK_TPC_ENTRY_VALID(e) ((e)->mpn != MPN_SENTINEL)
+#define CHECK_TPC_SLOT_VALID(d, s) ((d)->tpc_tags[(s)] != MPN_SENTINEL)
 
 //#define SMALL_INPUT_MODE
 #define SMALL_INPUT_THRESHOLD (30000000000000ull) // 本来打算对小数据做特殊处理的，比如改成单线程，现在取消这个设计
 
 // TPC 配置
-#define TPC_WAYS 4
+#ifndef TPC_WAYS
+#define TPC_WAYS 4 // 组相联度，可选 4/8/16：一组的 tag 连续存放，用一到两条 SIMD 比较查完
+#endif
+#if TPC_WAYS != 4 && TPC_WAYS != 8 && TPC_WAYS != 16
+#error "TPC_WAYS must be 4, 8 or 16"
+#endif
 #define TPC_WAYS_MASK (TPC_WAYS - 1)
-#define TPC_SETS 64
-#define TPC_SET_MASK (TPC_SETS - 1)
+#define TPC_TAG_ALIGN 64
+
+#ifdef MAP_LINEAR_ELISION
+#define LIN_INIT_CAP 1024u // 线性页表(mpn -> base)初始容量，装载率超过 1/2 时翻倍
+#endif
+
+#ifdef TPC_MICRO_TLB
+#ifndef UTLB_ENTRIES
+#define UTLB_ENTRIES 8 // 可选 8/16，轮转替换
+#endif
+#if UTLB_ENTRIES != 8 && UTLB_ENTRIES != 16
+#error "UTLB_ENTRIES must be 8 or 16"
+#endif
+#endif
+#define TPC_SET_BITS 6      // 默认组数 2^6(未配置内存预算时)；配置了 mem_budget 时组数在 FTLInit 中按预算确定
+#define TPC_MAX_SET_BITS 16 // 内存预算能给 TPC 的最大组数(4 路时 1GB 页池)
+
+#ifdef TPC_PREFETCH
+// 预取器配置
+#define PF_STREAMS 4          // 同时跟踪的流数量
+#define PF_DEPTH 4            // 每次预取的映射页数
+#define PF_CONFIRM 2          // 同一步长连续出现多少次后才开始预取
+#define PF_MAX_STRIDE 64      // 步长(以mpn计)超过该值不视为同一条流
+#define PF_RANDOM_SWITCH 64   // 连续多少次不属于任何流的缺失后切回 FADV_RANDOM
+#endif
+
+#ifdef TPC_ZCACHE
+// 压缩缓存配置：arena 为环形日志，按插入顺序(FIFO)淘汰。预算包括 arena、索引和编解码缓冲，
+// 索引容量按每页 ZC_BYTES_PER_PAGE 字节压缩数据估算(取 2 的幂)，预算的其余部分都给 arena
+#define ZC_BUDGET_BYTES (1u << 20)          // 未设置 mem_budget 时压缩缓存的总预算
+#define ZC_BUDGET_SHARE 4u                  // 设置 mem_budget 时，扣除固定组件后的 1/ZC_BUDGET_SHARE 给压缩缓存
+#define ZC_BYTES_PER_PAGE 64u               // 估算索引容量用的每页平均压缩字节数
+#define ZC_MIN_PAGES 256u                   // 索引容量下限
+#define ZC_MAX_PAGES (1u << 22)             // 索引容量上限(arena 偏移为 32 位)
+#define ZC_MAX_BLOB (MAP_PAGE_BYTES / 2u)   // 压缩后超过该大小的页不进入压缩缓存
+#endif
+
+#ifdef TPC_ENTRY_RETAIN
+// 条目保留配置：旁路缓存复用 CMT 的开放寻址表
+#define RETAIN_ENTRIES 8192u                 // 旁路缓存容量(每条 16B，表约 256KB)
+#define RETAIN_MAX_PER_PAGE (EPP / 16u)      // 被访问条目多于该数的页按整页热度处理，不逐条保留
+#define TPC_ACC_WORDS ((EPP + 63u) / 64u)    // 每个 slot 的条目访问位字数
+#ifdef DISABLE_TPC
+#error "TPC_ENTRY_RETAIN requires the TPC"
+#endif
+#endif
+
+#ifdef MAP_MMAP
+#ifndef DISABLE_TPC
+#define DISABLE_TPC // 不再自己缓存映射页
+#endif
+#define MMAP_INIT_BYTES (64ull << 20) // 初始映射长度；写到末尾之外时文件按 2 倍扩展并 mremap
+#define MMAP_WILLNEED_PAGES 8u        // 顺序访问时提前提示内核读入的页数
+#endif
+
+#ifdef MAP_DIRECT_IO
+// 直接 I/O 要求缓冲区、偏移和长度都按块对齐：TPC 页池和各临时页都按 MAP_IO_ALIGN 分配，偏移和长度都是整页
+#if !defined(ZERO_COPY_DMA) && !defined(HUGEPAGE_BACKING)
+#define ZERO_COPY_DMA // TPC 页池需按 4KB 对齐
+#endif
+#if defined(MAP_DISK_COMPRESS) || defined(MAP_MMAP)
+#error "MAP_DIRECT_IO does not support MAP_DISK_COMPRESS (sub-page slots) / MAP_MMAP"
+#endif
+#endif
+
+#ifdef MAP_DISK_COMPRESS
+// 盘上压缩格式配置：槽位大小为 MLOC_UNIT << cls，每个 4KB 块只切同一大小类的槽位，槽位不跨块
+#define MLOC_UNIT 64u                         // 槽位粒度，定位表中的偏移以它为单位
+#define MLOC_CLASSES 7u                       // 64B, 128B, ..., 4KB
+#define MLOC_RAW_CLASS (MLOC_CLASSES - 1u)    // 4KB 槽位直接存未压缩的原页，读时不解码
+#define MLOC_BLOCK_UNITS (MAP_PAGE_BYTES / MLOC_UNIT)
+#define MLOC_MAX_PACKED (MAP_PAGE_BYTES / 2u) // 压缩后超过该大小的页按原页存放
+#define MLOC_INIT_CAP 1024u                   // 定位表初始容量，装载率超过 1/2 时翻倍
+#ifdef DISABLE_TPC
+#error "MAP_DISK_COMPRESS does not support DISABLE_TPC"
+#endif
+#endif
+
+#ifdef MAP_LOG_STRUCTURED
+// 日志结构存放配置：map.ssd 按段组织，段内页号连续；GTD 中 0 表示未分配，LOG_PPA_UNWRITTEN 表示已分配但盘上没有副本
+#undef SMALL_GTD_ARRAY  // 需要 mpn -> 盘上页号的完整 GTD
+#undef GTD_HIERARCHICAL
+#define LOG_SEG_PAGES 256u             // 每段 1MB
+#define LOG_INIT_SEGS 64u              // 段表初始容量，不够时翻倍
+#define LOG_GC_UTIL 0.75               // 空闲段只剩回收预留的一段时：有效页占比低于该值就回收，否则扩展日志
+#define LOG_GC_MAX_ROUNDS 8u           // 一次取新段最多连续回收几段，之后仍不够就扩展
+#define LOG_PPA_UNWRITTEN (~0ull - 1ull)
+#define LOG_SEG_NONE UINT32_MAX
+#if defined(MAP_DISK_COMPRESS) || defined(MAP_WARM_RESTART) || defined(MAP_DURABLE)
+#error "MAP_LOG_STRUCTURED does not support MAP_DISK_COMPRESS / MAP_WARM_RESTART / MAP_DURABLE"
+#endif
+#ifdef DISABLE_TPC
+#error "MAP_LOG_STRUCTURED does not support DISABLE_TPC"
+#endif
+#endif
+
+#if defined(MAP_DURABLE) && !defined(MAP_WARM_RESTART)
+#define MAP_WARM_RESTART // 持久模式的检查点复用热重启的检查点文件
+#endif
+
+#ifdef MAP_DURABLE
+#define WAL_MAGIC 0x31474F4C4C415746ull  // "FWALLOG1"
+#define WAL_DEFAULT_WINDOW 4096u          // 默认每多少次修改成组提交一次
+#define WAL_MAX_WINDOW (1u << 20)
+#define WAL_CKPT_BYTES (64ull << 20)      // WAL 超过该大小时做检查点并截断
+#ifdef MAP_DISK_COMPRESS
+#error "MAP_DURABLE does not support MAP_DISK_COMPRESS (slots may be reused after a checkpoint)"
+#endif
+#endif
+
+#ifdef MAP_WARM_RESTART
+#define CKPT_MAGIC 0x31544B50434C5446ull // "FTLCPKT1"
+#define CKPT_VERSION 2u
+#define CKPT_CHUNK_MPNS 32768u // GTD 按块保存，每块位图 4KB
+#define CKPT_CHUNK_WORDS (CKPT_CHUNK_MPNS / 64u)
+#define CKPT_LAYOUT_SMALL_GTD 0x1u
+#define CKPT_LAYOUT_LINEAR    0x2u
+#define CKPT_LAYOUT_COMPRESS  0x4u
+#ifdef DISABLE_TPC
+#error "MAP_WARM_RESTART does not support DISABLE_TPC"
+#endif
+#if defined(SMALL_GTD_ARRAY) && defined(GTD_HIERARCHICAL) && (1u << 15) != CKPT_CHUNK_MPNS
+#error "CKPT_CHUNK_MPNS must match the GTD leaf size"
+#endif
+#endif
 
 // TaskBatch 模型
 #define BATCH_SIZE   4096
@@ -96,8 +254,14 @@ typedef struct {
 typedef struct {
     TaskSimple tasks[BATCH_SIZE];
     int count;
+    bool to_cq; // 异步接口提交的批：结果写入完成队列而不是输出文件
 } TaskBatch;
 
+#define ASYNC_CQ_MASK (FTL_ASYNC_DEPTH - 1u)
+#if (FTL_ASYNC_DEPTH & ASYNC_CQ_MASK) != 0
+#error "FTL_ASYNC_DEPTH must be a power of two"
+#endif
+
 // 全局流水线结构：只用单 worker 线程和 TaskBatch 队列，保持输出顺序
 typedef struct {
     TaskBatch *batch_queue[QUEUE_DEPTH];
@@ -113,9 +277,22 @@ typedef struct {
 
     pthread_t worker_tid;
     FILE *output_file;
+#ifdef HUGEPAGE_BACKING
+    TaskBatch *batch_pool;   // 所有 TaskBatch 放在同一段大页映射中
+#endif
+
+    // 异步接口：提交队列就是正在填充的 sq_batch 加上 batch_queue，完成队列是 cq 环。
+    // 第 i 个提交的完成项固定放在 cq[i & ASYNC_CQ_MASK]：提交时写入 tag，worker 写入结果后推进 cq_tail
+    TaskBatch *sq_batch;     // 尚未按门铃的提交
+    FTLCqe *cq;              // FTL_ASYNC_DEPTH 项，第一次提交时分配
+    uint64_t sq_seq;         // 已提交的请求数
+    uint64_t cq_head;        // 已收割的完成项数
+    uint64_t cq_tail;        // 已完成的请求数，worker 以 release 发布
+    uint64_t cq_fill;        // worker 私有：已执行的异步请求数
+    bool async_running;      // worker 线程正在为异步接口运行
+    pthread_cond_t cq_ready; // cq_tail 推进
 } PipelineSimple;
 
-static PipelineSimple g_pl = {0};
 
 // 用0表示无效PPA，mpn要加1才能得到对应ppn，ppn要减1得到mpn。
 // 输入ppn如果为0：暂时也视为无效ppa
@@ -130,33 +307,29 @@ enum {
 
 // 原 CMT TPC 参数（未使用的部分保留）
 #ifdef LARGE_CMT
-#define MCACHE_PAGES (1u << 20)
-#define CMT_HASH_SIZE (1u << 22)
+#define CMT_ENTRIES (1u << 16) // CMT 缓存的映射条目数，每条 16B、装载率 3/4 时约 2MB
 #else
-#define MCACHE_PAGES (1u << 10)
-#define CMT_HASH_SIZE (1u << 12)
+#define CMT_ENTRIES (1u << 12)
 #endif
+#define CMT_DIRTY_BUCKETS (CMT_ENTRIES / 4u) // 按 mpn 散列的脏条目计数器个数(2 的幂)
 // #define TPC_MAX_PAGES    (1u << 8)
 // #define TPC_HASH_SIZE    (1u << 12)
 
 #define MAP_PAGE_BYTES 4096u
-#define LBA_MAX_PLUS1 (1ull << 36)
-#define CMT_HASH_MASK (CMT_HASH_SIZE - 1)
+#define LBA_MAX_PLUS1 (1ull << 36) // 默认逻辑空间大小，可用 FTLConfigure 在运行期修改
+#define FTL_DEFAULT_MAP_PATH "map.ssd"
 // #define TPC_HASH_MASK (TPC_HASH_SIZE - 1)
 
-// 字节压缩优化 (暂时搁置)
-#define USE_U64_ENTRY
-
-#if defined(USE_U64_ENTRY)
-#define ENTRY_BYTES 8u
-#else
+// 字节压缩优化：映射条目宽度可选 8(默认) / 6 / 5 字节，编译时用 -DENTRY_BYTES=5 等覆盖。
+// 6 字节可表示 48 位 PPN，每页 682 项；5 字节可表示 40 位 PPN，每页 819 项。映射页数、TPC 缺失和 map.ssd 体积相应减少
+#if defined(USE_U48_ENTRY) && !defined(ENTRY_BYTES)
 #define ENTRY_BYTES 6u
 #endif
-#if defined(USE_U64_ENTRY) && defined(USE_U48_ENTRY)
-#error "Define only one of USE_U64_ENTRY or USE_U48_ENTRY"
+#ifndef ENTRY_BYTES
+#define ENTRY_BYTES 8u
 #endif
-#if !defined(USE_U64_ENTRY) && !defined(USE_U48_ENTRY)
-#define USE_U64_ENTRY
+#if ENTRY_BYTES != 8 && ENTRY_BYTES != 6 && ENTRY_BYTES != 5
+#error "ENTRY_BYTES must be 8, 6 or 5"
 #endif
 
 // ========== MemStats / SsdStats 及通用内存封装，保持原样 ==========
@@ -178,8 +351,51 @@ typedef struct MemStats
     uint64_t tpc_query_cnt;
     uint64_t tpc_hit_cnt;
     uint64_t cmt_dirty_handle_cnt;
+    uint64_t cmt_wb_page_cnt;   // CMT 脏条目写回涉及的映射页更新次数(同一页的脏条目合并为一次)
     uint64_t tpc_dirty_handle_cnt;
     uint64_t threads_used; // 用于统计多线程/流水线的内存开销
+    uint64_t tpc_miss_read_cnt; // 需要读盘的TPC缺失次数(不含预取)
+    uint64_t pf_issue_cnt;      // 预取进TPC的页数
+    uint64_t pf_hit_cnt;        // 预取页在被淘汰前被访问的次数
+    uint64_t pf_waste_cnt;      // 预取页未被访问就被淘汰的次数
+    uint64_t pf_hint_cnt;       // 只能提示到page cache(WILLNEED)的页数
+    uint64_t pf_fadv_switch_cnt; // fadvise提示切换次数
+    uint64_t zcache_used;       // 压缩缓存 arena + 索引
+    uint64_t zc_put_cnt;        // 压缩进缓存的页数
+    uint64_t zc_put_bytes;      // 压缩后总字节数
+    uint64_t zc_reject_cnt;     // 压缩率不足未能进入缓存的页数
+    uint64_t zc_hit_cnt;        // TPC缺失时由压缩缓存满足的次数
+    uint64_t zc_evict_cnt;      // 因预算不足被淘汰的页数
+    uint64_t zc_dirty_writeback_cnt; // 淘汰时需要写回 map.ssd 的脏页数
+    uint64_t huge_tlb_used;     // 累计 MAP_HUGETLB 映射的字节数(类别字段内部的细分，不计入 total_used)
+    uint64_t huge_thp_used;     // 累计退化为 THP(MADV_HUGEPAGE) 的字节数(同上)
+    uint64_t minflt_init;       // FTLInit 期间的次缺页数
+    uint64_t minflt_base;       // FTLInit 结束时的次缺页数，运行期缺页以此为起点
+    uint64_t majflt_base;
+    uint64_t tpc_conflict_miss_cnt; // 全相联同容量下会命中的缺失
+    uint64_t tpc_capacity_miss_cnt; // 全相联同容量下也会缺失(含首次访问)
+    uint64_t utlb_query_cnt;    // 未命中 last-hit 后查 micro-TLB 的次数
+    uint64_t lin_detect_cnt;    // 写回时被识别为线性、省掉 pwrite 的页数
+    uint64_t lin_read_cnt;      // 由线性页直接算出结果的读次数
+    uint64_t lin_write_noop_cnt; // 写入值与线性预测一致、页保持线性的写次数
+    uint64_t lin_materialize_cnt; // 线性页因非线性更新重新装入 TPC 的次数
+    uint64_t retain_put_cnt;    // TPC 淘汰时保留进旁路缓存的条目数
+    uint64_t retain_dense_cnt;  // 被访问条目过多、未逐条保留的淘汰页数
+    uint64_t retain_hit_cnt;    // TPC 缺失但由旁路缓存满足的读次数
+    uint64_t utlb_hit_cnt;
+    uint64_t warm_page_cnt;     // 热重启时按检查点预读进 TPC 的页数
+    uint64_t wal_group_cnt;     // 成组提交次数(每次一条 fdatasync)
+    uint64_t wal_rec_cnt;
+    uint64_t wal_bytes;
+    uint64_t wal_sync_ns;       // 花在 WAL 写入 + fdatasync 上的时间
+    uint64_t durable_ckpt_cnt;
+    uint64_t durable_ckpt_ns;   // 花在运行中检查点(刷脏页 + fdatasync map.ssd + 写检查点)上的时间
+    uint64_t wal_replay_cnt;    // 启动时重放的修改数
+    uint64_t map_mem_used;      // 内存后端保存映射页所用的字节
+    uint64_t mapio_batch_cnt;   // map_io_wait 等待过的批数
+    uint64_t mapio_req_cnt;     // 这些批中的请求总数
+    uint64_t trim_lpn_cnt;      // TRIM 覆盖的 LBA 数
+    uint64_t trim_page_cnt;     // 因 TRIM 变为全空、被回收的映射页数
 } MemStats;
 
 typedef struct SsdStats
@@ -190,10 +406,103 @@ typedef struct SsdStats
     uint64_t map_pages_written_bytes;
     uint64_t map_pages_written_cnt;
     uint64_t map_pages_read_cnt;
+    uint64_t map_bytes_read;            // 实际读盘字节
+    uint64_t map_logical_bytes_written; // 写回映射页的未压缩字节
+    uint64_t map_slot_bytes;            // 当前存活槽位占用的字节(MAP_DISK_COMPRESS)
+    uint64_t map_slot_end;              // 槽位分配推进到的文件末尾(MAP_DISK_COMPRESS)
+    uint64_t map_gc_runs;               // 回收的段数(MAP_LOG_STRUCTURED)
+    uint64_t map_gc_pages_moved;        // 回收时搬移的有效页，也计入 map_pages_written_cnt
+    uint64_t map_gc_ns;                 // 花在回收上的时间
+    uint64_t map_punch_bytes;           // TRIM 后打洞释放的字节
+    uint64_t map_punch_fail_cnt;        // 打洞失败(文件系统不支持等)的次数，失败只影响空间回收
 } SsdStats;
 
-static MemStats g_memstats = {0};
-static SsdStats g_ssdstats = {0};
+
+// NAND 时序模拟：map.ssd 的第 p 页按页交织到各 die(die = p % 总 die 数)，die 内再按 plane、块、页依次排布。
+// 每个 die / 通道记录忙到的时刻；读是同步的，发起者等到数据传完，虚拟时钟随之推进；写回是异步的，
+// 只占用通道和 die，不推进虚拟时钟。虚拟时钟不计主机计算时间，因此结果可复现。
+// 页只能擦后写：原地覆盖按每块累计 pages_per_block 次编程折算一次擦除
+typedef struct NandSim
+{
+    bool enabled;
+    FTLNandConfig cfg;
+    uint32_t n_dies;            // channels * dies_per_channel
+    uint64_t pages_per_die;     // planes * blocks * pages
+    uint64_t now;               // 虚拟时钟(ns)
+    uint64_t *die_busy;         // die 忙到的时刻
+    uint64_t *ch_busy;
+    uint64_t *die_busy_ns;      // 累计忙时间
+    uint64_t *ch_busy_ns;
+    uint16_t *blk_prog;         // 各块自上次擦除以来的编程次数
+    uint64_t read_cnt;
+    uint64_t prog_cnt;
+    uint64_t erase_cnt;
+    uint64_t read_stall_ns;     // 同步读等待设备的总时间
+    uint64_t wrap_cnt;          // 超出模拟容量、按取模折回的页
+} NandSim;
+
+// 映射 I/O 后端：请求先排进当前批(至多 MAPIO_QD 个)，由 poll 一次等齐
+#define MAPIO_QD 64u
+#define MAPIO_MEM_LEAF 512u // 内存后端每个目录叶子覆盖的 4KB 块数
+#define MAP_IO_ALIGN 4096u  // 映射页 I/O 缓冲的对齐，满足 O_DIRECT 的要求
+
+typedef struct {
+    void *buf;
+    off_t off;
+    uint32_t len;
+    bool write;
+} MapIoReq;
+
+typedef struct MapIo MapIo;
+
+typedef struct {
+    const char *name;
+    bool (*open)(MapIo *io);               // 失败时退回 pread 后端
+    void (*submit)(MapIo *io, uint32_t idx); // reqs[idx] 已填好
+    void (*poll)(MapIo *io);               // 等齐 reqs[0, pending) 全部完成
+    int (*flush)(MapIo *io);               // 已完成的写入持久化，返回 0 表示成功
+    int (*discard)(MapIo *io, off_t off, uint64_t len); // 释放 [off, off + len) 的空间，之后读出全0；返回 0 表示成功
+    void (*close)(MapIo *io);
+} MapIoOps;
+
+struct MapIo {
+    const MapIoOps *ops;
+    int fd;
+    uint32_t pending;          // 当前批已提交的请求数
+    bool direct;               // fd 当前带 O_DIRECT
+    MapIoReq reqs[MAPIO_QD];
+    bool write_pending;        // 当前批中有写请求，新请求要检查地址重叠
+    uint32_t stage_used;       // 当前批占用的暂存页数
+    uint8_t *stage[MAPIO_QD];  // map_io_write_copy 的暂存页，第一次用到时分配，关闭时释放
+    bool nand_read_pending;    // 本批有读请求计入 NAND 模拟
+    uint64_t nand_read_done;   // 本批读请求在模拟中全部完成的时刻
+    // io_uring
+    int ring_fd;
+    uint32_t queued;           // 已填入 SQ、尚未 io_uring_enter 的请求数
+    uint32_t uring_done;       // 提交时已经同步完成的请求数
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_sz;
+    size_t cq_ring_sz;
+    size_t sqes_sz;
+    uint32_t *sq_tail;
+    uint32_t *sq_array;
+    uint32_t sq_mask;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t cq_mask;
+#ifdef MAPIO_HAVE_URING
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+#endif
+    // 内存后端
+    uint8_t ***mem_dir;        // 叶子指针，未写过的叶子/块为 NULL
+    uint64_t mem_cap;          // mem_dir 的项数
+    // 所属实例的统计
+    MemStats *ms;
+    SsdStats *ss;
+    NandSim *nand;
+};
 
 static void *FTLMalloc(size_t size)
 {
@@ -261,10 +570,6 @@ static ssize_t pread_full(int fd, void *buf, size_t len, off_t off)
     }
     if (n < len)
         memset(p + n, 0, len - n);
-
-#ifdef DEBUG_FTL
-    g_ssdstats.map_pages_read_cnt++; // 统计读页数(写页数在ssdstats_on_write_map中统计)
-#endif
     return (ssize_t)n;
 #endif
 }
@@ -291,28 +596,268 @@ static ssize_t pwrite_full(int fd, const void *buf, size_t len, off_t off)
 
 static inline double to_gb(uint64_t bytes) { return (double)bytes / 1024.0 / 1024.0 / 1024.0; }
 
-static inline void memstats_add(uint64_t *field, uint64_t sz)
+static inline uint64_t ftl_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline void memstats_add(MemStats *ms, uint64_t *field, uint64_t sz)
 {
 #ifdef DEBUG_FTL
     *field += sz;
-    g_memstats.total_used += sz;
-    if (g_memstats.total_used > g_memstats.peak_used)
-        g_memstats.peak_used = g_memstats.total_used;
+    ms->total_used += sz;
+    if (ms->total_used > ms->peak_used)
+        ms->peak_used = ms->total_used;
 #endif
 }
 
-static inline void memstats_sub(uint64_t *field, uint64_t sz)
+static inline void memstats_sub(MemStats *ms, uint64_t *field, uint64_t sz)
 {
 #ifdef DEBUG_FTL
     if (*field >= sz)
         *field -= sz;
     else
         *field = 0;
-    if (g_memstats.total_used >= sz)
-        g_memstats.total_used -= sz;
+    if (ms->total_used >= sz)
+        ms->total_used -= sz;
     else
-        g_memstats.total_used = 0;
+        ms->total_used = 0;
+#endif
+}
+
+#ifdef DEBUG_FTL
+// 从 /proc/self/status 读取按类型划分的 RSS(字节)：匿名页、文件页(含 mmap 的 map.ssd)、共享内存
+static void memstats_sample_rss(uint64_t *anon, uint64_t *file, uint64_t *shmem)
+{
+    *anon = *file = *shmem = 0;
+    FILE *fp = fopen("/proc/self/status", "r");
+    if (!fp)
+        return;
+    char line[256];
+    unsigned long long kb;
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "RssAnon: %llu kB", &kb) == 1)
+            *anon = kb * 1024ull;
+        else if (sscanf(line, "RssFile: %llu kB", &kb) == 1)
+            *file = kb * 1024ull;
+        else if (sscanf(line, "RssShmem: %llu kB", &kb) == 1)
+            *shmem = kb * 1024ull;
+    }
+    fclose(fp);
+}
+
+static void memstats_sample_faults(uint64_t *minflt, uint64_t *majflt)
+{
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+        *minflt = (uint64_t)ru.ru_minflt;
+        *majflt = (uint64_t)ru.ru_majflt;
+    }
+}
 #endif
+
+// ========== 进程内存采样：后台线程定期读 /proc/self/smaps_rollup，记录各项峰值 ==========
+// /proc/self 是整个进程的视图(含 libc、线程栈、stdio 缓冲和 mmap 的文件页)，所以采样器是进程级的，不属于某个实例
+#define MEM_SAMPLER_DEFAULT_MS 20u
+#define MEM_SAMPLER_REGIONS 256u // 可登记的组件内存段数，每个实例约 QUEUE_DEPTH + 4 段
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    pthread_t tid;
+    bool running;
+    bool stop;
+    uint32_t period_ms;
+    FTLMemUsage peak;
+    uint32_t nregions;
+    struct {
+        const void *p;
+        size_t len;
+        FTLMemComponent comp;
+    } regions[MEM_SAMPLER_REGIONS];
+} g_memsampler = {.mutex = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER};
+
+// 读一个 /proc 文件中 "key: N kB" 形式的若干项；返回是否读到了文件
+static bool proc_read_kb(const char *path, const char *const *keys, uint64_t *vals, int n)
+{
+    char buf[4096];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0)
+        return false;
+    buf[len] = '\0';
+    for (char *line = buf; line && *line;) {
+        char *next = strchr(line, '\n');
+        if (next)
+            *next++ = '\0';
+        char *colon = strchr(line, ':');
+        if (colon) {
+            *colon = '\0';
+            for (int i = 0; i < n; i++)
+                if (strcmp(line, keys[i]) == 0)
+                    vals[i] = strtoull(colon + 1, NULL, 10);
+        }
+        line = next;
+    }
+    return true;
+}
+
+// 采一次样(KB)。内核没有 smaps_rollup(4.14 之前)时退回 /proc/self/status 的 VmRSS，PSS 各项为 0
+static void mem_sample_once(FTLMemUsage *u)
+{
+    static const char *const rollup_keys[] = {"Rss", "Pss", "Pss_Anon", "Pss_File", "Pss_Shmem"};
+    static const char *const status_keys[] = {"VmRSS"};
+    uint64_t v[5] = {0, 0, 0, 0, 0};
+    if (!proc_read_kb("/proc/self/smaps_rollup", rollup_keys, v, 5))
+        proc_read_kb("/proc/self/status", status_keys, v, 1);
+    u->rss_kb = v[0];
+    u->pss_kb = v[1];
+    u->pss_anon_kb = v[2];
+    u->pss_file_kb = v[3];
+    u->pss_shmem_kb = v[4];
+}
+
+// 登记一段属于某组件的内存，之后每次采样统计其中驻留的页；表满时不再登记，这段只体现在进程级数字里
+static void mem_track(const void *p, size_t len, FTLMemComponent comp)
+{
+    if (!p || !len)
+        return;
+    pthread_mutex_lock(&g_memsampler.mutex);
+    if (g_memsampler.nregions < MEM_SAMPLER_REGIONS) {
+        uint32_t i = g_memsampler.nregions++;
+        g_memsampler.regions[i].p = p;
+        g_memsampler.regions[i].len = len;
+        g_memsampler.regions[i].comp = comp;
+    }
+    pthread_mutex_unlock(&g_memsampler.mutex);
+}
+
+// 释放前调用。采样线程持锁做 mincore，所以这里返回后它不会再碰这段内存
+static void mem_untrack(const void *p)
+{
+    pthread_mutex_lock(&g_memsampler.mutex);
+    for (uint32_t i = 0; i < g_memsampler.nregions; i++) {
+        if (g_memsampler.regions[i].p == p) {
+            g_memsampler.regions[i] = g_memsampler.regions[--g_memsampler.nregions];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_memsampler.mutex);
+}
+
+// 各组件已驻留的 KB。只数完全落在段内的页：堆上的段首尾可能和别的分配共用一页，向内取整不会重复计数；
+// 调用者持有 g_memsampler.mutex
+static void mem_sample_components(FTLMemUsage *u)
+{
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    unsigned char vec[4096];
+    memset(u->comp_rss_kb, 0, sizeof(u->comp_rss_kb));
+    for (uint32_t i = 0; i < g_memsampler.nregions; i++) {
+        uintptr_t lo = ((uintptr_t)g_memsampler.regions[i].p + page - 1) & ~(page - 1);
+        uintptr_t hi = ((uintptr_t)g_memsampler.regions[i].p + g_memsampler.regions[i].len) & ~(page - 1);
+        uint64_t resident = 0;
+        for (uintptr_t a = lo; a < hi; a += sizeof(vec) * page) {
+            size_t n = (hi - a) / page < sizeof(vec) ? (hi - a) / page : sizeof(vec);
+            if (mincore((void *)a, n * page, vec) != 0)
+                break;
+            for (size_t k = 0; k < n; k++)
+                resident += vec[k] & 1u;
+        }
+        u->comp_rss_kb[g_memsampler.regions[i].comp] += resident * page / 1024u;
+    }
+}
+
+// 每项各自取最大值(峰值不一定出现在同一次采样)；调用者持有 g_memsampler.mutex
+static void mem_sample_fold(const FTLMemUsage *u)
+{
+    FTLMemUsage *p = &g_memsampler.peak;
+    for (int c = 0; c < FTL_MEM_COMPONENTS; c++)
+        if (u->comp_rss_kb[c] > p->comp_rss_kb[c]) p->comp_rss_kb[c] = u->comp_rss_kb[c];
+    if (u->rss_kb > p->rss_kb) p->rss_kb = u->rss_kb;
+    if (u->pss_kb > p->pss_kb) p->pss_kb = u->pss_kb;
+    if (u->pss_anon_kb > p->pss_anon_kb) p->pss_anon_kb = u->pss_anon_kb;
+    if (u->pss_file_kb > p->pss_file_kb) p->pss_file_kb = u->pss_file_kb;
+    if (u->pss_shmem_kb > p->pss_shmem_kb) p->pss_shmem_kb = u->pss_shmem_kb;
+    p->samples++;
+}
+
+static void *mem_sampler_thread(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&g_memsampler.mutex);
+    while (!g_memsampler.stop) {
+        pthread_mutex_unlock(&g_memsampler.mutex);
+        FTLMemUsage u;
+        mem_sample_once(&u);
+        pthread_mutex_lock(&g_memsampler.mutex);
+        mem_sample_components(&u);
+        mem_sample_fold(&u);
+
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        uint64_t ns = (uint64_t)ts.tv_nsec + (uint64_t)g_memsampler.period_ms * 1000000ull;
+        ts.tv_sec += (time_t)(ns / 1000000000ull);
+        ts.tv_nsec = (long)(ns % 1000000000ull);
+        while (!g_memsampler.stop && pthread_cond_timedwait(&g_memsampler.wake, &g_memsampler.mutex, &ts) == 0)
+            ;
+    }
+    pthread_mutex_unlock(&g_memsampler.mutex);
+    return NULL;
+}
+
+void FTLMemSamplerStart(uint32_t period_ms)
+{
+    pthread_mutex_lock(&g_memsampler.mutex);
+    if (g_memsampler.running) {
+        pthread_mutex_unlock(&g_memsampler.mutex);
+        return;
+    }
+    memset(&g_memsampler.peak, 0, sizeof(g_memsampler.peak));
+    g_memsampler.period_ms = period_ms ? period_ms : MEM_SAMPLER_DEFAULT_MS;
+    g_memsampler.stop = false;
+    g_memsampler.running = pthread_create(&g_memsampler.tid, NULL, mem_sampler_thread, NULL) == 0;
+    pthread_mutex_unlock(&g_memsampler.mutex);
+}
+
+bool FTLMemSamplerPeek(FTLMemUsage *out)
+{
+    pthread_mutex_lock(&g_memsampler.mutex);
+    bool running = g_memsampler.running;
+    *out = g_memsampler.peak;
+    pthread_mutex_unlock(&g_memsampler.mutex);
+    return running;
+}
+
+void FTLMemSamplerStop(FTLMemUsage *out)
+{
+    pthread_mutex_lock(&g_memsampler.mutex);
+    bool running = g_memsampler.running;
+    g_memsampler.stop = true;
+    pthread_cond_signal(&g_memsampler.wake);
+    pthread_mutex_unlock(&g_memsampler.mutex);
+    if (running)
+        pthread_join(g_memsampler.tid, NULL);
+
+    // 最后再采一次；RSS 峰值再与内核记录的 VmHWM 比较，不漏掉两次采样之间的尖峰
+    static const char *const hwm_key[] = {"VmHWM"};
+    uint64_t hwm = 0;
+    FTLMemUsage u;
+    mem_sample_once(&u);
+    proc_read_kb("/proc/self/status", hwm_key, &hwm, 1);
+    if (hwm > u.rss_kb)
+        u.rss_kb = hwm;
+    pthread_mutex_lock(&g_memsampler.mutex);
+    mem_sample_components(&u);
+    mem_sample_fold(&u);
+    g_memsampler.running = false;
+    if (out)
+        *out = g_memsampler.peak;
+    pthread_mutex_unlock(&g_memsampler.mutex);
 }
 
 typedef enum
@@ -323,947 +868,5276 @@ typedef enum
     MEM_CLASS_CMT_HASH,
     MEM_CLASS_TPC,
     MEM_CLASS_TPC_PAGE,
-    MEM_CLASS_PIPELINE
+    MEM_CLASS_PIPELINE,
+    MEM_CLASS_ZCACHE
 } MemClass;
 
-static void *FTLMallocEx(size_t size, MemClass cls)
+static void *FTLMallocEx(MemStats *ms, size_t size, MemClass cls)
 {
     void *p = FTLMalloc(size);
     switch (cls)
     {
     case MEM_CLASS_CTRL:
-        memstats_add(&g_memstats.ctrl_used, size);
+        memstats_add(ms, &ms->ctrl_used, size);
         break;
     case MEM_CLASS_ENTRIES:
-        memstats_add(&g_memstats.cmt_entrys_used, size);
+        memstats_add(ms, &ms->cmt_entrys_used, size);
         break;
     case MEM_CLASS_GTD:
-        memstats_add(&g_memstats.gtd_used, size);
+        memstats_add(ms, &ms->gtd_used, size);
         break;
     case MEM_CLASS_CMT_HASH:
-        memstats_add(&g_memstats.cmt_hash_used, size);
+        memstats_add(ms, &ms->cmt_hash_used, size);
         break;
     case MEM_CLASS_TPC:
-        memstats_add(&g_memstats.tpc_used, size);
+        memstats_add(ms, &ms->tpc_used, size);
         break;
     case MEM_CLASS_TPC_PAGE:
-        memstats_add(&g_memstats.tpc_page_used, size);
+        memstats_add(ms, &ms->tpc_page_used, size);
         break;
     case MEM_CLASS_PIPELINE:
-        memstats_add(&g_memstats.threads_used, size);
+        memstats_add(ms, &ms->threads_used, size);
+        break;
+    case MEM_CLASS_ZCACHE:
+        memstats_add(ms, &ms->zcache_used, size);
         break;
     default:
-        memstats_add(&g_memstats.ctrl_used, size);
+        memstats_add(ms, &ms->ctrl_used, size);
         break;
     }
     return p;
 }
 
-static void *FTLCallocEx(size_t n, size_t size, MemClass cls)
+static void *FTLCallocEx(MemStats *ms, size_t n, size_t size, MemClass cls)
 {
     void *p = FTLCalloc(n, size);
     size_t total = n * size;
     switch (cls)
     {
     case MEM_CLASS_CTRL:
-        memstats_add(&g_memstats.ctrl_used, total);
+        memstats_add(ms, &ms->ctrl_used, total);
         break;
     case MEM_CLASS_ENTRIES:
-        memstats_add(&g_memstats.cmt_entrys_used, total);
+        memstats_add(ms, &ms->cmt_entrys_used, total);
         break;
     case MEM_CLASS_GTD:
-        memstats_add(&g_memstats.gtd_used, total);
+        memstats_add(ms, &ms->gtd_used, total);
         break;
     case MEM_CLASS_CMT_HASH:
-        memstats_add(&g_memstats.cmt_hash_used, total);
+        memstats_add(ms, &ms->cmt_hash_used, total);
         break;
     case MEM_CLASS_TPC:
-        memstats_add(&g_memstats.tpc_used, total);
+        memstats_add(ms, &ms->tpc_used, total);
         break;
     case MEM_CLASS_TPC_PAGE:
-        memstats_add(&g_memstats.tpc_page_used, total);
+        memstats_add(ms, &ms->tpc_page_used, total);
         break;
     case MEM_CLASS_PIPELINE:
-        memstats_add(&g_memstats.threads_used, total);
+        memstats_add(ms, &ms->threads_used, total);
+        break;
+    case MEM_CLASS_ZCACHE:
+        memstats_add(ms, &ms->zcache_used, total);
         break;
     default:
-        memstats_add(&g_memstats.ctrl_used, total);
+        memstats_add(ms, &ms->ctrl_used, total);
         break;
     }
     return p;
 }
 
-static void FTLFreeEx(void *p, size_t size, MemClass cls)
+static inline uint64_t *memstats_class_field(MemStats *ms, MemClass cls)
+{
+    switch (cls)
+    {
+    case MEM_CLASS_ENTRIES:
+        return &ms->cmt_entrys_used;
+    case MEM_CLASS_GTD:
+        return &ms->gtd_used;
+    case MEM_CLASS_CMT_HASH:
+        return &ms->cmt_hash_used;
+    case MEM_CLASS_TPC:
+        return &ms->tpc_used;
+    case MEM_CLASS_TPC_PAGE:
+        return &ms->tpc_page_used;
+    case MEM_CLASS_PIPELINE:
+        return &ms->threads_used;
+    case MEM_CLASS_ZCACHE:
+        return &ms->zcache_used;
+    default:
+        return &ms->ctrl_used;
+    }
+}
+
+#if !defined(DISABLE_TPC) || defined(USE_CMT)
+// 按 align 对齐分配并清零，用 free 释放(FTLFreeEx 即可)。用户是 TPC tag、条目级缓存和 TPC 之后的各模块
+static void *FTLAllocAlignedEx(MemStats *ms, size_t size, size_t align, MemClass cls)
+{
+    void *p = NULL;
+    if (posix_memalign(&p, align, size) != 0) {
+        perror("posix_memalign failed");
+        exit(1);
+    }
+    memset(p, 0, size);
+    memstats_add(ms, memstats_class_field(ms, cls), size);
+    return p;
+}
+#endif
+
+#ifdef HUGEPAGE_BACKING
+#define HUGEPAGE_BYTES (2u << 20)
+
+static inline size_t huge_round(size_t size)
+{
+    return (size + HUGEPAGE_BYTES - 1u) & ~(size_t)(HUGEPAGE_BYTES - 1u);
+}
+
+// 大页映射：优先 MAP_HUGETLB(需要预留的 hugetlbfs 页)，失败时改用 2MB 对齐的普通映射 + MADV_HUGEPAGE。
+// 大小向上取整到 2MB；prefault 为真时在这里把每一页触碰一遍，计时阶段不再发生首次缺页。
+static void *FTLMapHugeEx(MemStats *ms, size_t size, bool prefault, MemClass cls)
+{
+    size_t len = huge_round(size);
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (prefault ? MAP_POPULATE : 0), -1, 0);
+    bool hugetlb = p != MAP_FAILED;
+    if (!hugetlb) {
+        uint8_t *raw = (uint8_t *)mmap(NULL, len + HUGEPAGE_BYTES, PROT_READ | PROT_WRITE,
+                                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (unlikely(raw == MAP_FAILED)) {
+            fprintf(stderr, "mmap %zu failed: %s\n", len, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        uint8_t *aligned = (uint8_t *)(((uintptr_t)raw + HUGEPAGE_BYTES - 1u) & ~(uintptr_t)(HUGEPAGE_BYTES - 1u));
+        if (aligned > raw)
+            munmap(raw, (size_t)(aligned - raw));
+        if (aligned + len < raw + len + HUGEPAGE_BYTES)
+            munmap(aligned + len, (size_t)(raw + len + HUGEPAGE_BYTES - (aligned + len)));
+        p = aligned;
+#ifdef MADV_HUGEPAGE
+        madvise(p, len, MADV_HUGEPAGE);
+#endif
+        if (prefault) {
+            for (size_t off = 0; off < len; off += 4096u)
+                ((volatile uint8_t *)p)[off] = 0;
+        }
+    }
+#ifdef DEBUG_FTL
+    // 只记细分，不走 memstats_add：这段内存下面按类别计一次 total_used
+    if (hugetlb)
+        ms->huge_tlb_used += len;
+    else
+        ms->huge_thp_used += len;
+#endif
+#ifdef HUGEPAGE_MLOCK
+    if (mlock(p, len) != 0) {
+        static bool warned = false;
+        if (!warned) {
+            fprintf(stderr, "mlock %zu failed: %s (continuing without mlock)\n", len, strerror(errno));
+            warned = true;
+        }
+    }
+#endif
+    memstats_add(ms, memstats_class_field(ms, cls), len);
+    return p;
+}
+
+static void FTLUnmapHugeEx(MemStats *ms, void *p, size_t size, MemClass cls)
+{
+    if (!p)
+        return;
+    size_t len = huge_round(size);
+    munmap(p, len);
+    memstats_sub(ms, memstats_class_field(ms, cls), len);
+}
+#endif
+
+static void FTLFreeEx(MemStats *ms, void *p, size_t size, MemClass cls)
 {
     FTLFree(p, size);
     switch (cls)
     {
     case MEM_CLASS_CTRL:
-        memstats_sub(&g_memstats.ctrl_used, size);
+        memstats_sub(ms, &ms->ctrl_used, size);
         break;
     case MEM_CLASS_ENTRIES:
-        memstats_sub(&g_memstats.cmt_entrys_used, size);
+        memstats_sub(ms, &ms->cmt_entrys_used, size);
         break;
     case MEM_CLASS_GTD:
-        memstats_sub(&g_memstats.gtd_used, size);
+        memstats_sub(ms, &ms->gtd_used, size);
         break;
     case MEM_CLASS_CMT_HASH:
-        memstats_sub(&g_memstats.cmt_hash_used, size);
+        memstats_sub(ms, &ms->cmt_hash_used, size);
         break;
     case MEM_CLASS_TPC:
-        memstats_sub(&g_memstats.tpc_used, size);
+        memstats_sub(ms, &ms->tpc_used, size);
         break;
     case MEM_CLASS_TPC_PAGE:
-        memstats_sub(&g_memstats.tpc_page_used, size);
+        memstats_sub(ms, &ms->tpc_page_used, size);
         break;
     case MEM_CLASS_PIPELINE:
-        memstats_sub(&g_memstats.threads_used, size);
+        memstats_sub(ms, &ms->threads_used, size);
+        break;
+    case MEM_CLASS_ZCACHE:
+        memstats_sub(ms, &ms->zcache_used, size);
         break;
     default:
-        memstats_sub(&g_memstats.ctrl_used, size);
+        memstats_sub(ms, &ms->ctrl_used, size);
         break;
     }
 }
 
-static inline void ssdstats_on_write_map(off_t offset, size_t len)
+static inline void ssdstats_on_write_map(SsdStats *ss, off_t offset, size_t len)
 {
 #ifdef DEBUG_FTL
     uint64_t end = (uint64_t)offset + (uint64_t)len;
-    if (end > g_ssdstats.map_max_off)
-        g_ssdstats.map_max_off = end;
-    g_ssdstats.map_pages_written_bytes += len;
-    g_ssdstats.map_pages_written_cnt ++;
+    if (end > ss->map_max_off)
+        ss->map_max_off = end;
+    ss->map_pages_written_bytes += len;
+    ss->map_pages_written_cnt ++;
 #endif
 }
 
-static inline void ssdstats_refresh_from_fs(int fd_map)
+static inline void ssdstats_refresh_from_fs(SsdStats *ss, int fd_map)
 {
 #ifdef DEBUG_FTL
     struct stat st;
     if (fd_map >= 0 && fstat(fd_map, &st) == 0)
     {
-        g_ssdstats.map_st_size = (uint64_t)st.st_size;
-        g_ssdstats.map_st_blocks = (uint64_t)st.st_blocks * 512ull;
+        ss->map_st_size = (uint64_t)st.st_size;
+        ss->map_st_blocks = (uint64_t)st.st_blocks * 512ull;
     }
 #endif
 }
 
-static ssize_t pwrite_full_with_stats(int fd, const void *buf, size_t len, off_t off)
-{
-    ssize_t n = pwrite_full(fd, buf, len, off);
-    #ifdef DEBUG_FTL
-    if (n == (ssize_t)len)
-        ssdstats_on_write_map(off, len);
-    #endif
-    return n;
-}
-
-#define FTL_MALLOC_CTRL(sz_tt) FTLMallocEx((sz_tt), MEM_CLASS_CTRL)
-#define FTL_CALLOC_CTRL(n, sz_per) FTLCallocEx((n), (sz_per), MEM_CLASS_CTRL)
-#define FTL_MALLOC_ENTRIES(n) FTLCallocEx((n), sizeof(cmt_entry), MEM_CLASS_ENTRIES)
-#ifdef SMALL_GTD_ARRAY
+#define FTL_MALLOC_CTRL(ms, sz_tt) FTLMallocEx((ms), (sz_tt), MEM_CLASS_CTRL)
+#define FTL_CALLOC_CTRL(ms, n, sz_per) FTLCallocEx((ms), (n), (sz_per), MEM_CLASS_CTRL)
+#ifdef HUGEPAGE_GTD_PREFAULT
+#define GTD_PREFAULT true
+#else
+#define GTD_PREFAULT false
+#endif
+#if defined(SMALL_GTD_ARRAY) && defined(GTD_HIERARCHICAL)
+// 叶子位图按需用普通堆内存分配，不走大页(单个叶子只有4KB)
+#define GTD_LEAF_SHIFT 15 // 每个叶子覆盖 2^15 个 mpn，即 2^24 个 LBA
+#define GTD_LEAF_MPNS (1ull << GTD_LEAF_SHIFT)
+#define GTD_LEAF_MASK (GTD_LEAF_MPNS - 1ull)
+#define GTD_LEAF_WORDS (GTD_LEAF_MPNS / 64ull)
+#define GTD_LEAF_BYTES (GTD_LEAF_MPNS / 8ull)
+#define GTD_LEAVES(n_mpns) (((n_mpns) + GTD_LEAF_MASK) >> GTD_LEAF_SHIFT)
+#define GTD_SUMMARY_WORDS(n_leaves) (((n_leaves) + 63ull) / 64ull)
+#define FTL_MALLOC_GTD_LEAF(ms) FTLCallocEx((ms), 1u, GTD_LEAF_BYTES, MEM_CLASS_GTD)
+#define FTL_FREE_GTD_LEAF(ms, p) FTLFreeEx((ms), (p), GTD_LEAF_BYTES, MEM_CLASS_GTD)
+#define FTL_MALLOC_GTD_DIR(ms, n_leaves) FTLMallocEx((ms), (size_t)(n_leaves) * sizeof(uint64_t *), MEM_CLASS_GTD)
+#define FTL_FREE_GTD_DIR(ms, p, n_leaves) FTLFreeEx((ms), (p), (size_t)(n_leaves) * sizeof(uint64_t *), MEM_CLASS_GTD)
+#define FTL_MALLOC_GTD_SUMMARY(ms, n_leaves) FTLCallocEx((ms), GTD_SUMMARY_WORDS(n_leaves), sizeof(uint64_t), MEM_CLASS_GTD)
+#define FTL_FREE_GTD_SUMMARY(ms, p, n_leaves) FTLFreeEx((ms), (p), GTD_SUMMARY_WORDS(n_leaves) * sizeof(uint64_t), MEM_CLASS_GTD)
+#elif defined(SMALL_GTD_ARRAY)
 #define GTD_BITMAP_BYTES(n_mpns) (((n_mpns) + 7ull) / 8ull)
-#define FTL_MALLOC_GTD(n_mpns) FTLCallocEx(GTD_BITMAP_BYTES((n_mpns)), 1u, MEM_CLASS_GTD)
-#define FTL_FREE_GTD(p, n_mpns) FTLFreeEx((p), GTD_BITMAP_BYTES((n_mpns)), MEM_CLASS_GTD)
+#ifdef HUGEPAGE_BACKING
+#define FTL_MALLOC_GTD(ms, n_mpns) FTLMapHugeEx((ms), GTD_BITMAP_BYTES((n_mpns)), GTD_PREFAULT, MEM_CLASS_GTD)
+#define FTL_FREE_GTD(ms, p, n_mpns) FTLUnmapHugeEx((ms), (p), GTD_BITMAP_BYTES((n_mpns)), MEM_CLASS_GTD)
 #else
-#define FTL_MALLOC_GTD(n) FTLCallocEx((n), sizeof(uint64_t), MEM_CLASS_GTD)
-#define FTL_FREE_GTD(p, cap) FTLFreeEx((p), (size_t)(cap) * sizeof(uint64_t), MEM_CLASS_GTD)
+#define FTL_MALLOC_GTD(ms, n_mpns) FTLCallocEx((ms), GTD_BITMAP_BYTES((n_mpns)), 1u, MEM_CLASS_GTD)
+#define FTL_FREE_GTD(ms, p, n_mpns) FTLFreeEx((ms), (p), GTD_BITMAP_BYTES((n_mpns)), MEM_CLASS_GTD)
 #endif
-#define FTL_MALLOC_TPC(sz_tt) FTLMallocEx((sz_tt), MEM_CLASS_TPC)
-#define FTL_MALLOC_TPC_PAGE(n) FTLCallocEx((n), MAP_PAGE_BYTES, MEM_CLASS_TPC_PAGE)
-#define FTL_MALLOC_CMT_HASH_BUCKETS(n) FTLCallocEx((n), sizeof(cmt_entry *), MEM_CLASS_CMT_HASH)
-#define FTL_FREE_CTRL(p, sz_tt) FTLFreeEx((p), (sz_tt), MEM_CLASS_CTRL)
-#define FTL_FREE_ENTRIES(p, cap) FTLFreeEx((p), (size_t)(cap) * sizeof(cmt_entry), MEM_CLASS_ENTRIES)
-#define FTL_FREE_TPC(p, sz_tt) FTLFreeEx((p), (sz_tt), MEM_CLASS_TPC)
-#define FTL_FREE_CMT_HASH_BUCKETS(p, cap) FTLFreeEx((p), (size_t)(cap) * sizeof(cmt_entry *), MEM_CLASS_CMT_HASH)
-#define FTL_FREE_TPC_PAGE(p) FTLFreeEx((p), MAP_PAGE_BYTES, MEM_CLASS_TPC_PAGE)
-#define SSD_PWRITE_MAP(fd, buf, len, off) pwrite_full_with_stats((fd), (buf), (len), (off))
-
-#define FTL_MALLOC_PIPELINE(sz_tt) FTLMallocEx((sz_tt), MEM_CLASS_PIPELINE)
-#define FTL_FREE_PIPELINE(p, sz_tt) FTLFreeEx((p), (sz_tt), MEM_CLASS_PIPELINE)
-
-// 映射条目
-#define EPP (MAP_PAGE_BYTES / ENTRY_BYTES)
-
-#if ENTRY_BYTES == 8u
-static inline uint64_t lpn_to_mpn(uint64_t lpn) { return lpn >> 9; }
-static inline uint32_t lpn_to_off(uint64_t lpn) { return (uint32_t)(lpn & 511); }
 #else
-static inline uint64_t lpn_to_mpn(uint64_t lpn) { return lpn / (uint64_t)EPP; }
-static inline uint32_t lpn_to_off(uint64_t lpn) { return (uint32_t)(lpn % (uint64_t)EPP); }
+#ifdef HUGEPAGE_BACKING
+#define FTL_MALLOC_GTD(ms, n) FTLMapHugeEx((ms), (size_t)(n) * sizeof(uint64_t), GTD_PREFAULT, MEM_CLASS_GTD)
+#define FTL_FREE_GTD(ms, p, cap) FTLUnmapHugeEx((ms), (p), (size_t)(cap) * sizeof(uint64_t), MEM_CLASS_GTD)
+#else
+#define FTL_MALLOC_GTD(ms, n) FTLCallocEx((ms), (n), sizeof(uint64_t), MEM_CLASS_GTD)
+#define FTL_FREE_GTD(ms, p, cap) FTLFreeEx((ms), (p), (size_t)(cap) * sizeof(uint64_t), MEM_CLASS_GTD)
 #endif
-
-static inline uint64_t mpn_to_ppa(uint64_t mpn) { return mpn + 1; }
-static inline uint64_t ppa_to_mpn(uint64_t ppa) { return ppa - 1; }
-
-static inline void entry_store_u64(uint8_t *base, uint32_t idx, uint64_t v)
-{
-#if ENTRY_BYTES == 8u
-    ((uint64_t *)base)[idx] = v;
+#endif
+#define FTL_MALLOC_TPC(ms, sz_tt) FTLMallocEx((ms), (sz_tt), MEM_CLASS_TPC)
+#define FTL_MALLOC_TPC_PAGE(ms, n) FTLCallocEx((ms), (n), MAP_PAGE_BYTES, MEM_CLASS_TPC_PAGE)
+#define FTL_FREE_CTRL(ms, p, sz_tt) FTLFreeEx((ms), (p), (sz_tt), MEM_CLASS_CTRL)
+#define FTL_FREE_TPC(ms, p, sz_tt) FTLFreeEx((ms), (p), (sz_tt), MEM_CLASS_TPC)
+#define FTL_FREE_TPC_PAGE(ms, p) FTLFreeEx((ms), (p), MAP_PAGE_BYTES, MEM_CLASS_TPC_PAGE)
+#ifdef CACHE_LINE_OPTIMIZE
+#define FTL_MALLOC_TPC_TAGS(ms, n) FTLAllocAlignedEx((ms), (size_t)(n) * sizeof(uint64_t), TPC_TAG_ALIGN, MEM_CLASS_TPC)
 #else
-    uint8_t *p = base + (size_t)idx * 6u;
-    uint64_t x = v & 0xFFFFFFFFFFFFull;
-    p[0] = (uint8_t)(x);
-    p[1] = (uint8_t)(x >> 8);
-    p[2] = (uint8_t)(x >> 16);
-    p[3] = (uint8_t)(x >> 24);
-    p[4] = (uint8_t)(x >> 32);
-    p[5] = (uint8_t)(x >> 40);
+#define FTL_MALLOC_TPC_TAGS(ms, n) FTLMallocEx((ms), (size_t)(n) * sizeof(uint64_t), MEM_CLASS_TPC)
 #endif
+#define FTL_FREE_TPC_TAGS(ms, p, n) FTLFreeEx((ms), (p), (size_t)(n) * sizeof(uint64_t), MEM_CLASS_TPC)
+
+#define FTL_MALLOC_PIPELINE(ms, sz_tt) FTLMallocEx((ms), (sz_tt), MEM_CLASS_PIPELINE)
+#define FTL_FREE_PIPELINE(ms, p, sz_tt) FTLFreeEx((ms), (p), (sz_tt), MEM_CLASS_PIPELINE)
+#define FTL_MALLOC_ZCACHE(ms, sz_tt) FTLMallocEx((ms), (sz_tt), MEM_CLASS_ZCACHE)
+#define FTL_FREE_ZCACHE(ms, p, sz_tt) FTLFreeEx((ms), (p), (sz_tt), MEM_CLASS_ZCACHE)
+#define FTL_MALLOC_LIN(ms, cap) FTLMallocEx((ms), (size_t)(cap) * sizeof(LinEntry), MEM_CLASS_GTD)
+#define FTL_FREE_LIN(ms, p, cap) FTLFreeEx((ms), (p), (size_t)(cap) * sizeof(LinEntry), MEM_CLASS_GTD)
+#define FTL_MALLOC_MLOC(ms, cap) FTLMallocEx((ms), (size_t)(cap) * sizeof(MapLoc), MEM_CLASS_GTD)
+#define FTL_FREE_MLOC(ms, p, cap) FTLFreeEx((ms), (p), (size_t)(cap) * sizeof(MapLoc), MEM_CLASS_GTD)
+#define FTL_MALLOC_MLOC_FREE(ms, cap) FTLMallocEx((ms), (size_t)(cap) * sizeof(uint32_t), MEM_CLASS_GTD)
+#define FTL_FREE_MLOC_FREE(ms, p, cap) FTLFreeEx((ms), (p), (size_t)(cap) * sizeof(uint32_t), MEM_CLASS_GTD)
+#define FTL_MALLOC_LOG_OWNER(ms, n_segs) FTLMallocEx((ms), (size_t)(n_segs) * LOG_SEG_PAGES * sizeof(uint64_t), MEM_CLASS_GTD)
+#define FTL_FREE_LOG_OWNER(ms, p, n_segs) FTLFreeEx((ms), (p), (size_t)(n_segs) * LOG_SEG_PAGES * sizeof(uint64_t), MEM_CLASS_GTD)
+#define FTL_MALLOC_LOG_SEGS(ms, n_segs) FTLMallocEx((ms), (size_t)(n_segs) * (2u * sizeof(uint32_t) + 1u), MEM_CLASS_GTD)
+#define FTL_FREE_LOG_SEGS(ms, p, n_segs) FTLFreeEx((ms), (p), (size_t)(n_segs) * (2u * sizeof(uint32_t) + 1u), MEM_CLASS_GTD)
+
+// ========== NAND 时序模拟 ==========
+
+static void nand_sim_init(NandSim *n, const FTLNandConfig *c, MemStats *ms)
+{
+    memset(n, 0, sizeof(*n));
+    n->cfg = *c;
+    if (!n->cfg.channels) n->cfg.channels = 8;
+    if (!n->cfg.dies_per_channel) n->cfg.dies_per_channel = 4;
+    if (!n->cfg.planes_per_die) n->cfg.planes_per_die = 2;
+    if (!n->cfg.blocks_per_plane) n->cfg.blocks_per_plane = 1024;
+    if (!n->cfg.pages_per_block || n->cfg.pages_per_block > UINT16_MAX) n->cfg.pages_per_block = 256;
+    if (!n->cfg.t_read_ns) n->cfg.t_read_ns = 50000;
+    if (!n->cfg.t_prog_ns) n->cfg.t_prog_ns = 600000;
+    if (!n->cfg.t_erase_ns) n->cfg.t_erase_ns = 3000000;
+    if (!n->cfg.t_xfer_ns) n->cfg.t_xfer_ns = 5000;
+    n->n_dies = n->cfg.channels * n->cfg.dies_per_channel;
+    n->pages_per_die = (uint64_t)n->cfg.planes_per_die * n->cfg.blocks_per_plane * n->cfg.pages_per_block;
+    n->die_busy = (uint64_t *)FTL_CALLOC_CTRL(ms, n->n_dies, sizeof(uint64_t));
+    n->die_busy_ns = (uint64_t *)FTL_CALLOC_CTRL(ms, n->n_dies, sizeof(uint64_t));
+    n->ch_busy = (uint64_t *)FTL_CALLOC_CTRL(ms, n->cfg.channels, sizeof(uint64_t));
+    n->ch_busy_ns = (uint64_t *)FTL_CALLOC_CTRL(ms, n->cfg.channels, sizeof(uint64_t));
+    n->blk_prog = (uint16_t *)FTL_CALLOC_CTRL(ms, (size_t)n->n_dies * n->cfg.planes_per_die * n->cfg.blocks_per_plane,
+                                              sizeof(uint16_t));
+    n->enabled = true;
 }
 
-static inline uint64_t entry_load_u64(const uint8_t *base, uint32_t idx)
+static void nand_sim_free(NandSim *n, MemStats *ms)
 {
-#if ENTRY_BYTES == 8u
-    return ((const uint64_t *)base)[idx];
-#else
-    const uint8_t *p = base + (size_t)idx * 6u;
-    uint64_t x = (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) | ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40);
-    return x;
-#endif
+    if (!n->enabled)
+        return;
+    FTL_FREE_CTRL(ms, n->die_busy, (size_t)n->n_dies * sizeof(uint64_t));
+    FTL_FREE_CTRL(ms, n->die_busy_ns, (size_t)n->n_dies * sizeof(uint64_t));
+    FTL_FREE_CTRL(ms, n->ch_busy, (size_t)n->cfg.channels * sizeof(uint64_t));
+    FTL_FREE_CTRL(ms, n->ch_busy_ns, (size_t)n->cfg.channels * sizeof(uint64_t));
+    FTL_FREE_CTRL(ms, n->blk_prog, (size_t)n->n_dies * n->cfg.planes_per_die * n->cfg.blocks_per_plane * sizeof(uint16_t));
+    n->enabled = false;
 }
 
-// ========== 替换原来的 TPC 实现：采用 4-way set associative + 预分配 page_pool ==========
+// 在当前虚拟时刻发起一次读/写 [off, off+len) 覆盖的各页，返回最后一页完成的时刻。
+// 同一批中的请求都在同一时刻发起，各 die 并行；读由 nand_sim_complete 推进虚拟时钟
+static uint64_t nand_sim_issue(NandSim *n, off_t off, size_t len, bool write)
+{
+    if (len == 0)
+        return n->now;
+    uint64_t first = (uint64_t)off / MAP_PAGE_BYTES;
+    uint64_t last = ((uint64_t)off + len - 1) / MAP_PAGE_BYTES;
+    uint64_t done_max = n->now;
+    for (uint64_t p = first; p <= last; p++) {
+        uint32_t die = (uint32_t)(p % n->n_dies);
+        uint32_t ch = die % n->cfg.channels;
+        uint64_t q = p / n->n_dies;
+        if (unlikely(q >= n->pages_per_die)) {
+            q %= n->pages_per_die;
+            n->wrap_cnt++;
+        }
+        uint64_t start = n->die_busy[die] > n->now ? n->die_busy[die] : n->now;
+        uint64_t done;
+        if (!write) {
+            // 阵列读出到 die 的页寄存器，再经通道传出
+            uint64_t xfer = start + n->cfg.t_read_ns;
+            if (n->ch_busy[ch] > xfer)
+                xfer = n->ch_busy[ch];
+            done = xfer + n->cfg.t_xfer_ns;
+            n->read_cnt++;
+        } else {
+            // 先经通道传入，再编程；块写满一轮后先擦除
+            if (n->ch_busy[ch] > start)
+                start = n->ch_busy[ch];
+            uint64_t blk = (uint64_t)die * n->cfg.planes_per_die * n->cfg.blocks_per_plane + q / n->cfg.pages_per_block;
+            done = start + n->cfg.t_xfer_ns + n->cfg.t_prog_ns;
+            if (n->blk_prog[blk] >= n->cfg.pages_per_block) {
+                n->blk_prog[blk] = 0;
+                done += n->cfg.t_erase_ns;
+                n->erase_cnt++;
+            }
+            n->blk_prog[blk]++;
+            n->prog_cnt++;
+        }
+        uint64_t xfer_end = write ? start + n->cfg.t_xfer_ns : done;
+        n->ch_busy_ns[ch] += n->cfg.t_xfer_ns;
+        n->ch_busy[ch] = xfer_end;
+        n->die_busy_ns[die] += done - start;
+        n->die_busy[die] = done;
+        if (done > done_max)
+            done_max = done;
+    }
+    return done_max;
+}
 
-// TPC 结构
-#ifndef CACHE_LINE_OPTIMIZE
-typedef struct {
-    uint64_t mpn;
-    uint8_t *buffer;
-    uint8_t dirty;
-} TpcEntry;
-#else
-typedef struct {
-    uint64_t mpn;
-    uint32_t buf_idx;  // 改为索引
-    uint8_t dirty;
-    uint8_t pad[3];    // 凑齐 16 bytes，保证对齐
-} TpcEntry;
-#endif
+// 同步读的发起者等到 done 时刻
+static inline void nand_sim_complete(NandSim *n, uint64_t done)
+{
+    if (done > n->now) {
+        n->read_stall_ns += done - n->now;
+        n->now = done;
+    }
+}
 
-typedef struct {
-    TpcEntry ways[TPC_WAYS];
-    uint8_t next_victim;
-} TpcSet;
+// 设备时间：虚拟时钟与所有 die 忙完时刻中的最大者
+static uint64_t nand_sim_device_ns(const NandSim *n)
+{
+    uint64_t t = n->now;
+    for (uint32_t i = 0; i < n->n_dies; i++) {
+        if (n->die_busy[i] > t)
+            t = n->die_busy[i];
+    }
+    return t;
+}
 
-// ========== CMT 结构（原样保留，默认 USE_CMT 未启用） ==========
+// ========== 映射 I/O 后端 ==========
+// 所有 map.ssd 读写都经过 MapIo：调用者用 map_io_read / map_io_write 把请求排进当前批，
+// map_io_wait 一次等齐整批。读请求完成前缓冲区内容未定义，写请求完成前缓冲区不能改动
+// (map_io_write_copy 先把内容拷进暂存页，返回后缓冲区即可复用)。
+// 后端不保证批内顺序：新请求与批中某个请求地址重叠且其中有写时，先等齐当前批再排入。
+// 读失败或读到文件末尾之外时得到全0，写失败直接退出(与原 pread_full/pwrite_full 的用法一致)
 
-typedef struct cmt_entry
+// O_DIRECT 的读写被拒(EINVAL，如文件系统只在打开时接受 O_DIRECT)时关掉它，返回 true 表示值得重做
+static bool map_io_drop_direct(MapIo *io)
 {
-    uint64_t lpn;
-    uint64_t ppn;
-    uint8_t dirty;
-    QTAILQ_ENTRY(cmt_entry) entry;
-    struct cmt_entry *hnext; // for hash
-} cmt_entry;
+    if (!io->direct || errno != EINVAL)
+        return false;
+    int fl = fcntl(io->fd, F_GETFL);
+    if (fl < 0 || fcntl(io->fd, F_SETFL, fl & ~O_DIRECT) != 0)
+        return false;
+    io->direct = false;
+    fprintf(stderr, "map I/O: O_DIRECT request rejected, switching map.ssd to buffered I/O\n");
+    return true;
+}
 
-typedef struct
+// 同步补做一段读写：读失败得到全0，写失败直接退出
+static void mapio_sync_rw(MapIo *io, void *buf, uint32_t len, off_t off, bool write)
 {
-    cmt_entry **cmt_table;
-} cmt_hash_table;
+    do {
+        if (write ? pwrite_full(io->fd, buf, len, off) == (ssize_t)len : pread_full(io->fd, buf, len, off) >= 0)
+            return;
+    } while (map_io_drop_direct(io));
+    if (write) {
+        perror("pwrite failed");
+        exit(1);
+    }
+    memset(buf, 0, len);
+}
 
-// ========== FTL 主控制块：融合 TPC / GTD / CMT / 多线程状态 ==========
+static bool mapio_pread_open(MapIo *io)
+{
+    (void)io;
+    return true;
+}
 
-typedef struct
+static void mapio_pread_submit(MapIo *io, uint32_t idx)
 {
-    uint64_t total_lpns;
-    uint64_t total_mpns;
+    (void)io;
+    (void)idx; // 推迟到 poll 时执行，以便合并相邻请求
+}
 
-    cmt_entry *cmt_entries;
-    uint64_t tt_entries;
+// 执行 reqs[i, j)：它们方向相同、地址首尾相接
+static void mapio_pread_run(MapIo *io, uint32_t i, uint32_t j)
+{
+    MapIoReq *r = &io->reqs[i];
+    if (j - i > 1) {
+        struct iovec iov[MAPIO_QD];
+        size_t total = 0;
+        for (uint32_t k = i; k < j; k++) {
+            iov[k - i].iov_base = io->reqs[k].buf;
+            iov[k - i].iov_len = io->reqs[k].len;
+            total += io->reqs[k].len;
+        }
+        ssize_t n = r->write ? pwritev(io->fd, iov, (int)(j - i), r->off)
+                             : preadv(io->fd, iov, (int)(j - i), r->off);
+        if (n == (ssize_t)total)
+            return;
+        // 部分完成(含读到文件末尾)：逐个重做，pread_full 会把读不到的部分清零
+    }
+    for (uint32_t k = i; k < j; k++)
+        mapio_sync_rw(io, io->reqs[k].buf, io->reqs[k].len, io->reqs[k].off, io->reqs[k].write);
+}
 
-    QTAILQ_HEAD(free_cmt_entry_list, cmt_entry) free_cmt_entry_list;
-    uint64_t free_cmt_entry_cnt;
+static void mapio_pread_poll(MapIo *io)
+{
+    uint32_t i = 0;
+    while (i < io->pending) {
+        uint32_t j = i + 1;
+        while (j < io->pending && io->reqs[j].write == io->reqs[i].write &&
+               io->reqs[j].off == io->reqs[j - 1].off + (off_t)io->reqs[j - 1].len)
+            j++;
+        mapio_pread_run(io, i, j);
+        i = j;
+    }
+}
 
-    QTAILQ_HEAD(cmt_entry_list, cmt_entry) cmt_entry_list;
-    uint64_t used_cmt_entry_cnt;
-
-#ifdef SMALL_GTD_ARRAY
-    uint8_t *gtd; // 位图，每 bit 表示对应 mpn 是否已分配
-#else
-    uint64_t *gtd;   // GTD, 记录mpn->mpn_ppa
-#endif
-
-    cmt_hash_table cmt_hash;
-    int fd_map;
-
-    // 新 TPC：4-way 组相联 + 预分配页池
-    TpcSet tpc_sets[TPC_SETS];
-    uint8_t *page_pool_base; // 共 TPC_SETS*TPC_WAYS 页
-
-    bool small_input_mode;
+static int mapio_pread_flush(MapIo *io)
+{
+    return fdatasync(io->fd);
+}
 
-    bool multi_threaded;
+static void mapio_pread_close(MapIo *io)
+{
+    (void)io;
+}
 
-    // Last-Hit 优化缓存
-#ifdef LAST_HIT_OPTIMIZE
-    uint64_t last_mpn;
-    TpcEntry *last_entry;
-#endif
-} FTL;
+// 文件后端共用：在 map.ssd 中打洞，文件长度不变
+static int mapio_fd_discard(MapIo *io, off_t off, uint64_t len)
+{
+    return fallocate(io->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, (off_t)len);
+}
 
-static FTL *g = NULL;
+static const MapIoOps g_mapio_pread_ops = {
+    "pread", mapio_pread_open, mapio_pread_submit, mapio_pread_poll, mapio_pread_flush, mapio_fd_discard,
+    mapio_pread_close,
+};
 
-// ========== GTD 位图操作（原有 SMALL_GTD_ARRAY 逻辑） ==========
+#ifdef MAPIO_HAVE_URING
+// io_uring 后端：直接用系统调用，不依赖 liburing。请求只填进 SQ，poll 时一次 io_uring_enter 提交整批并等齐完成。
+// 个别请求失败或只完成一部分(如 OP_READ 不受支持、读到文件末尾)时，剩余部分改用同步读写补上
 
-#ifdef SMALL_GTD_ARRAY
-static inline bool gtd_is_allocated(const FTL *d, uint64_t mpn)
+static bool mapio_uring_open(MapIo *io)
 {
-    return (d->gtd[mpn >> 3] >> (mpn & 7u)) & 1u;
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = (int)syscall(__NR_io_uring_setup, MAPIO_QD, &p);
+    if (fd < 0)
+        return false;
+    io->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    io->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (io->cq_ring_sz > io->sq_ring_sz)
+            io->sq_ring_sz = io->cq_ring_sz;
+        io->cq_ring_sz = io->sq_ring_sz;
+    }
+    io->sq_ring = mmap(NULL, io->sq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (io->sq_ring == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        io->cq_ring = io->sq_ring;
+    } else {
+        io->cq_ring = mmap(NULL, io->cq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (io->cq_ring == MAP_FAILED) {
+            munmap(io->sq_ring, io->sq_ring_sz);
+            close(fd);
+            return false;
+        }
+    }
+    io->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    io->sqes = (struct io_uring_sqe *)mmap(NULL, io->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                           fd, IORING_OFF_SQES);
+    if (io->sqes == MAP_FAILED) {
+        if (io->cq_ring != io->sq_ring)
+            munmap(io->cq_ring, io->cq_ring_sz);
+        munmap(io->sq_ring, io->sq_ring_sz);
+        close(fd);
+        return false;
+    }
+    uint8_t *sq = (uint8_t *)io->sq_ring, *cq = (uint8_t *)io->cq_ring;
+    io->sq_tail = (uint32_t *)(sq + p.sq_off.tail);
+    io->sq_mask = *(uint32_t *)(sq + p.sq_off.ring_mask);
+    io->sq_array = (uint32_t *)(sq + p.sq_off.array);
+    io->cq_head = (uint32_t *)(cq + p.cq_off.head);
+    io->cq_tail = (uint32_t *)(cq + p.cq_off.tail);
+    io->cq_mask = *(uint32_t *)(cq + p.cq_off.ring_mask);
+    io->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    io->ring_fd = fd;
+    io->queued = 0;
+    return true;
 }
 
-static inline void gtd_mark_allocated(FTL *d, uint64_t mpn)
+static void mapio_uring_submit(MapIo *io, uint32_t idx)
 {
-    d->gtd[mpn >> 3] |= (uint8_t)(1u << (mpn & 7u));
-}
-#endif
-
-// ========== TPC 4-way 实现 ==========
-
-static inline uint32_t tpc_get_set_idx(uint64_t mpn) {
-    return (uint32_t)(mpn & TPC_SET_MASK);
+    const MapIoReq *r = &io->reqs[idx];
+    if (r->write && !io->direct) {
+        // 缓冲写在不支持 nowait 缓冲写的文件系统(如 ext4)上会被转给 io-wq 线程，线程切换比 pwrite 本身还贵：
+        // 直接写进页缓存，批中只剩读请求走 io_uring
+        mapio_sync_rw(io, r->buf, r->len, r->off, true);
+        io->uring_done++;
+        return;
+    }
+    uint32_t tail = *io->sq_tail;
+    uint32_t i = tail & io->sq_mask;
+    struct io_uring_sqe *sqe = &io->sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = r->write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = io->fd;
+    sqe->addr = (uint64_t)(uintptr_t)r->buf;
+    sqe->len = r->len;
+    sqe->off = (uint64_t)r->off;
+    sqe->user_data = idx;
+    io->sq_array[i] = i;
+    __atomic_store_n(io->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    io->queued++;
 }
 
-static inline void tpc_flush_entry(FTL *d, TpcEntry *e) {
-    if (CHECK_TPC_ENTRY_VALID(e) && e->dirty) {
-        // 【新增补丁】: 在写盘前，再次确认/强制标记 GTD！
-        // 防止之前 gtd_mark_allocated 没生效，或者位图意外丢失
-#ifdef SMALL_GTD_ARRAY
-        if (!gtd_is_allocated(d, e->mpn)) {
-            gtd_mark_allocated(d, e->mpn);
-        }
-#endif
-        off_t offset = (off_t)(e->mpn) * MAP_PAGE_BYTES;
-#ifndef CACHE_LINE_OPTIMIZE
-        if (SSD_PWRITE_MAP(d->fd_map, e->buffer, MAP_PAGE_BYTES, offset) != (ssize_t)MAP_PAGE_BYTES) {
-            perror("pwrite failed");
+static void mapio_uring_poll(MapIo *io)
+{
+    uint32_t to_submit = io->queued, done = io->uring_done;
+    io->uring_done = 0;
+    while (done < io->pending) {
+        int r = (int)syscall(__NR_io_uring_enter, io->ring_fd, to_submit, io->pending - done,
+                             IORING_ENTER_GETEVENTS, NULL, 0);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("io_uring_enter failed");
             exit(1);
         }
-#else
-        uint8_t *real_buffer = GET_TPC_PTR(d, e->buf_idx);
-        if (SSD_PWRITE_MAP(d->fd_map, real_buffer, MAP_PAGE_BYTES, offset) != (ssize_t)MAP_PAGE_BYTES) {
-            perror("pwrite failed");
-            exit(1);
+        to_submit -= (uint32_t)r < to_submit ? (uint32_t)r : to_submit;
+        uint32_t head = *io->cq_head;
+        uint32_t tail = __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            const struct io_uring_cqe *cqe = &io->cqes[head & io->cq_mask];
+            MapIoReq *q = &io->reqs[cqe->user_data];
+            uint32_t got = cqe->res > 0 ? (uint32_t)cqe->res : 0;
+            if (got < q->len) {
+                if (cqe->res < 0)
+                    errno = -cqe->res;
+                mapio_sync_rw(io, (uint8_t *)q->buf + got, q->len - got, q->off + (off_t)got, q->write);
+            }
+            done++;
         }
-#endif
-        e->dirty = 0;
-        memstats_add(&g_memstats.tpc_dirty_handle_cnt, 1);
+        __atomic_store_n(io->cq_head, head, __ATOMIC_RELEASE);
     }
+    io->queued = 0;
 }
 
-static uint8_t *tpc_get_buffer(FTL *d, uint64_t mpn, int is_write) {
-    memstats_add(&g_memstats.tpc_query_cnt, 1);
-#ifdef LAST_HIT_OPTIMIZE
-    // 检查是否命中上一次访问的页
-    if (likely(d->last_mpn == mpn)) {
-        if (is_write) d->last_entry->dirty = 1;
-        memstats_add(&g_memstats.tpc_hit_cnt, 1);
-#ifdef CACHE_LINE_OPTIMIZE
-        return GET_TPC_PTR(d, d->last_entry->buf_idx);
-#else
-        return d->last_entry->buffer;
-#endif
-    }
-#endif
-    uint32_t set_idx = tpc_get_set_idx(mpn);
-    TpcSet *set = &d->tpc_sets[set_idx];
+static int mapio_uring_flush(MapIo *io)
+{
+    return fdatasync(io->fd);
+}
 
-    // 查找命中
-    for (int i = 0; i < TPC_WAYS; i++) {
-        if (set->ways[i].mpn == mpn) {
-            if (is_write) set->ways[i].dirty = 1;
-            memstats_add(&g_memstats.tpc_hit_cnt, 1);
-#ifdef LAST_HIT_OPTIMIZE
-            d->last_mpn = mpn;
-            d->last_entry = &set->ways[i];
-#endif
-#ifndef CACHE_LINE_OPTIMIZE
-            return set->ways[i].buffer;
-#else
-            return GET_TPC_PTR(d, set->ways[i].buf_idx);
+static void mapio_uring_close(MapIo *io)
+{
+    munmap(io->sqes, io->sqes_sz);
+    if (io->cq_ring != io->sq_ring)
+        munmap(io->cq_ring, io->cq_ring_sz);
+    munmap(io->sq_ring, io->sq_ring_sz);
+    close(io->ring_fd);
+    io->ring_fd = -1;
+}
+
+static const MapIoOps g_mapio_uring_ops = {
+    "io_uring", mapio_uring_open, mapio_uring_submit, mapio_uring_poll, mapio_uring_flush, mapio_fd_discard,
+    mapio_uring_close,
+};
 #endif
-        }
-    }
-    // 未命中：选 victim
-    int victim_way = set->next_victim;
-    TpcEntry *e = &set->ways[victim_way];
-    set->next_victim = (uint8_t)((set->next_victim + 1) & TPC_WAYS_MASK);
 
-    if (CHECK_TPC_ENTRY_VALID(e)) {
-        tpc_flush_entry(d, e);
+// 内存后端：按 4KB 块保存 map.ssd 的内容，两级目录(每个叶子 MAPIO_MEM_LEAF 个块指针)，块在第一次写入时分配。
+// 请求在提交时即完成
+static bool mapio_mem_open(MapIo *io)
+{
+    io->mem_cap = 0;
+    io->mem_dir = NULL;
+    return true;
+}
+
+// 第 bi 块的地址；alloc 为 false 且块不存在时返回 NULL
+static uint8_t *mapio_mem_block(MapIo *io, uint64_t bi, bool alloc)
+{
+    uint64_t li = bi / MAPIO_MEM_LEAF;
+    if (li >= io->mem_cap) {
+        if (!alloc)
+            return NULL;
+        uint64_t cap = io->mem_cap ? io->mem_cap : 64;
+        while (cap <= li)
+            cap *= 2;
+        uint8_t ***nd = (uint8_t ***)FTLCalloc(cap, sizeof(uint8_t **));
+        if (io->mem_cap)
+            memcpy(nd, io->mem_dir, io->mem_cap * sizeof(uint8_t **));
+        FTLFree(io->mem_dir, io->mem_cap * sizeof(uint8_t **));
+        memstats_add(io->ms, &io->ms->map_mem_used, (cap - io->mem_cap) * sizeof(uint8_t **));
+        io->mem_dir = nd;
+        io->mem_cap = cap;
     }
+    uint8_t **leaf = io->mem_dir[li];
+    if (!leaf) {
+        if (!alloc)
+            return NULL;
+        leaf = io->mem_dir[li] = (uint8_t **)FTLCalloc(MAPIO_MEM_LEAF, sizeof(uint8_t *));
+        memstats_add(io->ms, &io->ms->map_mem_used, MAPIO_MEM_LEAF * sizeof(uint8_t *));
+    }
+    uint8_t **slot = &leaf[bi % MAPIO_MEM_LEAF];
+    if (!*slot && alloc) {
+        *slot = (uint8_t *)FTLCalloc(1, MAP_PAGE_BYTES);
+        memstats_add(io->ms, &io->ms->map_mem_used, MAP_PAGE_BYTES);
+    }
+    return *slot;
+}
 
-    e->mpn = mpn;
-    e->dirty = is_write ? 1 : 0;
+static void mapio_mem_submit(MapIo *io, uint32_t idx)
+{
+    const MapIoReq *r = &io->reqs[idx];
+    uint8_t *p = (uint8_t *)r->buf;
+    uint64_t off = (uint64_t)r->off;
+    uint32_t left = r->len;
+    while (left) {
+        uint64_t bi = off / MAP_PAGE_BYTES;
+        uint32_t in = (uint32_t)(off % MAP_PAGE_BYTES);
+        uint32_t n = MAP_PAGE_BYTES - in < left ? MAP_PAGE_BYTES - in : left;
+        uint8_t *blk = mapio_mem_block(io, bi, r->write);
+        if (r->write)
+            memcpy(blk + in, p, n);
+        else if (blk)
+            memcpy(p, blk + in, n);
+        else
+            memset(p, 0, n);
+        p += n;
+        off += n;
+        left -= n;
+    }
+}
 
-#ifdef LAST_HIT_OPTIMIZE
-    d->last_mpn = mpn;
-    d->last_entry = e;
-#endif
+static void mapio_mem_poll(MapIo *io)
+{
+    (void)io;
+}
 
-#ifndef CACHE_LINE_OPTIMIZE
-    uint8_t *real_buffer = e->buffer;
-#else
-    uint8_t *real_buffer = GET_TPC_PTR(d, e->buf_idx);
-#endif
+static int mapio_mem_flush(MapIo *io)
+{
+    (void)io;
+    return 0;
+}
 
-    // 查看 GTD 决定是否读盘
-#ifdef SMALL_GTD_ARRAY
-    if (gtd_is_allocated(d, mpn)) {
-        off_t offset = (off_t)mpn * MAP_PAGE_BYTES;
-        if (pread_full(d->fd_map, real_buffer, MAP_PAGE_BYTES, offset) < 0) {
-            memset(real_buffer, 0, MAP_PAGE_BYTES);
+// 释放完全落在 [off, off + len) 内的块；部分覆盖的块清零对应部分
+static int mapio_mem_discard(MapIo *io, off_t off, uint64_t len)
+{
+    uint64_t pos = (uint64_t)off, end = pos + len;
+    while (pos < end) {
+        uint64_t bi = pos / MAP_PAGE_BYTES;
+        uint32_t in = (uint32_t)(pos % MAP_PAGE_BYTES);
+        uint32_t n = MAP_PAGE_BYTES - in < end - pos ? MAP_PAGE_BYTES - in : (uint32_t)(end - pos);
+        uint8_t *blk = mapio_mem_block(io, bi, false);
+        if (blk && n == MAP_PAGE_BYTES) {
+            FTLFree(blk, MAP_PAGE_BYTES);
+            memstats_sub(io->ms, &io->ms->map_mem_used, MAP_PAGE_BYTES);
+            io->mem_dir[bi / MAPIO_MEM_LEAF][bi % MAPIO_MEM_LEAF] = NULL;
+        } else if (blk) {
+            memset(blk + in, 0, n);
         }
-    } else {
-        if (is_write) gtd_mark_allocated(d, mpn);
-        memset(real_buffer, 0, MAP_PAGE_BYTES);
+        pos += n;
     }
-#else
-    uint64_t ppa = d->gtd[mpn];
-    if (ppa == INVALID_PPA) {
-        if (is_write) {
-            d->gtd[mpn] = mpn_to_ppa(mpn);
-        }
-        memset(real_buffer, 0, MAP_PAGE_BYTES);
-    } else {
-        off_t offset = (off_t)ppa_to_mpn(ppa) * MAP_PAGE_BYTES;
-        if (pread_full(d->fd_map, real_buffer, MAP_PAGE_BYTES, offset) < 0) {
-            memset(real_buffer, 0, MAP_PAGE_BYTES);
+    return 0;
+}
+
+static void mapio_mem_close(MapIo *io)
+{
+    for (uint64_t li = 0; li < io->mem_cap; li++) {
+        uint8_t **leaf = io->mem_dir[li];
+        if (!leaf)
+            continue;
+        for (uint32_t i = 0; i < MAPIO_MEM_LEAF; i++) {
+            if (leaf[i]) {
+                FTLFree(leaf[i], MAP_PAGE_BYTES);
+                memstats_sub(io->ms, &io->ms->map_mem_used, MAP_PAGE_BYTES);
+            }
         }
+        FTLFree(leaf, MAPIO_MEM_LEAF * sizeof(uint8_t *));
+        memstats_sub(io->ms, &io->ms->map_mem_used, MAPIO_MEM_LEAF * sizeof(uint8_t *));
     }
-#endif
-    return real_buffer;
+    FTLFree(io->mem_dir, io->mem_cap * sizeof(uint8_t **));
+    memstats_sub(io->ms, &io->ms->map_mem_used, io->mem_cap * sizeof(uint8_t **));
+    io->mem_dir = NULL;
+    io->mem_cap = 0;
 }
 
-// ========== CMT 相关（保持原逻辑，默认 USE_CMT 未启用） ==========
+static const MapIoOps g_mapio_mem_ops = {
+    "memory", mapio_mem_open, mapio_mem_submit, mapio_mem_poll, mapio_mem_flush, mapio_mem_discard, mapio_mem_close,
+};
 
-static uint64_t gtd_get_ppa_for_mpn(FTL *d, uint64_t mpn) {
-    if (mpn >= d->total_mpns) {
-        fprintf(stderr, "gtd_get_ppa_for_mpn: mpn out of range\n");
-        exit(1);
-    }
-#ifdef SMALL_GTD_ARRAY
-    if (!gtd_is_allocated(d, mpn)) {
-        return INVALID_PPA;
+static void map_io_open(MapIo *io, int fd, uint32_t backend, MemStats *ms, SsdStats *ss, NandSim *nand)
+{
+    memset(io, 0, sizeof(*io));
+    io->ms = ms;
+    io->ss = ss;
+    io->nand = nand;
+    io->fd = fd;
+    io->ring_fd = -1;
+#ifdef MAP_DIRECT_IO
+    if (backend != FTL_MAP_BACKEND_MEM) {
+        // 在已打开的 fd 上加 O_DIRECT：不支持直接 I/O 的文件系统(如旧内核的 tmpfs)在这里就返回 EINVAL
+        int fl = fcntl(fd, F_GETFL);
+        if (fl >= 0 && fcntl(fd, F_SETFL, fl | O_DIRECT) == 0)
+            io->direct = true;
+        else
+            fprintf(stderr, "map I/O: O_DIRECT unavailable on map.ssd (%s), using buffered I/O\n", strerror(errno));
     }
-    return mpn_to_ppa(mpn);
-#else
-    return d->gtd[mpn];
 #endif
+    switch (backend) {
+#ifdef MAPIO_HAVE_URING
+    case FTL_MAP_BACKEND_IO_URING:
+        io->ops = &g_mapio_uring_ops;
+        break;
+#endif
+    case FTL_MAP_BACKEND_MEM:
+        io->ops = &g_mapio_mem_ops;
+        break;
+    default:
+        io->ops = &g_mapio_pread_ops;
+        break;
+    }
+    if (!io->ops->open(io)) {
+        fprintf(stderr, "map I/O: %s backend unavailable (%s), falling back to pread\n", io->ops->name, strerror(errno));
+        io->ops = &g_mapio_pread_ops;
+    }
 }
 
-// 从TPC读取lpn对应ppn（未分配则返回UNMAPPED）
-static uint64_t read_ppn_from_map_with_gtd(FTL *d, uint64_t lpn)
+// 等齐当前批的全部请求
+static void map_io_wait(MapIo *io)
 {
-    // 原实现：使用 tpc_page 结构及 LRU；现改为使用 tpc_get_buffer
-    uint64_t mpn = lpn_to_mpn(lpn);
-    uint32_t off = lpn_to_off(lpn);
-#ifdef DISABLE_TPC
-    // === 无 TPC 模式：直接读盘 ===
-    
-    // 1. 检查 GTD 是否已分配
-#ifdef SMALL_GTD_ARRAY
-    if (!gtd_is_allocated(d, mpn)) return UNMAPPED_PPA;
-#else
-    if (d->gtd[mpn] == INVALID_PPA) return UNMAPPED_PPA;
+    if (io->pending) {
+        io->ops->poll(io);
+#ifdef DEBUG_FTL
+        io->ms->mapio_batch_cnt++;
+        io->ms->mapio_req_cnt += io->pending;
 #endif
-
-    // 2. 准备临时 buffer (4KB)
-    uint8_t buf[MAP_PAGE_BYTES]; // 栈上分配，速度快
-
-    // 3. 计算偏移并读取 (注意强制转 uint64 防止溢出)
-    off_t offset = (off_t)((uint64_t)mpn * MAP_PAGE_BYTES);
-    
-    // 4. 直接读取 Flash
-    if (pread_full(d->fd_map, buf, MAP_PAGE_BYTES, offset) < 0) {
-        return UNMAPPED_PPA; // 读取失败视为未映射
+        io->pending = 0;
+    }
+    io->write_pending = false;
+    io->stage_used = 0;
+    if (io->nand_read_pending) {
+        nand_sim_complete(io->nand, io->nand_read_done);
+        io->nand_read_pending = false;
     }
-
-    // 5. 提取数据
-    uint64_t v = entry_load_u64(buf, off);
-    if (v == 0) return UNMAPPED_PPA;
-    return v;
-#else
-    uint8_t *buf = tpc_get_buffer(d, mpn, 0);
-#ifdef FAST_CONSTANTS
-    return ((const uint64_t *)buf)[off];
-#else
-    uint64_t v = entry_load_u64(buf, off);
-    if (v == 0) return UNMAPPED_PPA;
-    return v;
-#endif
-#endif
 }
 
-// 写入条目到TPC页，必要时分配映射页并在写回时统一刷盘
-static void write_ppn_to_map_with_gtd(FTL *d, uint64_t lpn, uint64_t ppn)
+static void map_io_close(MapIo *io)
 {
-    // 原实现：获取 tpc_page，可能懒分配 buf；现在统一使用 tpc_get_buffer
-    uint64_t mpn = lpn_to_mpn(lpn);
-    uint32_t off = lpn_to_off(lpn);
-#ifdef DISABLE_TPC
-    // === 无 TPC 模式：读-改-写 ===
-    uint8_t buf[MAP_PAGE_BYTES];
-    off_t offset = (off_t)((uint64_t)mpn * MAP_PAGE_BYTES);
-    bool need_read = false;
-
-    // 1. 检查并标记 GTD
-#ifdef SMALL_GTD_ARRAY
-    if (gtd_is_allocated(d, mpn)) {
-        need_read = true;
-    } else {
-        gtd_mark_allocated(d, mpn);
-        need_read = false; // 新页，全0，不用读
-    }
-#else
-    if (d->gtd[mpn] != INVALID_PPA) {
-        need_read = true;
-    } else {
-        d->gtd[mpn] = mpn_to_ppa(mpn);
-        need_read = false;
+    map_io_wait(io);
+    if (io->ops)
+        io->ops->close(io);
+    io->ops = NULL;
+    for (uint32_t i = 0; i < MAPIO_QD && io->stage[i]; i++) {
+        free(io->stage[i]);
+        io->stage[i] = NULL;
+        memstats_sub(io->ms, &io->ms->ctrl_used, MAP_PAGE_BYTES);
     }
-#endif
+}
 
-    // 2. 如果是旧页，先读进来；如果是新页，清零
-    if (need_read) {
-        if (pread_full(d->fd_map, buf, MAP_PAGE_BYTES, offset) < 0) {
-            memset(buf, 0, MAP_PAGE_BYTES); // 读取失败当做新页处理
+// 为新请求腾出位置：批已满，或与批中某个请求地址重叠且其中有写时，先等齐当前批
+static inline void map_io_reserve(MapIo *io, off_t off, uint32_t len, bool write)
+{
+    if (unlikely(io->pending == MAPIO_QD)) {
+        map_io_wait(io);
+        return;
+    }
+    if (!write && !io->write_pending)
+        return;
+    for (uint32_t i = 0; i < io->pending; i++) {
+        const MapIoReq *r = &io->reqs[i];
+        if ((write || r->write) && off < r->off + (off_t)r->len && r->off < off + (off_t)len) {
+            map_io_wait(io);
+            return;
         }
-    } else {
-        memset(buf, 0, MAP_PAGE_BYTES);
     }
+}
 
-    // 3. 修改数据
-    entry_store_u64(buf, off, ppn);
-
-    // 4. 直接写回 Flash
-    // 注意：使用 pwrite_full_with_stats 以便计入写入量统计
-    if (pwrite_full_with_stats(d->fd_map, buf, MAP_PAGE_BYTES, offset) < 0) {
-        perror("No-TPC write failed");
-        exit(1);
+// 把请求排进当前批，调用者已经 map_io_reserve 过
+static inline void map_io_push(MapIo *io, void *buf, uint32_t len, off_t off, bool write)
+{
+    if (unlikely(io->nand->enabled)) {
+        uint64_t t = nand_sim_issue(io->nand, off, len, write);
+        if (!write && (!io->nand_read_pending || t > io->nand_read_done)) {
+            io->nand_read_done = t;
+            io->nand_read_pending = true;
+        }
     }
-
-#else
-    uint8_t *buf = tpc_get_buffer(d, mpn, 1);
-    entry_store_u64(buf, off, ppn);
-#endif
+    uint32_t idx = io->pending++;
+    MapIoReq *r = &io->reqs[idx];
+    r->buf = buf;
+    r->len = len;
+    r->off = off;
+    r->write = write;
+    io->write_pending |= write;
+    io->ops->submit(io, idx);
 }
 
-// 以下 CMT hash 仍保留（如后续开启 USE_CMT 时可用）
-static uint64_t hash_lpn(uint64_t lpn) {
-    return lpn & CMT_HASH_MASK;
+static inline void map_io_queue(MapIo *io, void *buf, uint32_t len, off_t off, bool write)
+{
+    map_io_reserve(io, off, len, write);
+    map_io_push(io, buf, len, off, write);
 }
 
-static void cachehash_init(cmt_hash_table *h, uint64_t sz)
+static inline void map_io_read(MapIo *io, void *buf, uint32_t len, off_t off)
 {
-    h->cmt_table = (cmt_entry **)FTL_MALLOC_CMT_HASH_BUCKETS(sz);
-    memset(h->cmt_table, 0, (size_t)sz * sizeof(cmt_entry *));
+#ifdef DEBUG_FTL
+    io->ss->map_pages_read_cnt++;
+    io->ss->map_bytes_read += len;
+#endif
+    map_io_queue(io, buf, len, off, false);
 }
 
-static void cachehash_destroy(cmt_hash_table *h)
+static inline void map_io_write(MapIo *io, const void *buf, uint32_t len, off_t off)
 {
-    FTL_FREE_CMT_HASH_BUCKETS(h->cmt_table, CMT_HASH_SIZE);
-    h->cmt_table = NULL;
+    ssdstats_on_write_map(io->ss, off, len);
+    map_io_queue(io, (void *)buf, len, off, true);
 }
 
-static cmt_entry *cachehash_find(cmt_hash_table *h, uint64_t lpn)
+// 写入 buf(不超过一页)的副本：返回后 buf 即可改动，写请求留在当前批，与之后的读一起等齐。
+// 暂存页随批中的写回数增长，最多 MAPIO_QD 页
+static void map_io_write_copy(MapIo *io, const void *buf, uint32_t len, off_t off)
 {
-    memstats_add(&g_memstats.cmt_query_cnt, 1);
-    cmt_entry *p = h->cmt_table[hash_lpn(lpn)];
-    while (p)
-    {
-        if (p->lpn == lpn){
-            memstats_add(&g_memstats.cmt_hit_cnt, 1);
-            return p;
+    ssdstats_on_write_map(io->ss, off, len);
+    map_io_reserve(io, off, len, true);
+    uint8_t **s = &io->stage[io->stage_used++];
+    if (!*s) {
+        if (posix_memalign((void **)s, MAP_IO_ALIGN, MAP_PAGE_BYTES) != 0) {
+            perror("posix_memalign failed");
+            exit(1);
         }
-        p = p->hnext;
+        memstats_add(io->ms, &io->ms->ctrl_used, MAP_PAGE_BYTES);
     }
-    return NULL;
+    memcpy(*s, buf, len);
+    map_io_push(io, *s, len, off, true);
 }
 
-static void cachehash_insert(cmt_hash_table *h, cmt_entry *n)
+static inline void map_io_read_sync(MapIo *io, void *buf, uint32_t len, off_t off)
 {
-    uint64_t idx = hash_lpn(n->lpn);
-    n->hnext = h->cmt_table[idx];
-    h->cmt_table[idx] = n;
+    map_io_read(io, buf, len, off);
+    map_io_wait(io);
 }
 
-static void cachehash_remove(cmt_hash_table *h, cmt_entry *n)
+#ifdef MAP_WARM_RESTART
+// 先等齐未完成的写，再把已写入的内容持久化(只有检查点需要)
+static int map_io_flush(MapIo *io)
 {
-    uint32_t idx = hash_lpn(n->lpn);
-    cmt_entry *p = h->cmt_table[idx], *prev = NULL;
-    while (p)
-    {
-        if (p == n)
-        {
-            if (prev)
-                prev->hnext = p->hnext;
-            else
-                h->cmt_table[idx] = p->hnext;
-            n->hnext = NULL;
-            return;
-        }
-        prev = p;
-        p = p->hnext;
-    }
-    perror("Cachehash_remove did not find the entry\n");
+    map_io_wait(io);
+    return io->ops->flush(io);
 }
+#endif
 
-static void cmt_entry_bind(FTL *d, cmt_entry *n, uint64_t lpn, uint64_t ppn, uint8_t dirty)
+// 释放 [off, off + len) 的盘上空间。先等齐当前批，排在前面的写不会落到洞里；失败时旧内容留在原处，返回 false
+static bool map_io_discard(MapIo *io, off_t off, uint64_t len)
 {
-    n->lpn = lpn;
-    n->ppn = ppn;
-    n->dirty = dirty;
-    cachehash_insert(&d->cmt_hash, n);
-    QTAILQ_INSERT_HEAD(&d->cmt_entry_list, n, entry);
-    d->used_cmt_entry_cnt++;
+    map_io_wait(io);
+    if (io->ops->discard(io, off, len) != 0) {
+        io->ss->map_punch_fail_cnt++;
+        return false;
+    }
+    io->ss->map_punch_bytes += len;
+    return true;
 }
 
-static void handback_if_needed(FTL *d, cmt_entry *n)
+// 映射条目
+#define EPP (MAP_PAGE_BYTES / ENTRY_BYTES)
+
+#if ENTRY_BYTES == 8u
+static inline uint64_t lpn_to_mpn(uint64_t lpn) { return lpn >> 9; }
+static inline uint32_t lpn_to_off(uint64_t lpn) { return (uint32_t)(lpn & 511); }
+#else
+#define ENTRY_VALUE_MASK ((1ull << (ENTRY_BYTES * 8u)) - 1ull)
+// 除以 EPP 改为乘法 + 移位：M = ceil(2^64 / EPP)，lpn < 2^64 / EPP(约 2^54)时结果精确
+#define EPP_DIV_MAGIC (UINT64_MAX / (uint64_t)EPP + 1ull)
+#define EPP_DIV_LIMIT (1ull << 54)
+static inline uint64_t lpn_to_mpn(uint64_t lpn) { return (uint64_t)(((unsigned __int128)lpn * EPP_DIV_MAGIC) >> 64); }
+static inline uint32_t lpn_to_off(uint64_t lpn) { return (uint32_t)(lpn - lpn_to_mpn(lpn) * (uint64_t)EPP); }
+#endif
+
+static inline uint64_t mpn_to_ppa(uint64_t mpn) { return mpn + 1; }
+static inline uint64_t ppa_to_mpn(uint64_t ppa) { return ppa - 1; }
+
+static inline void entry_store_u64(uint8_t *base, uint32_t idx, uint64_t v)
 {
-    if (n->dirty == DIRTY) {
-        memstats_add(&g_memstats.cmt_dirty_handle_cnt, 1);
-        write_ppn_to_map_with_gtd(d, n->lpn, n->ppn);
-        n->dirty = CLEAN;
+#if ENTRY_BYTES == 8u
+    ((uint64_t *)base)[idx] = v;
+#else
+    // 非对齐 8 字节读-改-写；页尾最后一个条目改为向前对齐到页尾的 8 字节，避免越界
+    size_t pos = (size_t)idx * ENTRY_BYTES;
+    uint64_t x;
+    if (likely(pos + 8u <= MAP_PAGE_BYTES)) {
+        memcpy(&x, base + pos, 8);
+        x = (x & ~ENTRY_VALUE_MASK) | (v & ENTRY_VALUE_MASK);
+        memcpy(base + pos, &x, 8);
+    } else {
+        const uint32_t sh = (8u - ENTRY_BYTES) * 8u;
+        memcpy(&x, base + pos - (8u - ENTRY_BYTES), 8);
+        x = (x & ~(ENTRY_VALUE_MASK << sh)) | ((v & ENTRY_VALUE_MASK) << sh);
+        memcpy(base + pos - (8u - ENTRY_BYTES), &x, 8);
     }
+#endif
 }
 
-static cmt_entry *cache_get_entry(FTL *d, uint64_t lpn)
+static inline uint64_t entry_load_u64(const uint8_t *base, uint32_t idx)
 {
-    cmt_entry *n = cachehash_find(&d->cmt_hash, lpn);
-    if (n) {
-        QTAILQ_REMOVE(&d->cmt_entry_list, n, entry);
-        QTAILQ_INSERT_HEAD(&d->cmt_entry_list, n, entry);
-        return n;
-    }
-    cmt_entry *e;
-    if (!QTAILQ_EMPTY(&d->free_cmt_entry_list)) {
-        e = QTAILQ_FIRST(&d->free_cmt_entry_list);
-        QTAILQ_REMOVE(&d->free_cmt_entry_list, e, entry);
-        d->free_cmt_entry_cnt--;
-    } else {
-        e = QTAILQ_LAST(&d->cmt_entry_list);
-        if (!e) {
-            fprintf(stderr, "CMT empty\n");
-            exit(1);
-        }
-        handback_if_needed(d, e);
-        cachehash_remove(&d->cmt_hash, e);
-        QTAILQ_REMOVE(&d->cmt_entry_list, e, entry);
-        d->used_cmt_entry_cnt--;
+#if ENTRY_BYTES == 8u
+    return ((const uint64_t *)base)[idx];
+#else
+    size_t pos = (size_t)idx * ENTRY_BYTES;
+    uint64_t x;
+    if (likely(pos + 8u <= MAP_PAGE_BYTES)) {
+        memcpy(&x, base + pos, 8);
+        return x & ENTRY_VALUE_MASK;
     }
-    uint64_t ppn = read_ppn_from_map_with_gtd(d, lpn);
-    cmt_entry_bind(d, e, lpn, ppn, CLEAN);
-    return e;
+    memcpy(&x, base + pos - (8u - ENTRY_BYTES), 8);
+    return x >> ((8u - ENTRY_BYTES) * 8u);
+#endif
 }
 
-// ========== 资源报告（保持原版，但补充线程内存统计） ==========
+#if defined(TPC_ZCACHE) || defined(MAP_DISK_COMPRESS)
+// ========== 映射页压缩编码 ==========
+// 预测器 + 例外表：先按预测器(全0 或 base+i 的顺序映射)预测每个条目，
+// 与预测不符的条目记入位图(小端 64 位字)，其值用 frame-of-reference 位打包存放。
+// 顺序写满的页和新分配的稀疏页都只需几十字节。
 
-static void PrintResourceReport(const char *title, FTL *d)
+#define MPAGE_MODE_ZERO   0u // 预测值为 0
+#define MPAGE_MODE_LINEAR 1u // 预测值为 base + i
+#define MPAGE_MODE_RAW    2u // 不压缩
+#define MPAGE_BITMAP_BYTES ((EPP + 7u) / 8u)
+
+typedef struct {
+    uint8_t mode;
+    uint8_t width;  // 例外值位宽
+    uint16_t n_exc; // 例外条目数
+    uint32_t pad;
+    uint64_t base;  // LINEAR 模式的起始 ppn
+    uint64_t fmin;  // 例外值的最小值
+} MpageHdr;
+
+typedef struct {
+    uint8_t *p;
+    uint64_t acc;
+    uint32_t nbits;
+} BitWriter;
+
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+    uint64_t acc;
+    uint32_t nbits;
+} BitReader;
+
+static inline uint32_t bits_needed(uint64_t x) { return x ? 64u - (uint32_t)__builtin_clzll(x) : 0u; }
+static inline uint64_t low_mask(uint32_t w) { return w >= 64u ? ~0ull : ((1ull << w) - 1ull); }
+
+static inline void bw_put(BitWriter *bw, uint64_t v, uint32_t w)
+{
+    v &= low_mask(w);
+    uint32_t total = bw->nbits + w;
+    bw->acc |= v << bw->nbits;
+    if (total >= 64u) {
+        memcpy(bw->p, &bw->acc, 8);
+        bw->p += 8;
+        bw->acc = bw->nbits ? (v >> (64u - bw->nbits)) : 0ull;
+        bw->nbits = total - 64u;
+    } else {
+        bw->nbits = total;
+    }
+}
+
+static inline void bw_flush(BitWriter *bw)
+{
+    uint32_t n = (bw->nbits + 7u) / 8u;
+    memcpy(bw->p, &bw->acc, n);
+    bw->p += n;
+    bw->acc = 0;
+    bw->nbits = 0;
+}
+
+static inline uint64_t br_get(BitReader *br, uint32_t w)
+{
+    uint64_t v;
+    if (br->nbits >= w) {
+        v = br->acc & low_mask(w);
+        br->acc = (w >= 64u) ? 0ull : (br->acc >> w);
+        br->nbits -= w;
+        return v;
+    }
+    uint64_t nxt = 0;
+    size_t avail = (size_t)(br->end - br->p);
+    memcpy(&nxt, br->p, avail < 8 ? avail : 8);
+    br->p += 8;
+    uint32_t need = w - br->nbits;
+    v = (br->acc | (nxt << br->nbits)) & low_mask(w);
+    br->acc = (need >= 64u) ? 0ull : (nxt >> need);
+    br->nbits = 64u - need;
+    return v;
+}
+
+static inline uint64_t mpage_predict(uint32_t mode, uint64_t base, uint32_t i)
+{
+    return mode == MPAGE_MODE_LINEAR ? base + i : 0ull;
+}
+
+// 把一页映射条目编码到 out，返回字节数（out 至少 MAP_PAGE_BYTES + sizeof(MpageHdr)）
+static uint32_t mpage_encode(const uint8_t *page, uint8_t *out)
+{
+    // base 取首/中/尾三个条目推出的起点的多数值，避免首条目恰好是例外
+    uint64_t b0 = entry_load_u64(page, 0);
+    uint64_t b1 = entry_load_u64(page, EPP / 2u) - EPP / 2u;
+    uint64_t b2 = entry_load_u64(page, EPP - 1u) - (EPP - 1u);
+    uint64_t base = (b1 == b2) ? b1 : b0;
+    uint32_t n_zero_exc = 0, n_lin_exc = 0;
+
+    // 第一遍：无分支地统计两种预测器的例外数，选例外少的一种
+    for (uint32_t i = 0; i < EPP; i++) {
+        uint64_t v = entry_load_u64(page, i);
+        n_zero_exc += (v != 0);
+        n_lin_exc += (v != base + i);
+    }
+
+    MpageHdr h;
+    memset(&h, 0, sizeof(h));
+    h.mode = (uint8_t)(n_lin_exc < n_zero_exc ? MPAGE_MODE_LINEAR : MPAGE_MODE_ZERO);
+    h.n_exc = (uint16_t)(h.mode == MPAGE_MODE_LINEAR ? n_lin_exc : n_zero_exc);
+    h.base = base;
+    if (!h.n_exc) {
+        memcpy(out, &h, sizeof(h));
+        return (uint32_t)sizeof(h);
+    }
+
+    // 第二遍：生成例外位图并求例外值范围
+    uint64_t bitmap[(EPP + 63u) / 64u];
+    uint64_t lo = ~0ull, hi = 0;
+    memset(bitmap, 0, sizeof(bitmap));
+    for (uint32_t i = 0; i < EPP; i++) {
+        uint64_t v = entry_load_u64(page, i);
+        if (v != mpage_predict(h.mode, base, i)) {
+            bitmap[i >> 6] |= 1ull << (i & 63u);
+            lo = v < lo ? v : lo;
+            hi = v > hi ? v : hi;
+        }
+    }
+    h.fmin = lo;
+    h.width = (uint8_t)bits_needed(hi - lo);
+
+    uint64_t sz = sizeof(MpageHdr) + MPAGE_BITMAP_BYTES + ((uint64_t)h.n_exc * h.width + 7u) / 8u;
+    if (sz >= MAP_PAGE_BYTES) {
+        memset(&h, 0, sizeof(h));
+        h.mode = MPAGE_MODE_RAW;
+        memcpy(out, &h, sizeof(h));
+        memcpy(out + sizeof(h), page, MAP_PAGE_BYTES);
+        return (uint32_t)sizeof(h) + MAP_PAGE_BYTES;
+    }
+
+    memcpy(out, &h, sizeof(h));
+    memcpy(out + sizeof(h), bitmap, MPAGE_BITMAP_BYTES);
+    BitWriter bw = {out + sizeof(h) + MPAGE_BITMAP_BYTES, 0, 0};
+    if (h.width) {
+        for (uint32_t w = 0; w < (EPP + 63u) / 64u; w++) {
+            for (uint64_t m = bitmap[w]; m; m &= m - 1) {
+                uint32_t i = w * 64u + (uint32_t)__builtin_ctzll(m);
+                bw_put(&bw, entry_load_u64(page, i) - lo, h.width);
+            }
+        }
+        bw_flush(&bw);
+    }
+    return (uint32_t)(bw.p - out);
+}
+
+static void mpage_decode(const uint8_t *in, uint32_t len, uint8_t *page)
+{
+    MpageHdr h;
+    memcpy(&h, in, sizeof(h));
+    if (h.mode == MPAGE_MODE_RAW) {
+        memcpy(page, in + sizeof(h), MAP_PAGE_BYTES);
+        return;
+    }
+    if (h.mode == MPAGE_MODE_ZERO)
+        memset(page, 0, MAP_PAGE_BYTES);
+    else
+        for (uint32_t i = 0; i < EPP; i++)
+            entry_store_u64(page, i, h.base + i);
+    if (!h.n_exc)
+        return;
+
+    uint64_t bitmap[(EPP + 63u) / 64u];
+    memset(bitmap, 0, sizeof(bitmap));
+    memcpy(bitmap, in + sizeof(h), MPAGE_BITMAP_BYTES);
+    BitReader br = {in + sizeof(h) + MPAGE_BITMAP_BYTES, in + len, 0, 0};
+    for (uint32_t w = 0; w < (EPP + 63u) / 64u; w++) {
+        for (uint64_t m = bitmap[w]; m; m &= m - 1) {
+            uint32_t i = w * 64u + (uint32_t)__builtin_ctzll(m);
+            entry_store_u64(page, i, h.fmin + (h.width ? br_get(&br, h.width) : 0ull));
+        }
+    }
+}
+#endif
+
+// ========== 替换原来的 TPC 实现：采用 4-way set associative + 预分配 page_pool ==========
+
+// TPC 结构：按 SoA 存放，slot = set * TPC_WAYS + way，同时也是 page_pool 中的页下标。
+// tpc_tags 只放 mpn，查找时整组一次比较；脏位等元数据放在单独的 tpc_flags 中，查找路径不碰它们
+#define TPC_F_DIRTY      0x01
+#define TPC_F_PREFETCHED 0x02 // 由预取装入且尚未被访问
+
+#ifdef TPC_PREFETCH
+// 预取流：记录上一次缺失的 mpn 和步长，conf 为同一步长连续出现的次数
+typedef struct {
+    uint64_t last_mpn;
+    int64_t stride;
+    uint32_t conf;
+    uint32_t lru;
+} PfStream;
+#endif
+
+#ifdef TPC_ZCACHE
+// 压缩缓存条目，zc_ent 本身按插入顺序组成环形队列
+typedef struct {
+    uint64_t mpn;
+    uint32_t off;   // 在 arena 中的偏移
+    uint16_t len;
+    uint8_t dirty;
+    uint8_t valid;  // 被取回 TPC 后置0，空间在出队时回收
+} ZcEntry;
+#endif
+
+#ifdef MAP_LINEAR_ELISION
+// 线性页：条目 i 的值恰为 base + i，只在内存里记 base。mpn 为 MPN_SENTINEL 表示空槽
+typedef struct {
+    uint64_t mpn;
+    uint64_t base;
+} LinEntry;
+#endif
+
+#ifdef MAP_DURABLE
+typedef struct {
+    uint64_t lba;
+    uint64_t ppn;
+} WalRec;
+
+#define WAL_TRIM (1ull << 63) // ppn 带此位的记录是一次 TRIM，低位为条目数(要求 ppn < 2^63)
+
+// 一组修改的头部，其后紧跟 n 条 WalRec；sum 覆盖头部(sum 置0)和全部记录
+typedef struct {
+    uint64_t magic;
+    uint64_t lsn_first;
+    uint32_t n;
+    uint32_t pad;
+    uint64_t sum;
+} WalGroupHdr;
+#endif
+
+#ifdef MAP_DISK_COMPRESS
+// 映射页在 map.ssd 中的位置：off 以 MLOC_UNIT 计，len 为写入的字节数(0 表示尚未分配槽位)。mpn 为 MPN_SENTINEL 表示空槽
+typedef struct {
+    uint64_t mpn;
+    uint32_t off;
+    uint16_t len;
+    uint8_t cls;
+    uint8_t pad;
+} MapLoc;
+#endif
+
+#ifdef TPC_MISS_CLASSIFY
+// 与 TPC 同容量的全相联 LRU 影子缓存，只记录 mpn，用来判断一次缺失是否属于冲突缺失
+// 容量随 TPC 的 slot 数在 FTLInit 中确定
+#define SHADOW_NIL UINT32_MAX
+
+typedef struct {
+    uint64_t *mpn;
+    uint32_t *prev;      // 按下标串起的 LRU 双向链表：head 最近访问，tail 最久未访问，命中和淘汰都是 O(1)
+    uint32_t *next;
+    int32_t *hash;       // mpn -> 下标，-1 为空，共 cap * 4 项
+    uint32_t cap;
+    uint32_t hash_mask;
+    uint32_t used;
+    uint32_t head;
+    uint32_t tail;
+} ShadowLru;
+#endif
+
+// ========== 条目级缓存：开放寻址表，每槽 16B(默认 USE_CMT 未启用) ==========
+// lpn 经乘法散列后线性探测，删除时后续槽位前移(不留墓碑)；替换用 CLOCK，访问位单独存成位图，随槽位一起移动。
+// 新插入的条目访问位为 0：只用过一次的条目在指针第一次扫过时就被淘汰
+
+#define EC_EMPTY (~0ull)        // 空槽的 lpn
+#define EC_DIRTY (1ull << 63)   // val 的最高位为脏标记，其余位为 ppn(要求 ppn < 2^63)
+#define EC_PPN(v) ((v) & ~EC_DIRTY)
+
+typedef struct {
+    uint64_t lpn;
+    uint64_t val; // ppn | EC_DIRTY
+} EcSlot;
+
+typedef struct {
+    EcSlot *slots;
+    uint64_t *ref;   // CLOCK 访问位，每槽 1 bit
+    uint32_t cap;    // 槽数，2 的幂
+    uint32_t shift;  // 64 - log2(cap)
+    uint32_t limit;  // 最多容纳的条目数，不超过 cap 的 3/4
+    uint32_t cnt;
+    uint32_t hand;   // CLOCK 指针
+    uint32_t step;   // 指针步长：约 0.618 * cap 的奇数
+    MemClass cls;
+    MemStats *ms;    // 所属实例的内存统计
+} EntryCache;
+
+#if defined(USE_CMT) || defined(TPC_ENTRY_RETAIN)
+static inline uint32_t ec_home(const EntryCache *c, uint64_t lpn)
+{
+    return (uint32_t)((lpn * 0x9E3779B97F4A7C15ull) >> c->shift);
+}
+
+static inline bool ec_ref_test(const EntryCache *c, uint32_t i)
+{
+    return (c->ref[i >> 6] >> (i & 63u)) & 1u;
+}
+
+static inline void ec_ref_put(EntryCache *c, uint32_t i, bool on)
+{
+    uint64_t b = 1ull << (i & 63u);
+    c->ref[i >> 6] = on ? (c->ref[i >> 6] | b) : (c->ref[i >> 6] & ~b);
+}
+
+// 能容纳 entries 个条目的表：槽数取满足装载率不超过 3/4 的最小 2 的幂
+static void ec_init(EntryCache *c, uint32_t entries, MemClass cls, MemStats *ms)
+{
+    c->ms = ms;
+    uint32_t cap = 64;
+    while ((uint64_t)cap * 3u < (uint64_t)entries * 4u)
+        cap *= 2;
+    c->slots = (EcSlot *)FTLAllocAlignedEx(c->ms, (size_t)cap * sizeof(EcSlot), 64, cls);
+    for (uint32_t i = 0; i < cap; i++)
+        c->slots[i].lpn = EC_EMPTY;
+    c->ref = (uint64_t *)FTLCallocEx(c->ms, cap / 64u, sizeof(uint64_t), cls);
+    c->cap = cap;
+    c->shift = 64u - (uint32_t)__builtin_ctz(cap);
+    c->limit = entries;
+    c->cnt = 0;
+    c->hand = 0;
+    c->step = (uint32_t)((uint64_t)cap * 2654435769u >> 32) | 1u;
+    c->cls = cls;
+}
+
+static void ec_destroy(EntryCache *c)
+{
+    FTLFreeEx(c->ms, c->slots, (size_t)c->cap * sizeof(EcSlot), c->cls);
+    FTLFreeEx(c->ms, c->ref, (size_t)(c->cap / 64u) * sizeof(uint64_t), c->cls);
+    c->slots = NULL;
+    c->ref = NULL;
+    c->cap = c->cnt = c->limit = 0;
+}
+
+// 只查找，不置访问位
+static inline EcSlot *ec_peek(EntryCache *c, uint64_t lpn)
+{
+    uint32_t mask = c->cap - 1u, i = ec_home(c, lpn);
+    for (;;) {
+        EcSlot *s = &c->slots[i];
+        if (s->lpn == lpn)
+            return s;
+        if (s->lpn == EC_EMPTY)
+            return NULL;
+        i = (i + 1u) & mask;
+    }
+}
+
+// 命中时置访问位
+static inline EcSlot *ec_find(EntryCache *c, uint64_t lpn)
+{
+    uint32_t mask = c->cap - 1u, i = ec_home(c, lpn);
+    for (;;) {
+        EcSlot *s = &c->slots[i];
+        if (s->lpn == lpn) {
+            c->ref[i >> 6] |= 1ull << (i & 63u);
+            return s;
+        }
+        if (s->lpn == EC_EMPTY)
+            return NULL;
+        i = (i + 1u) & mask;
+    }
+}
+
+// 插入一个不在表中的条目，调用者保证 cnt < limit
+static inline EcSlot *ec_insert(EntryCache *c, uint64_t lpn, uint64_t val)
+{
+    uint32_t mask = c->cap - 1u, i = ec_home(c, lpn);
+    while (c->slots[i].lpn != EC_EMPTY)
+        i = (i + 1u) & mask;
+    c->slots[i].lpn = lpn;
+    c->slots[i].val = val;
+    ec_ref_put(c, i, false);
+    c->cnt++;
+    return &c->slots[i];
+}
+
+// 删除第 i 槽：后续同一探测链上的槽位前移
+static void ec_remove_at(EntryCache *c, uint32_t i)
+{
+    uint32_t mask = c->cap - 1u, j = i;
+    c->slots[i].lpn = EC_EMPTY;
+    ec_ref_put(c, i, false);
+    c->cnt--;
+    for (;;) {
+        j = (j + 1u) & mask;
+        if (c->slots[j].lpn == EC_EMPTY)
+            break;
+        uint32_t k = ec_home(c, c->slots[j].lpn);
+        bool stay = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+        if (!stay) {
+            c->slots[i] = c->slots[j];
+            ec_ref_put(c, i, ec_ref_test(c, j));
+            c->slots[j].lpn = EC_EMPTY;
+            ec_ref_put(c, j, false);
+            i = j;
+        }
+    }
+}
+
+// CLOCK 淘汰：指针扫过的条目访问位为 1 则清零放过，为 0 则取出到 *out 并删除。表不能为空。
+// 指针按奇数步长跳跃(仍是遍历全部槽位的一个排列)：若逐槽前进，指针前方的槽位都已装满一整圈、后方刚被清空，
+// 删除时的后移链会长达数百槽
+static void ec_evict(EntryCache *c, EcSlot *out)
+{
+    uint32_t mask = c->cap - 1u;
+    for (;;) {
+        uint32_t i = c->hand;
+        c->hand = (i + c->step) & mask;
+        if (c->slots[i].lpn == EC_EMPTY)
+            continue;
+        if (ec_ref_test(c, i)) {
+            ec_ref_put(c, i, false);
+            continue;
+        }
+        *out = c->slots[i];
+        ec_remove_at(c, i);
+        return;
+    }
+}
+#endif
+
+// ========== FTL 主控制块：融合 TPC / GTD / CMT / 多线程状态 ==========
+// 一个实例的全部可变状态都在这里(对外即 FTLHandle)，实例之间不共享任何可写数据
+
+struct FTLHandle
+{
+    uint64_t total_lpns;
+    uint64_t total_mpns;
+
+    FTLConfig cfg;           // 规整后的配置，cfg.map_path 指向下面的 map_path
+    char *map_path;          // map 文件及其派生的 WAL / 检查点路径
+    char *wal_path;
+    char *ckpt_path;
+    char *ckpt_tmp_path;
+    MemStats ms;             // 本实例的内存与计数统计
+    SsdStats ss;
+    NandSim nand;
+    PipelineSimple pl;       // 本实例的回放流水线(FTLHandleRun)
+
+    EntryCache cmt; // 条目级映射缓存(USE_CMT)，位于 TPC 之前
+    uint32_t *cmt_dirty_cnt; // CMT_DIRTY_BUCKETS 个计数器：散列到该桶的 mpn 的脏条目数之和
+
+#if defined(SMALL_GTD_ARRAY) && defined(GTD_HIERARCHICAL)
+    uint64_t **gtd_dir;     // 叶子位图指针，未分配的叶子指向共享的全0叶子 g_gtd_zero_leaf
+    uint64_t *gtd_summary;  // 每 bit 表示对应叶子是否已分配(含有置位的 mpn)
+    uint64_t gtd_n_leaves;
+    uint64_t gtd_leaves_used;
+#elif defined(SMALL_GTD_ARRAY)
+    uint8_t *gtd; // 位图，每 bit 表示对应 mpn 是否已分配
+#else
+    uint64_t *gtd;   // GTD, 记录mpn->mpn_ppa
+#endif
+
+    int fd_map;
+    MapIo mio;               // map.ssd 的读写都经过它
+
+    // 新 TPC：组相联 + 预分配页池
+    uint32_t tpc_set_bits;   // 组数 = 2^tpc_set_bits
+    uint32_t tpc_set_mask;
+    uint32_t tpc_slots;      // 组数 * TPC_WAYS
+    uint64_t *tpc_tags;      // tpc_slots 个 mpn，CACHE_LINE_OPTIMIZE 下 64B 对齐
+    uint8_t *tpc_flags;      // tpc_slots 项
+    uint8_t *tpc_next_victim; // 每组一项
+    uint8_t *page_pool_base; // 共 tpc_slots 页
+#ifdef TPC_ENTRY_RETAIN
+    uint64_t *tpc_acc;       // 每个 slot TPC_ACC_WORDS 个字：装入后被读写过的条目置位
+    EntryCache retain;       // 淘汰时保留下来的条目(lpn -> ppn)，都是干净的
+#endif
+
+    bool small_input_mode;
+
+    bool multi_threaded;
+
+    // 内存预算(cfg.mem_budget)切分出的各组件大小，FTLInit 时确定
+    size_t in_buf_bytes;  // 回放输入文件的 stdio 缓冲
+    size_t out_buf_bytes; // 回放输出文件的 stdio 缓冲，0 表示用 stdio 默认大小
+    uint32_t batch_cnt;   // TaskBatch 池大小，不超过 QUEUE_DEPTH + 2
+
+    // Last-Hit 优化缓存
+#ifdef LAST_HIT_OPTIMIZE
+    uint64_t last_mpn;
+    uint32_t last_slot;
+    uint8_t *last_buf;
+#endif
+
+#ifdef MAP_LINEAR_ELISION
+    // 与 GTD 并列的页状态：线性页 mpn -> base 的开放寻址表。线性页不在 TPC/压缩缓存中，盘上副本已过期
+    LinEntry *lin_tab;
+    uint64_t lin_cap;          // 2 的幂
+    uint32_t lin_shift;        // 64 - log2(lin_cap)
+    uint64_t lin_cnt;
+#endif
+
+#ifdef MAP_DISK_COMPRESS
+    // 盘上压缩格式：定位表 + 按大小类的槽位分配器。释放的槽位进各自大小类的空闲栈，不做合并
+    MapLoc *mloc_tab;
+    uint64_t mloc_cap;         // 2 的幂
+    uint32_t mloc_shift;       // 64 - log2(mloc_cap)
+    uint64_t mloc_cnt;
+    uint32_t *mloc_free[MLOC_CLASSES];
+    uint32_t mloc_free_cnt[MLOC_CLASSES];
+    uint32_t mloc_free_cap[MLOC_CLASSES];
+    uint32_t mloc_carve_off[MLOC_CLASSES];  // 各大小类正在切分的块中下一个槽位
+    uint32_t mloc_carve_left[MLOC_CLASSES]; // 该块剩余的单位数
+    uint32_t mloc_end;         // 文件末尾，以 MLOC_UNIT 计
+    uint8_t *mloc_buf;         // 编解码缓冲
+#endif
+
+#ifdef MAP_LOG_STRUCTURED
+    // 日志结构存放：gtd[mpn] 为盘上页号 + 1，log_owner 为反向映射(盘上页号 -> mpn，失效页为 MPN_SENTINEL)
+    uint64_t *log_owner;
+    uint32_t *log_seg_valid;   // 各段有效页数
+    uint8_t *log_seg_free;     // 段是否在空闲栈中
+    uint32_t *log_free;        // 空闲段栈
+    uint32_t log_free_cnt;
+    uint32_t log_nsegs;        // 已使用过的段数(文件末尾 = log_nsegs 段)
+    uint32_t log_seg_cap;      // 上面各段表的容量
+    uint32_t log_active;       // 接收写回的段
+    uint32_t log_active_off;
+    uint32_t log_gc_seg;       // 接收回收搬移的段，与写回分开，冷热页不混在一起
+    uint32_t log_gc_off;
+    uint64_t log_valid;        // 全部有效页数
+    uint8_t *log_buf;          // 回收搬移缓冲
+#endif
+
+#ifdef MAP_MMAP
+    uint8_t *mm_base;          // map.ssd 的共享映射，覆盖 [0, mm_len)
+    uint64_t mm_len;
+    uint64_t mm_last_mpn;      // 上次访问的 mpn，用于识别顺序访问
+#endif
+
+#ifdef MAP_WARM_RESTART
+    bool ckpt_loaded;          // 本次启动是否由检查点恢复
+    uint64_t ckpt_wal_lsn;     // 检查点已包含 lsn 小于该值的全部修改
+#endif
+
+#ifdef MAP_DURABLE
+    // 意图日志：每条修改记一条 WalRec，攒满一个窗口后整组写入 map.wal 并 fdatasync
+    int fd_wal;
+    WalRec *wal_buf;
+    uint32_t wal_n;
+    uint32_t wal_window;
+    uint64_t wal_lsn;          // 下一条修改的序号
+    uint64_t wal_off;          // map.wal 当前长度
+#endif
+
+#ifdef TPC_MICRO_TLB
+    // 最近访问的 mpn -> slot，同一 mpn 至多出现一次；slot 被淘汰时对应项置为 MPN_SENTINEL
+    uint64_t utlb_mpn[UTLB_ENTRIES];
+    uint32_t utlb_slot[UTLB_ENTRIES];
+    uint32_t utlb_next;
+#endif
+
+#ifdef TPC_PREFETCH
+    PfStream pf_streams[PF_STREAMS];
+    uint32_t pf_tick;          // 流 LRU 时钟
+    uint32_t pf_unmatched;     // 连续不属于任何流的缺失次数
+    int pf_fadv;               // 当前对 map.ssd 生效的 fadvise 提示
+#endif
+
+#ifdef TPC_MISS_CLASSIFY
+    ShadowLru shadow;
+#endif
+
+#ifdef TPC_ZCACHE
+    uint64_t zc_budget;        // 压缩缓存总预算：arena、索引和编解码缓冲
+    uint32_t zc_arena_bytes;   // 以下三项由 ftl_budget_plan 按 zc_budget 确定
+    uint32_t zc_max_pages;     // 索引容量(2 的幂)
+    uint32_t zc_hash_mask;     // 哈希表共 zc_max_pages * 2 项
+    uint8_t *zc_arena;         // zc_arena_bytes 字节的环形 arena
+    uint32_t zc_arena_head;    // 下一次分配的位置
+    ZcEntry *zc_ent;           // zc_max_pages 个条目的环形队列
+    uint32_t zc_q_first;       // 最老条目下标
+    uint32_t zc_q_count;
+    uint32_t zc_valid_cnt;     // 仍有效的页数
+    int32_t *zc_hash;          // mpn -> zc_ent 下标，-1 为空
+    uint8_t *zc_enc;           // 编码输出缓冲
+    uint8_t *zc_page;          // 淘汰脏页时的解码缓冲
+#endif
+};
+typedef struct FTLHandle FTL;
+
+// 旧接口(FTLInit / FTLRead / ... / AlgorithmRun)使用的默认实例及其配置
+static FTL *g = NULL;
+
+static FTLConfig g_cfg = {
+    .lba_count = LBA_MAX_PLUS1,
+};
+
+void FTLConfigDefault(FTLConfig *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->lba_count = LBA_MAX_PLUS1;
+}
+
+void FTLConfigure(const FTLConfig *cfg)
+{
+    if (g) {
+        fprintf(stderr, "FTLConfigure: must be called before FTLInit\n");
+        return;
+    }
+    g_cfg = *cfg;
+}
+
+static void ftl_config_normalize(FTLConfig *c)
+{
+    if (c->lba_count == 0)
+        c->lba_count = LBA_MAX_PLUS1;
+#if ENTRY_BYTES != 8u
+    if (c->lba_count > EPP_DIV_LIMIT) {
+        fprintf(stderr, "FTLConfigure: lba_count clamped to 2^54 for %u-byte entries\n", (unsigned)ENTRY_BYTES);
+        c->lba_count = EPP_DIV_LIMIT;
+    }
+#endif
+    if (c->map_backend > FTL_MAP_BACKEND_MEM) {
+        fprintf(stderr, "FTLConfigure: unknown map backend %u, using pread\n", c->map_backend);
+        c->map_backend = FTL_MAP_BACKEND_PREAD;
+    }
+    if (!c->map_path || !c->map_path[0])
+        c->map_path = FTL_DEFAULT_MAP_PATH;
+}
+
+#define BUDGET_MIN_BATCHES 3u // 读线程填一个、队列里排一个、worker 执行一个
+
+static inline uint64_t clamp_u64(uint64_t v, uint64_t lo, uint64_t hi)
+{
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+#ifdef TPC_ZCACHE
+// 把 bytes 字节的压缩缓存预算分给编解码缓冲、索引和 arena：索引容量取放得下的最大 2 的幂，其余都给 arena
+static void zc_plan(FTL *d, uint64_t bytes)
+{
+    uint64_t bufs = (MAP_PAGE_BYTES + sizeof(MpageHdr) + 8u) + MAP_PAGE_BYTES; // zc_enc 和 zc_page
+    uint64_t per_page = sizeof(ZcEntry) + 2u * sizeof(int32_t);                  // 队列条目和两个哈希槽
+    uint32_t pages = ZC_MIN_PAGES;
+    while (pages < ZC_MAX_PAGES && bufs + (uint64_t)pages * 2u * (per_page + ZC_BYTES_PER_PAGE) <= bytes)
+        pages *= 2u;
+    uint64_t fixed = bufs + (uint64_t)pages * per_page;
+    d->zc_budget = bytes;
+    d->zc_max_pages = pages;
+    d->zc_hash_mask = pages * 2u - 1u;
+    // arena 至少放得下几个最大的压缩页，预算太小时超出预算
+    d->zc_arena_bytes = (uint32_t)clamp_u64(bytes > fixed ? bytes - fixed : 0, 4u * ZC_MAX_BLOB,
+                                            (uint64_t)ZC_MAX_PAGES * ZC_BYTES_PER_PAGE);
+}
+#endif
+
+// 按 cfg.mem_budget 切分大小可调的组件：输入/输出缓冲和 batch 池按比例取(各有上下限)，压缩缓存取余下的
+// 1/ZC_BUDGET_SHARE，其余全部给 TPC，组数取放得下的最大 2 的幂，取整剩下的也归压缩缓存。
+// GTD、线性页表等随访问范围增长的结构不在预算内，报告中与实测 RSS 一起对照。
+// mem_budget 为 0 时沿用编译期默认值
+static void ftl_budget_plan(FTL *d)
+{
+    uint64_t b = d->cfg.mem_budget;
+    uint32_t bits = TPC_SET_BITS;
+#ifdef TPC_ZCACHE
+    uint64_t zc = ZC_BUDGET_BYTES;
+#endif
+    d->in_buf_bytes = 1024 * 1024;
+    d->out_buf_bytes = 0;
+    d->batch_cnt = QUEUE_DEPTH + 2;
+    if (b) {
+        d->in_buf_bytes = (size_t)clamp_u64(b / 32u, 64u << 10, 1u << 20) & ~(size_t)4095;
+        d->out_buf_bytes = (size_t)clamp_u64(b / 64u, 16u << 10, 1u << 20) & ~(size_t)4095;
+        d->batch_cnt = (uint32_t)clamp_u64(b / 8u / sizeof(TaskBatch), BUDGET_MIN_BATCHES, QUEUE_DEPTH + 2);
+        uint64_t fixed = d->in_buf_bytes + d->out_buf_bytes;
+#ifndef NO_PIPELINE
+        fixed += (uint64_t)d->batch_cnt * sizeof(TaskBatch);
+#endif
+        uint64_t rest = b > fixed ? b - fixed : 0;
+#ifdef TPC_ZCACHE
+        zc = rest / ZC_BUDGET_SHARE;
+        rest -= zc;
+#endif
+#ifndef DISABLE_TPC
+        // 每组：TPC_WAYS 个页框、tag 和标志字节，加一个轮转指针
+        uint64_t per_set = (uint64_t)TPC_WAYS * (MAP_PAGE_BYTES + sizeof(uint64_t) + 1u) + 1u;
+#ifdef TPC_ENTRY_RETAIN
+        per_set += (uint64_t)TPC_WAYS * TPC_ACC_WORDS * sizeof(uint64_t);
+#endif
+        bits = 0;
+        while (bits < TPC_MAX_SET_BITS && (per_set << (bits + 1)) <= rest)
+            bits++;
+        if (per_set > rest)
+            fprintf(stderr, "FTLConfigure: mem_budget %" PRIu64 " B is below the minimum component sizes, using them anyway\n", b);
+#ifdef TPC_ZCACHE
+        if (rest > (per_set << bits))
+            zc += rest - (per_set << bits);
+#endif
+#else
+        if (rest == 0)
+            fprintf(stderr, "FTLConfigure: mem_budget %" PRIu64 " B is below the minimum component sizes, using them anyway\n", b);
+#endif
+    }
+    d->tpc_set_bits = bits;
+    d->tpc_set_mask = (1u << bits) - 1u;
+    d->tpc_slots = (1u << bits) * TPC_WAYS;
+#ifdef TPC_ZCACHE
+    zc_plan(d, zc);
+#endif
+}
+
+// 在 base 后接上 suffix；base 以 strip 结尾时先去掉它
+static char *ftl_path_derive(FTL *d, const char *base, const char *strip, const char *suffix)
+{
+    size_t n = strlen(base);
+    size_t k = strip ? strlen(strip) : 0;
+    if (k && (n < k || strcmp(base + n - k, strip) != 0))
+        k = 0;
+    size_t len = n - k + strlen(suffix) + 1;
+    char *p = (char *)FTL_MALLOC_CTRL(&d->ms, len);
+    memcpy(p, base, n - k);
+    strcpy(p + n - k, suffix);
+    return p;
+}
+
+static void ftl_path_free(FTL *d, char *p)
+{
+    if (p)
+        FTL_FREE_CTRL(&d->ms, p, strlen(p) + 1);
+}
+
+// ========== GTD 位图操作（原有 SMALL_GTD_ARRAY 逻辑） ==========
+
+#if defined(SMALL_GTD_ARRAY) && defined(GTD_HIERARCHICAL)
+// 两级位图：gtd_dir[mpn >> GTD_LEAF_SHIFT] 指向叶子位图。查找固定两次访存、无分支，
+// 未分配的叶子共享一个只读的全0叶子
+static uint64_t g_gtd_zero_leaf[GTD_LEAF_WORDS];
+
+static inline bool gtd_is_allocated(const FTL *d, uint64_t mpn)
+{
+    const uint64_t *leaf = d->gtd_dir[mpn >> GTD_LEAF_SHIFT];
+    uint64_t i = mpn & GTD_LEAF_MASK;
+    return (leaf[i >> 6] >> (i & 63u)) & 1u;
+}
+
+static uint64_t *gtd_leaf_alloc(FTL *d, uint64_t li)
+{
+    uint64_t *leaf = (uint64_t *)FTL_MALLOC_GTD_LEAF(&d->ms);
+    if (unlikely(!leaf)) { perror("malloc gtd leaf failed"); exit(1); }
+    d->gtd_dir[li] = leaf;
+    d->gtd_summary[li >> 6] |= 1ull << (li & 63u);
+    d->gtd_leaves_used++;
+    return leaf;
+}
+
+static inline void gtd_mark_allocated(FTL *d, uint64_t mpn)
+{
+    uint64_t li = mpn >> GTD_LEAF_SHIFT;
+    uint64_t *leaf = d->gtd_dir[li];
+    if (unlikely(leaf == g_gtd_zero_leaf))
+        leaf = gtd_leaf_alloc(d, li);
+    uint64_t i = mpn & GTD_LEAF_MASK;
+    leaf[i >> 6] |= 1ull << (i & 63u);
+}
+
+// 叶子内 [lo, hi] 位是否有置位
+static inline bool gtd_leaf_any(const uint64_t *leaf, uint64_t lo, uint64_t hi)
+{
+    uint64_t wlo = lo >> 6, whi = hi >> 6;
+    uint64_t mlo = ~0ull << (lo & 63u);
+    uint64_t mhi = ~0ull >> (63u - (hi & 63u));
+    if (wlo == whi)
+        return (leaf[wlo] & mlo & mhi) != 0;
+    if (leaf[wlo] & mlo)
+        return true;
+    for (uint64_t w = wlo + 1; w < whi; w++) {
+        if (leaf[w])
+            return true;
+    }
+    return (leaf[whi] & mhi) != 0;
+}
+
+// 清掉 mpn 的位；叶子因此变空时释放它，目录项退回共享的全0叶子
+static void gtd_clear_allocated(FTL *d, uint64_t mpn)
+{
+    uint64_t li = mpn >> GTD_LEAF_SHIFT;
+    uint64_t *leaf = d->gtd_dir[li];
+    uint64_t i = mpn & GTD_LEAF_MASK;
+    leaf[i >> 6] &= ~(1ull << (i & 63u));
+    if (leaf[i >> 6] || gtd_leaf_any(leaf, 0, GTD_LEAF_MASK))
+        return;
+    FTL_FREE_GTD_LEAF(&d->ms, leaf);
+    d->gtd_dir[li] = g_gtd_zero_leaf;
+    d->gtd_summary[li >> 6] &= ~(1ull << (li & 63u));
+    d->gtd_leaves_used--;
+}
+
+// [first, last] 内是否有已分配的映射页：整段空叶子按 summary 每次跳过 64 个叶子
+static inline bool gtd_any_allocated(const FTL *d, uint64_t first, uint64_t last)
+{
+    if (first > last || first >= d->total_mpns)
+        return false;
+    if (last >= d->total_mpns)
+        last = d->total_mpns - 1;
+    uint64_t lf = first >> GTD_LEAF_SHIFT, ll = last >> GTD_LEAF_SHIFT;
+    uint64_t li = lf;
+    while (li <= ll) {
+        uint64_t word = d->gtd_summary[li >> 6] >> (li & 63u);
+        if (!word) {
+            li = (li | 63u) + 1;
+            continue;
+        }
+        li += (uint64_t)__builtin_ctzll(word);
+        if (li > ll)
+            break;
+        uint64_t lo = (li == lf) ? (first & GTD_LEAF_MASK) : 0;
+        uint64_t hi = (li == ll) ? (last & GTD_LEAF_MASK) : GTD_LEAF_MASK;
+        if (gtd_leaf_any(d->gtd_dir[li], lo, hi))
+            return true;
+        li++;
+    }
+    return false;
+}
+#elif defined(SMALL_GTD_ARRAY)
+static inline bool gtd_is_allocated(const FTL *d, uint64_t mpn)
+{
+    return (d->gtd[mpn >> 3] >> (mpn & 7u)) & 1u;
+}
+
+static inline void gtd_mark_allocated(FTL *d, uint64_t mpn)
+{
+    d->gtd[mpn >> 3] |= (uint8_t)(1u << (mpn & 7u));
+}
+
+static inline void gtd_clear_allocated(FTL *d, uint64_t mpn)
+{
+    d->gtd[mpn >> 3] &= (uint8_t)~(1u << (mpn & 7u));
+}
+#endif
+
+// mpn 对应的映射页是否已分配(两种 GTD 形式通用)
+static inline bool map_page_allocated(const FTL *d, uint64_t mpn)
+{
+#ifdef SMALL_GTD_ARRAY
+    return gtd_is_allocated(d, mpn);
+#else
+    return d->gtd[mpn] != INVALID_PPA;
+#endif
+}
+
+// 标记映射页已分配(两种 GTD 形式通用)
+static inline void map_mark_allocated(FTL *d, uint64_t mpn)
+{
+#ifdef SMALL_GTD_ARRAY
+    if (!gtd_is_allocated(d, mpn))
+        gtd_mark_allocated(d, mpn);
+#elif defined(MAP_LOG_STRUCTURED)
+    if (d->gtd[mpn] == INVALID_PPA)
+        d->gtd[mpn] = LOG_PPA_UNWRITTEN; // 盘上位置在第一次写回时分配
+#else
+    if (d->gtd[mpn] == INVALID_PPA)
+        d->gtd[mpn] = mpn_to_ppa(mpn);
+#endif
+}
+
+// 取消映射页的分配标记(两种 GTD 形式通用)，调用者已处理它的缓存副本和盘上位置
+static inline void map_clear_allocated(FTL *d, uint64_t mpn)
+{
+#ifdef SMALL_GTD_ARRAY
+    gtd_clear_allocated(d, mpn);
+#else
+    d->gtd[mpn] = INVALID_PPA;
+#endif
+}
+
+#ifdef MAP_LINEAR_ELISION
+// ========== 线性映射页 ==========
+
+static inline uint64_t lin_home(const FTL *d, uint64_t mpn)
+{
+    return (mpn * 0x9E3779B97F4A7C15ull) >> d->lin_shift;
+}
+
+static inline LinEntry *lin_find(const FTL *d, uint64_t mpn)
+{
+    uint64_t mask = d->lin_cap - 1;
+    uint64_t i = lin_home(d, mpn);
+    for (;;) {
+        LinEntry *e = &d->lin_tab[i];
+        if (e->mpn == mpn)
+            return e;
+        if (e->mpn == MPN_SENTINEL)
+            return NULL;
+        i = (i + 1) & mask;
+    }
+}
+
+static inline bool lin_lookup(const FTL *d, uint64_t mpn, uint64_t *base)
+{
+    if (likely(d->lin_cnt == 0))
+        return false;
+    LinEntry *e = lin_find(d, mpn);
+    if (!e)
+        return false;
+    *base = e->base;
+    return true;
+}
+
+static void lin_alloc_table(FTL *d, uint64_t cap)
+{
+    d->lin_tab = (LinEntry *)FTL_MALLOC_LIN(&d->ms, cap);
+    if (unlikely(!d->lin_tab)) { perror("malloc linear table failed"); exit(1); }
+    for (uint64_t i = 0; i < cap; i++)
+        d->lin_tab[i].mpn = MPN_SENTINEL;
+    d->lin_cap = cap;
+    d->lin_shift = 64u - (uint32_t)__builtin_ctzll(cap);
+}
+
+static void lin_insert_nogrow(FTL *d, uint64_t mpn, uint64_t base)
+{
+    uint64_t mask = d->lin_cap - 1;
+    uint64_t i = lin_home(d, mpn);
+    while (d->lin_tab[i].mpn != MPN_SENTINEL && d->lin_tab[i].mpn != mpn)
+        i = (i + 1) & mask;
+    if (d->lin_tab[i].mpn == MPN_SENTINEL)
+        d->lin_cnt++;
+    d->lin_tab[i].mpn = mpn;
+    d->lin_tab[i].base = base;
+}
+
+static void lin_insert(FTL *d, uint64_t mpn, uint64_t base)
+{
+    if (unlikely((d->lin_cnt + 1) * 2 > d->lin_cap)) {
+        LinEntry *old = d->lin_tab;
+        uint64_t old_cap = d->lin_cap;
+        lin_alloc_table(d, old_cap * 2);
+        d->lin_cnt = 0;
+        for (uint64_t i = 0; i < old_cap; i++) {
+            if (old[i].mpn != MPN_SENTINEL)
+                lin_insert_nogrow(d, old[i].mpn, old[i].base);
+        }
+        FTL_FREE_LIN(&d->ms, old, old_cap);
+    }
+    lin_insert_nogrow(d, mpn, base);
+}
+
+// 取出并删除线性页记录(线性探测的删除：后续槽位前移，避免墓碑)
+static bool lin_take(FTL *d, uint64_t mpn, uint64_t *base)
+{
+    if (likely(d->lin_cnt == 0))
+        return false;
+    LinEntry *e = lin_find(d, mpn);
+    if (!e)
+        return false;
+    *base = e->base;
+    uint64_t mask = d->lin_cap - 1;
+    uint64_t i = (uint64_t)(e - d->lin_tab), j = i;
+    d->lin_tab[i].mpn = MPN_SENTINEL;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (d->lin_tab[j].mpn == MPN_SENTINEL)
+            break;
+        uint64_t k = lin_home(d, d->lin_tab[j].mpn);
+        bool stay = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+        if (!stay) {
+            d->lin_tab[i] = d->lin_tab[j];
+            d->lin_tab[j].mpn = MPN_SENTINEL;
+            i = j;
+        }
+    }
+    d->lin_cnt--;
+    return true;
+}
+
+// 页内条目是否满足 entry[i] == entry[0] + i；先比较首尾，绝大多数非线性页在这里就被排除
+static bool lin_detect(const uint8_t *page, uint64_t *base)
+{
+    uint64_t b = entry_load_u64(page, 0);
+    if (entry_load_u64(page, EPP - 1u) != b + (EPP - 1u))
+        return false;
+    for (uint32_t i = 1; i < EPP - 1u; i++) {
+        if (entry_load_u64(page, i) != b + i)
+            return false;
+    }
+    *base = b;
+    return true;
+}
+
+static void lin_materialize(uint8_t *page, uint64_t base)
+{
+    for (uint32_t i = 0; i < EPP; i++)
+        entry_store_u64(page, i, base + i);
+}
+#endif
+
+#ifdef MAP_DISK_COMPRESS
+// ========== 压缩映射页的盘上布局 ==========
+// 每页用 mpage_encode 压缩后按长度选大小类，写入该类的槽位；定位表记录 mpn -> (偏移, 长度, 大小类)。
+// 重写时大小类不变就原地覆盖，否则释放旧槽位另行分配。定位表只在内存中，map.ssd 不自描述
+
+static inline uint64_t mloc_home(const FTL *d, uint64_t mpn)
+{
+    return (mpn * 0x9E3779B97F4A7C15ull) >> d->mloc_shift;
+}
+
+static inline MapLoc *mloc_find(const FTL *d, uint64_t mpn)
+{
+    if (unlikely(d->mloc_cnt == 0))
+        return NULL;
+    uint64_t mask = d->mloc_cap - 1;
+    uint64_t i = mloc_home(d, mpn);
+    for (;;) {
+        MapLoc *e = &d->mloc_tab[i];
+        if (e->mpn == mpn)
+            return e;
+        if (e->mpn == MPN_SENTINEL)
+            return NULL;
+        i = (i + 1) & mask;
+    }
+}
+
+static void mloc_alloc_table(FTL *d, uint64_t cap)
+{
+    d->mloc_tab = (MapLoc *)FTL_MALLOC_MLOC(&d->ms, cap);
+    if (unlikely(!d->mloc_tab)) { perror("malloc map locator failed"); exit(1); }
+    for (uint64_t i = 0; i < cap; i++)
+        d->mloc_tab[i].mpn = MPN_SENTINEL;
+    d->mloc_cap = cap;
+    d->mloc_shift = 64u - (uint32_t)__builtin_ctzll(cap);
+}
+
+static MapLoc *mloc_insert_nogrow(FTL *d, const MapLoc *src)
+{
+    uint64_t mask = d->mloc_cap - 1;
+    uint64_t i = mloc_home(d, src->mpn);
+    while (d->mloc_tab[i].mpn != MPN_SENTINEL && d->mloc_tab[i].mpn != src->mpn)
+        i = (i + 1) & mask;
+    if (d->mloc_tab[i].mpn == MPN_SENTINEL)
+        d->mloc_cnt++;
+    d->mloc_tab[i] = *src;
+    return &d->mloc_tab[i];
+}
+
+// 查找 mpn 的定位项，不存在时插入一个尚未分配槽位的空项
+static MapLoc *mloc_get(FTL *d, uint64_t mpn)
+{
+    MapLoc *e = mloc_find(d, mpn);
+    if (e)
+        return e;
+    if (unlikely((d->mloc_cnt + 1) * 2 > d->mloc_cap)) {
+        MapLoc *old = d->mloc_tab;
+        uint64_t old_cap = d->mloc_cap;
+        mloc_alloc_table(d, old_cap * 2);
+        d->mloc_cnt = 0;
+        for (uint64_t i = 0; i < old_cap; i++) {
+            if (old[i].mpn != MPN_SENTINEL)
+                mloc_insert_nogrow(d, &old[i]);
+        }
+        FTL_FREE_MLOC(&d->ms, old, old_cap);
+    }
+    MapLoc n;
+    memset(&n, 0, sizeof(n));
+    n.mpn = mpn;
+    return mloc_insert_nogrow(d, &n);
+}
+
+// 删除定位项(线性探测的删除：后续槽位前移，避免墓碑)
+static void mloc_remove(FTL *d, MapLoc *e)
+{
+    uint64_t mask = d->mloc_cap - 1;
+    uint64_t i = (uint64_t)(e - d->mloc_tab), j = i;
+    d->mloc_tab[i].mpn = MPN_SENTINEL;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (d->mloc_tab[j].mpn == MPN_SENTINEL)
+            break;
+        uint64_t k = mloc_home(d, d->mloc_tab[j].mpn);
+        bool stay = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+        if (!stay) {
+            d->mloc_tab[i] = d->mloc_tab[j];
+            d->mloc_tab[j].mpn = MPN_SENTINEL;
+            i = j;
+        }
+    }
+    d->mloc_cnt--;
+}
+
+// 能容纳 len 字节的最小大小类
+static inline uint32_t mloc_class(uint32_t len)
+{
+    if (len <= MLOC_UNIT)
+        return 0;
+    return 32u - (uint32_t)__builtin_clz(len - 1u) - (uint32_t)__builtin_ctz(MLOC_UNIT);
+}
+
+static uint32_t mloc_slot_alloc(FTL *d, uint32_t cls)
+{
+    uint32_t units = 1u << cls;
+    uint32_t off;
+    if (d->mloc_free_cnt[cls]) {
+        off = d->mloc_free[cls][--d->mloc_free_cnt[cls]];
+    } else {
+        if (d->mloc_carve_left[cls] == 0) {
+            if (unlikely(d->mloc_end > UINT32_MAX - MLOC_BLOCK_UNITS)) {
+                fprintf(stderr, "map.ssd compressed slot space exhausted\n");
+                exit(1);
+            }
+            d->mloc_carve_off[cls] = d->mloc_end;
+            d->mloc_carve_left[cls] = MLOC_BLOCK_UNITS;
+            d->mloc_end += MLOC_BLOCK_UNITS;
+#ifdef DEBUG_FTL
+            d->ss.map_slot_end = (uint64_t)d->mloc_end * MLOC_UNIT;
+#endif
+        }
+        off = d->mloc_carve_off[cls];
+        d->mloc_carve_off[cls] += units;
+        d->mloc_carve_left[cls] -= units;
+    }
+#ifdef DEBUG_FTL
+    d->ss.map_slot_bytes += (uint64_t)units * MLOC_UNIT;
+#endif
+    return off;
+}
+
+static void mloc_slot_free(FTL *d, uint32_t cls, uint32_t off)
+{
+    if (unlikely(d->mloc_free_cnt[cls] == d->mloc_free_cap[cls])) {
+        uint32_t cap = d->mloc_free_cap[cls] ? d->mloc_free_cap[cls] * 2u : 64u;
+        uint32_t *p = (uint32_t *)FTL_MALLOC_MLOC_FREE(&d->ms, cap);
+        if (d->mloc_free_cnt[cls])
+            memcpy(p, d->mloc_free[cls], (size_t)d->mloc_free_cnt[cls] * sizeof(uint32_t));
+        FTL_FREE_MLOC_FREE(&d->ms, d->mloc_free[cls], d->mloc_free_cap[cls]);
+        d->mloc_free[cls] = p;
+        d->mloc_free_cap[cls] = cap;
+    }
+    d->mloc_free[cls][d->mloc_free_cnt[cls]++] = off;
+#ifdef DEBUG_FTL
+    d->ss.map_slot_bytes -= (uint64_t)MLOC_UNIT << cls;
+#endif
+}
+
+// 映射页的盘上副本不再需要(例如页变为线性)，回收其槽位
+static void mloc_discard(FTL *d, uint64_t mpn)
+{
+    MapLoc *e = mloc_find(d, mpn);
+    if (!e)
+        return;
+    if (e->len)
+        mloc_slot_free(d, e->cls, e->off);
+    mloc_remove(d, e);
+}
+#endif
+
+#ifdef MAP_LOG_STRUCTURED
+// ========== 日志结构的映射页存放 ==========
+// 写回不再覆盖 mpn 的固定位置，而是追加到当前段的下一页(顺序写)，旧位置作废。
+// 空闲段只剩一段时，若全局有效页占比低于 LOG_GC_UTIL，就挑有效页最少的段，把其中的有效页搬到回收段后整段放回空闲栈；
+// 否则直接扩展文件。最后一个空闲段只留给回收段，回收因此不必扩展文件，日志长度能稳定下来。回收在需要新段时于 worker 线程上就地进行(FTL 状态不加锁，不另开后台线程)，
+// 每次只回收一段，代价分摊到各次写回上
+
+static inline bool log_ppa_on_disk(uint64_t ppa)
+{
+    return ppa != INVALID_PPA && ppa != LOG_PPA_UNWRITTEN;
+}
+
+static void log_grow_segs(FTL *d, uint32_t cap)
+{
+    uint8_t *blk = (uint8_t *)FTL_MALLOC_LOG_SEGS(&d->ms, cap);
+    uint64_t *owner = (uint64_t *)FTL_MALLOC_LOG_OWNER(&d->ms, cap);
+    if (unlikely(!blk || !owner)) { perror("malloc log segments failed"); exit(1); }
+    uint32_t *valid = (uint32_t *)blk;
+    uint32_t *free_stack = valid + cap;
+    uint8_t *free_flag = (uint8_t *)(free_stack + cap);
+    if (d->log_seg_cap) {
+        memcpy(valid, d->log_seg_valid, (size_t)d->log_seg_cap * sizeof(uint32_t));
+        memcpy(free_stack, d->log_free, (size_t)d->log_free_cnt * sizeof(uint32_t));
+        memcpy(free_flag, d->log_seg_free, d->log_seg_cap);
+        memcpy(owner, d->log_owner, (size_t)d->log_seg_cap * LOG_SEG_PAGES * sizeof(uint64_t));
+        FTL_FREE_LOG_SEGS(&d->ms, d->log_seg_valid, d->log_seg_cap);
+        FTL_FREE_LOG_OWNER(&d->ms, d->log_owner, d->log_seg_cap);
+    }
+    d->log_seg_valid = valid;
+    d->log_free = free_stack;
+    d->log_seg_free = free_flag;
+    d->log_owner = owner;
+    d->log_seg_cap = cap;
+}
+
+// 作废 mpn 当前的盘上副本
+static inline void log_invalidate(FTL *d, uint64_t mpn)
+{
+    uint64_t ppa = d->gtd[mpn];
+    if (!log_ppa_on_disk(ppa))
+        return;
+    uint64_t p = ppa - 1;
+    d->log_owner[p] = MPN_SENTINEL;
+    d->log_seg_valid[p / LOG_SEG_PAGES]--;
+    d->log_valid--;
+}
+
+static inline void log_place(FTL *d, uint64_t mpn, uint64_t p)
+{
+    d->log_owner[p] = mpn;
+    d->log_seg_valid[p / LOG_SEG_PAGES]++;
+    d->log_valid++;
+    d->gtd[mpn] = p + 1;
+}
+
+static uint32_t log_new_segment(FTL *d, bool for_gc);
+
+// 在写回段(或回收段)中分配下一页，返回盘上页号
+static uint64_t log_alloc_page(FTL *d, bool for_gc)
+{
+    uint32_t *seg = for_gc ? &d->log_gc_seg : &d->log_active;
+    uint32_t *off = for_gc ? &d->log_gc_off : &d->log_active_off;
+    if (*seg == LOG_SEG_NONE || *off == LOG_SEG_PAGES) {
+        *seg = LOG_SEG_NONE; // 写满的段就此封闭，可以成为回收对象
+        uint32_t s = log_new_segment(d, for_gc);
+        *seg = s;
+        *off = 0;
+    }
+    return (uint64_t)*seg * LOG_SEG_PAGES + (*off)++;
+}
+
+// 贪心回收：有效页最少的已封闭段。返回是否回收了一段
+static bool log_gc(FTL *d)
+{
+    uint64_t t0 = ftl_now_ns();
+    map_io_wait(&d->mio); // 批量写回中尚未完成的页不能被搬移
+    uint32_t victim = LOG_SEG_NONE;
+    for (uint32_t s = 0; s < d->log_nsegs; s++) {
+        if (d->log_seg_free[s] || s == d->log_active || s == d->log_gc_seg)
+            continue;
+        if (victim == LOG_SEG_NONE || d->log_seg_valid[s] < d->log_seg_valid[victim])
+            victim = s;
+    }
+    if (victim == LOG_SEG_NONE || d->log_seg_valid[victim] == LOG_SEG_PAGES)
+        return false;
+    uint64_t first = (uint64_t)victim * LOG_SEG_PAGES;
+    for (uint64_t p = first; p < first + LOG_SEG_PAGES && d->log_seg_valid[victim]; p++) {
+        uint64_t mpn = d->log_owner[p];
+        if (mpn == MPN_SENTINEL)
+            continue;
+        map_io_read_sync(&d->mio, d->log_buf, MAP_PAGE_BYTES, (off_t)p * MAP_PAGE_BYTES);
+        uint64_t q = log_alloc_page(d, true);
+        map_io_write(&d->mio, d->log_buf, MAP_PAGE_BYTES, (off_t)q * MAP_PAGE_BYTES);
+        map_io_wait(&d->mio);
+        log_invalidate(d, mpn);
+        log_place(d, mpn, q);
+#ifdef DEBUG_FTL
+        d->ss.map_gc_pages_moved++;
+#endif
+    }
+    d->log_seg_free[victim] = 1;
+    d->log_free[d->log_free_cnt++] = victim;
+#ifdef DEBUG_FTL
+    d->ss.map_gc_runs++;
+    d->ss.map_gc_ns += ftl_now_ns() - t0;
+#else
+    (void)t0;
+#endif
+    return true;
+}
+
+static uint32_t log_new_segment(FTL *d, bool for_gc)
+{
+    // 回收自身需要新段时不再递归回收，直接取空闲段(包括预留的最后一段)或扩展
+    for (uint32_t i = 0; !for_gc && i < LOG_GC_MAX_ROUNDS && d->log_free_cnt <= 1 && d->log_nsegs > 0 &&
+                         (double)d->log_valid < LOG_GC_UTIL * (double)d->log_nsegs * LOG_SEG_PAGES; i++) {
+        if (!log_gc(d))
+            break;
+    }
+    if (d->log_free_cnt > (for_gc ? 0u : 1u)) {
+        uint32_t s = d->log_free[--d->log_free_cnt];
+        d->log_seg_free[s] = 0;
+        return s;
+    }
+    if (d->log_nsegs == d->log_seg_cap)
+        log_grow_segs(d, d->log_seg_cap * 2u);
+    uint32_t s = d->log_nsegs++;
+    d->log_seg_valid[s] = 0;
+    d->log_seg_free[s] = 0;
+    uint64_t *owner = d->log_owner + (size_t)s * LOG_SEG_PAGES;
+    for (uint32_t i = 0; i < LOG_SEG_PAGES; i++)
+        owner[i] = MPN_SENTINEL;
+    return s;
+}
+#endif
+
+// ========== TPC 组相联实现 ==========
+
+static inline uint32_t tpc_get_set_idx(const FTL *d, uint64_t mpn) {
+#ifdef TPC_HASH_SET_INDEX
+    // 把高位按组索引宽度折叠进低位：同一组数对齐块内的连续 mpn 仍落在不同组，
+    // 而相差组数整数倍的 mpn 会被打散。组索引宽度可到 TPC_MAX_SET_BITS(16)，移位量达到 64 时跳过该步(否则是未定义行为)
+    uint64_t x = mpn;
+    uint32_t bits = d->tpc_set_bits;
+    if (bits * 4 < 64)
+        x ^= x >> (bits * 4);
+    if (bits * 2 < 64)
+        x ^= x >> (bits * 2);
+    x ^= x >> bits;
+    return (uint32_t)(x & d->tpc_set_mask);
+#else
+    return (uint32_t)(mpn & d->tpc_set_mask);
+#endif
+}
+
+// 在 n 个连续 tag 中查找 mpn，返回下标，未命中返回 -1；n 为 4 的倍数且不超过 32。
+// AVX2 一条比较覆盖 4 个 tag；SSE4.1/SSE2 每条覆盖 2 个(SSE2 没有 64 位相等比较，用 32 位比较后高低半拼起来)
+static inline int tpc_tag_find(const uint64_t *tags, int n, uint64_t mpn)
+{
+    uint32_t mask = 0;
+#if defined(__AVX2__)
+    __m256i key = _mm256_set1_epi64x((long long)mpn);
+    for (int i = 0; i < n; i += 4) {
+        __m256i t = _mm256_loadu_si256((const __m256i *)(tags + i));
+        __m256i eq = _mm256_cmpeq_epi64(t, key);
+        mask |= (uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(eq)) << i;
+    }
+#elif defined(__SSE4_1__)
+    __m128i key = _mm_set1_epi64x((long long)mpn);
+    for (int i = 0; i < n; i += 2) {
+        __m128i t = _mm_loadu_si128((const __m128i *)(tags + i));
+        __m128i eq = _mm_cmpeq_epi64(t, key);
+        mask |= (uint32_t)_mm_movemask_pd(_mm_castsi128_pd(eq)) << i;
+    }
+#elif defined(__SSE2__)
+    __m128i key = _mm_set1_epi64x((long long)mpn);
+    for (int i = 0; i < n; i += 2) {
+        __m128i t = _mm_loadu_si128((const __m128i *)(tags + i));
+        __m128i eq32 = _mm_cmpeq_epi32(t, key);
+        __m128i eq = _mm_and_si128(eq32, _mm_shuffle_epi32(eq32, _MM_SHUFFLE(2, 3, 0, 1)));
+        mask |= (uint32_t)_mm_movemask_pd(_mm_castsi128_pd(eq)) << i;
+    }
+#else
+    for (int i = 0; i < n; i++)
+        mask |= (uint32_t)(tags[i] == mpn) << i;
+#endif
+    return mask ? __builtin_ctz(mask) : -1;
+}
+
+static inline int tpc_set_find(const uint64_t *tags, uint64_t mpn)
+{
+    return tpc_tag_find(tags, TPC_WAYS, mpn);
+}
+
+static inline const char *tpc_lookup_isa(void)
+{
+#if defined(__AVX2__)
+    return "AVX2";
+#elif defined(__SSE4_1__)
+    return "SSE4.1";
+#elif defined(__SSE2__)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
+
+#ifdef TPC_MICRO_TLB
+static inline void utlb_insert(FTL *d, uint64_t mpn, uint32_t slot)
+{
+    uint32_t i = d->utlb_next;
+    d->utlb_next = (i + 1) & (UTLB_ENTRIES - 1);
+    d->utlb_mpn[i] = mpn;
+    d->utlb_slot[i] = slot;
+}
+
+static inline void utlb_invalidate(FTL *d, uint64_t mpn)
+{
+    int i = tpc_tag_find(d->utlb_mpn, UTLB_ENTRIES, mpn);
+    if (i >= 0)
+        d->utlb_mpn[i] = MPN_SENTINEL;
+}
+#endif
+
+#ifdef TPC_MISS_CLASSIFY
+static inline uint32_t shadow_home(const ShadowLru *sh, uint64_t mpn)
+{
+    return (uint32_t)((mpn * 0x9E3779B97F4A7C15ull) >> 32) & sh->hash_mask;
+}
+
+static uint32_t shadow_find_slot(ShadowLru *sh, uint64_t mpn)
+{
+    uint32_t i = shadow_home(sh, mpn);
+    while (sh->hash[i] >= 0 && sh->mpn[sh->hash[i]] != mpn)
+        i = (i + 1) & sh->hash_mask;
+    return i;
+}
+
+static void shadow_hash_remove(ShadowLru *sh, uint32_t i)
+{
+    uint32_t j = i;
+    sh->hash[i] = -1;
+    for (;;) {
+        j = (j + 1) & sh->hash_mask;
+        if (sh->hash[j] < 0)
+            return;
+        uint32_t k = shadow_home(sh, sh->mpn[sh->hash[j]]);
+        bool stay = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+        if (!stay) {
+            sh->hash[i] = sh->hash[j];
+            sh->hash[j] = -1;
+            i = j;
+        }
+    }
+}
+
+static inline void shadow_unlink(ShadowLru *sh, uint32_t i)
+{
+    uint32_t p = sh->prev[i], n = sh->next[i];
+    if (p != SHADOW_NIL) sh->next[p] = n; else sh->head = n;
+    if (n != SHADOW_NIL) sh->prev[n] = p; else sh->tail = p;
+}
+
+static inline void shadow_push_front(ShadowLru *sh, uint32_t i)
+{
+    sh->prev[i] = SHADOW_NIL;
+    sh->next[i] = sh->head;
+    if (sh->head != SHADOW_NIL) sh->prev[sh->head] = i; else sh->tail = i;
+    sh->head = i;
+}
+
+// 记录一次访问，返回全相联 LRU 下是否命中
+static bool shadow_access(ShadowLru *sh, uint64_t mpn)
+{
+    uint32_t slot = shadow_find_slot(sh, mpn);
+    if (sh->hash[slot] >= 0) {
+        uint32_t idx = (uint32_t)sh->hash[slot];
+        if (idx != sh->head) {
+            shadow_unlink(sh, idx);
+            shadow_push_front(sh, idx);
+        }
+        return true;
+    }
+    uint32_t idx;
+    if (sh->used < sh->cap) {
+        idx = sh->used++;
+    } else {
+        idx = sh->tail;
+        shadow_unlink(sh, idx);
+        shadow_hash_remove(sh, shadow_find_slot(sh, sh->mpn[idx]));
+        slot = shadow_find_slot(sh, mpn);
+    }
+    sh->mpn[idx] = mpn;
+    shadow_push_front(sh, idx);
+    sh->hash[slot] = (int32_t)idx;
+    return false;
+}
+#endif
+
+static inline uint8_t *tpc_slot_buf(FTL *d, uint32_t slot) {
+    return GET_TPC_PTR(d, slot);
+}
+
+// 把一页映射页写回 map.ssd 中 mpn 对应的位置，只排进当前批。copy 为 false 时 map_io_wait 之前 buf 不能改动，
+// 为 true 时写的是副本，buf 马上可以复用
+static void map_write_page_io(FTL *d, uint64_t mpn, const uint8_t *buf, bool copy)
+{
+    // 【新增补丁】: 在写盘前，再次确认/强制标记 GTD！
+    // 防止之前 gtd_mark_allocated 没生效，或者位图意外丢失
+    // (写命中一个按未分配装入的页时不会标记 GTD，两种 GTD 形式都要在这里补标)
+    map_mark_allocated(d, mpn);
+#ifdef DEBUG_FTL
+    d->ss.map_logical_bytes_written += MAP_PAGE_BYTES;
+#endif
+#ifdef MAP_DISK_COMPRESS
+    const uint8_t *src = d->mloc_buf;
+    uint32_t len = mpage_encode(buf, d->mloc_buf);
+    uint32_t cls;
+    if (len > MLOC_MAX_PACKED) {
+        src = buf;
+        len = MAP_PAGE_BYTES;
+        cls = MLOC_RAW_CLASS;
+    } else {
+        cls = mloc_class(len);
+    }
+    MapLoc *e = mloc_get(d, mpn);
+    if (e->len == 0 || e->cls != cls) {
+        if (e->len)
+            mloc_slot_free(d, e->cls, e->off);
+        e->off = mloc_slot_alloc(d, cls);
+        e->cls = (uint8_t)cls;
+    }
+    e->len = (uint16_t)len;
+    off_t offset = (off_t)e->off * MLOC_UNIT;
+#elif defined(MAP_LOG_STRUCTURED)
+    uint32_t len = MAP_PAGE_BYTES;
+    const uint8_t *src = buf;
+    uint64_t p = log_alloc_page(d, false);
+    off_t offset = (off_t)p * MAP_PAGE_BYTES;
+#else
+    uint32_t len = MAP_PAGE_BYTES;
+    const uint8_t *src = buf;
+    off_t offset = (off_t)mpn * MAP_PAGE_BYTES;
+#endif
+#ifdef MAP_DISK_COMPRESS
+    copy |= src == d->mloc_buf; // 编码缓冲马上会被复用
+#endif
+    if (copy)
+        map_io_write_copy(&d->mio, src, len, offset);
+    else
+        map_io_write(&d->mio, src, len, offset);
+#ifdef MAP_LOG_STRUCTURED
+    // 分配新位置后再切换 GTD：分配时若触发回收，旧副本可能刚被搬走，这里作废的是它的最新位置
+    log_invalidate(d, mpn);
+    log_place(d, mpn, p);
+#endif
+}
+
+// 批量写回(ftl_flush_all)：各页缓冲在最后的 map_io_wait 之前保持不变
+static inline void map_write_page_submit(FTL *d, uint64_t mpn, const uint8_t *buf)
+{
+    map_write_page_io(d, mpn, buf, false);
+}
+
+// 淘汰时的写回：缓冲随后就要装入新页，写的是副本，与装入时的读盘一起等齐
+static inline void map_write_page(FTL *d, uint64_t mpn, const uint8_t *buf)
+{
+    map_write_page_io(d, mpn, buf, true);
+}
+
+// 从 map.ssd 读出 mpn 对应的映射页；读失败或盘上没有副本时得到全0页
+static void map_read_page(FTL *d, uint64_t mpn, uint8_t *buf)
+{
+#ifdef MAP_DISK_COMPRESS
+    const MapLoc *e = mloc_find(d, mpn);
+    if (!e || !e->len) {
+        memset(buf, 0, MAP_PAGE_BYTES);
+        return;
+    }
+    off_t offset = (off_t)e->off * MLOC_UNIT;
+    if (e->cls == MLOC_RAW_CLASS) {
+        map_io_read_sync(&d->mio, buf, MAP_PAGE_BYTES, offset);
+        return;
+    }
+    map_io_read_sync(&d->mio, d->mloc_buf, e->len, offset);
+    mpage_decode(d->mloc_buf, e->len, buf);
+#elif defined(MAP_LOG_STRUCTURED)
+    uint64_t ppa = d->gtd[mpn];
+    if (!log_ppa_on_disk(ppa)) {
+        memset(buf, 0, MAP_PAGE_BYTES);
+        return;
+    }
+    map_io_read_sync(&d->mio, buf, MAP_PAGE_BYTES, (off_t)(ppa - 1) * MAP_PAGE_BYTES);
+#else
+    map_io_read_sync(&d->mio, buf, MAP_PAGE_BYTES, (off_t)mpn * MAP_PAGE_BYTES);
+#endif
+}
+
+#ifdef MAP_LINEAR_ELISION
+// mpn 转为线性页后，盘上副本已过期：回收它占用的空间(原地存放时无事可做)
+static inline void map_discard_page(FTL *d, uint64_t mpn)
+{
+#if defined(MAP_DISK_COMPRESS)
+    mloc_discard(d, mpn);
+#elif defined(MAP_LOG_STRUCTURED)
+    log_invalidate(d, mpn);
+    d->gtd[mpn] = LOG_PPA_UNWRITTEN;
+#else
+    (void)d;
+    (void)mpn;
+#endif
+}
+#endif
+
+static inline void tpc_flush_slot(FTL *d, uint32_t slot) {
+    if (CHECK_TPC_SLOT_VALID(d, slot) && (d->tpc_flags[slot] & TPC_F_DIRTY)) {
+        map_write_page(d, d->tpc_tags[slot], tpc_slot_buf(d, slot));
+        d->tpc_flags[slot] &= (uint8_t)~TPC_F_DIRTY;
+        memstats_add(&d->ms, &d->ms.tpc_dirty_handle_cnt, 1);
+    }
+}
+
+#ifdef TPC_ZCACHE
+// ========== 第二级压缩缓存 ==========
+// arena 是一段环形日志，压缩页按插入顺序追加，空间不够时从最老的页开始淘汰；
+// 与 TPC 互斥：页被取回 TPC 时即从压缩缓存删除，因此可以直接保存脏页。
+
+static inline uint32_t zc_home(const FTL *d, uint64_t mpn)
+{
+    return (uint32_t)((mpn * 0x9E3779B97F4A7C15ull) >> 40) & d->zc_hash_mask;
+}
+
+static uint32_t zc_find_slot(FTL *d, uint64_t mpn)
+{
+    uint32_t i = zc_home(d, mpn);
+    while (d->zc_hash[i] >= 0 && d->zc_ent[d->zc_hash[i]].mpn != mpn)
+        i = (i + 1) & d->zc_hash_mask;
+    return i;
+}
+
+static inline bool zc_contains(FTL *d, uint64_t mpn)
+{
+    return d->zc_hash[zc_find_slot(d, mpn)] >= 0;
+}
+
+// 线性探测的删除：把后续槽位向前移动，避免墓碑
+static void zc_hash_remove(FTL *d, uint32_t i)
+{
+    uint32_t j = i;
+    d->zc_hash[i] = -1;
+    for (;;) {
+        j = (j + 1) & d->zc_hash_mask;
+        if (d->zc_hash[j] < 0)
+            return;
+        uint32_t k = zc_home(d, d->zc_ent[d->zc_hash[j]].mpn);
+        bool stay = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+        if (!stay) {
+            d->zc_hash[i] = d->zc_hash[j];
+            d->zc_hash[j] = -1;
+            i = j;
+        }
+    }
+}
+
+static void zc_pop_oldest(FTL *d)
+{
+    ZcEntry *z = &d->zc_ent[d->zc_q_first];
+    if (z->valid) {
+        if (z->dirty) {
+            mpage_decode(d->zc_arena + z->off, z->len, d->zc_page);
+            map_write_page(d, z->mpn, d->zc_page);
+            memstats_add(&d->ms, &d->ms.zc_dirty_writeback_cnt, 1);
+        }
+        zc_hash_remove(d, zc_find_slot(d, z->mpn));
+        z->valid = 0;
+        d->zc_valid_cnt--;
+        memstats_add(&d->ms, &d->ms.zc_evict_cnt, 1);
+    }
+    d->zc_q_first = (d->zc_q_first + 1) & (d->zc_max_pages - 1u);
+    d->zc_q_count--;
+}
+
+// 在 arena 中分配 len 字节，必要时淘汰最老的页
+static uint32_t zc_alloc(FTL *d, uint32_t len)
+{
+    uint32_t off;
+    for (;;) {
+        if (d->zc_q_count == 0) {
+            off = 0;
+            break;
+        }
+        if (d->zc_q_count < d->zc_max_pages) {
+            uint32_t tail = d->zc_ent[d->zc_q_first].off;
+            uint32_t newest = d->zc_ent[(d->zc_q_first + d->zc_q_count - 1) & (d->zc_max_pages - 1u)].off;
+            uint32_t head = d->zc_arena_head;
+            if (newest >= tail) {
+                // 未回绕：有效数据位于 [tail, head)
+                if (len <= d->zc_arena_bytes - head) { off = head; break; }
+                if (len <= tail) { off = 0; break; }
+            } else {
+                // 已回绕：有效数据位于 [tail, END) 和 [0, head)
+                if (len <= tail - head) { off = head; break; }
+            }
+        }
+        zc_pop_oldest(d);
+    }
+    d->zc_arena_head = off + len;
+    return off;
+}
+
+// 压缩一页放入缓存；压缩率不足时返回 false，由调用者按原逻辑写回
+static bool zc_put(FTL *d, uint64_t mpn, const uint8_t *page, uint8_t dirty)
+{
+    uint32_t len = mpage_encode(page, d->zc_enc);
+    if (len > ZC_MAX_BLOB) {
+        memstats_add(&d->ms, &d->ms.zc_reject_cnt, 1);
+        return false;
+    }
+    uint32_t off = zc_alloc(d, len);
+    uint32_t idx = (d->zc_q_first + d->zc_q_count) & (d->zc_max_pages - 1u);
+    ZcEntry *z = &d->zc_ent[idx];
+    memcpy(d->zc_arena + off, d->zc_enc, len);
+    z->mpn = mpn;
+    z->off = off;
+    z->len = (uint16_t)len;
+    z->dirty = dirty;
+    z->valid = 1;
+    d->zc_q_count++;
+    d->zc_valid_cnt++;
+    d->zc_hash[zc_find_slot(d, mpn)] = (int32_t)idx;
+    memstats_add(&d->ms, &d->ms.zc_put_cnt, 1);
+    memstats_add(&d->ms, &d->ms.zc_put_bytes, len);
+    return true;
+}
+
+// 命中时解压到 page 并从缓存删除，脏标记并入 *dirty
+static bool zc_take(FTL *d, uint64_t mpn, uint8_t *page, uint8_t *flags)
+{
+    uint32_t slot = zc_find_slot(d, mpn);
+    int32_t idx = d->zc_hash[slot];
+    if (idx < 0)
+        return false;
+    ZcEntry *z = &d->zc_ent[idx];
+    mpage_decode(d->zc_arena + z->off, z->len, page);
+    if (z->dirty)
+        *flags |= TPC_F_DIRTY;
+    z->valid = 0;
+    d->zc_valid_cnt--;
+    zc_hash_remove(d, slot);
+    memstats_add(&d->ms, &d->ms.zc_hit_cnt, 1);
+    return true;
+}
+
+// 丢弃 mpn 的压缩副本(脏也不写回)；arena 空间随环形日志推进自然回收
+static void zc_drop(FTL *d, uint64_t mpn)
+{
+    uint32_t slot = zc_find_slot(d, mpn);
+    int32_t idx = d->zc_hash[slot];
+    if (idx < 0)
+        return;
+    d->zc_ent[idx].valid = 0;
+    d->zc_valid_cnt--;
+    zc_hash_remove(d, slot);
+}
+#endif
+
+#ifdef TPC_ENTRY_RETAIN
+// ========== 淘汰时的条目保留 ==========
+
+static inline void tpc_touch_entry(FTL *d, const uint8_t *buf, uint32_t off)
+{
+    uint32_t slot = (uint32_t)((size_t)(buf - d->page_pool_base) / MAP_PAGE_BYTES);
+    d->tpc_acc[(size_t)slot * TPC_ACC_WORDS + (off >> 6)] |= 1ull << (off & 63u);
+}
+
+// 页中被访问过的条目不多时逐条存入旁路缓存；访问位随后清零，slot 以干净的访问位装入下一页
+static void retain_harvest(FTL *d, uint32_t slot)
+{
+    uint64_t *acc = &d->tpc_acc[(size_t)slot * TPC_ACC_WORDS];
+    uint32_t n = 0;
+    for (uint32_t w = 0; w < TPC_ACC_WORDS; w++)
+        n += (uint32_t)__builtin_popcountll(acc[w]);
+    if (n > RETAIN_MAX_PER_PAGE) {
+        memstats_add(&d->ms, &d->ms.retain_dense_cnt, 1);
+    } else if (n > 0) {
+        const uint8_t *buf = tpc_slot_buf(d, slot);
+        uint64_t first = d->tpc_tags[slot] * (uint64_t)EPP;
+        for (uint32_t w = 0; w < TPC_ACC_WORDS; w++) {
+            for (uint64_t m = acc[w]; m; m &= m - 1) {
+                uint32_t off = w * 64u + (uint32_t)__builtin_ctzll(m);
+                uint64_t v = EC_PPN(entry_load_u64(buf, off));
+                EcSlot *s = ec_find(&d->retain, first + off);
+                if (s) {
+                    s->val = v;
+                    continue;
+                }
+                if (d->retain.cnt >= d->retain.limit) {
+                    EcSlot old;
+                    ec_evict(&d->retain, &old); // 旁路缓存只有干净条目，直接丢弃
+                }
+                ec_insert(&d->retain, first + off, v);
+                memstats_add(&d->ms, &d->ms.retain_put_cnt, 1);
+            }
+        }
+    }
+    memset(acc, 0, TPC_ACC_WORDS * sizeof(uint64_t));
+}
+
+// 写入必须同步到旁路缓存：该条目的映射页可能已重新装入 TPC，之后再次淘汰前旁路副本不能过期
+static inline void retain_update(FTL *d, uint64_t lpn, uint64_t ppn)
+{
+    if (likely(d->retain.cnt == 0))
+        return;
+    EcSlot *s = ec_find(&d->retain, lpn);
+    if (s)
+        s->val = EC_PPN(ppn);
+}
+#endif
+
+// 淘汰一个有效 way：优先压缩进第二级缓存，否则按原逻辑写回脏页
+static inline void tpc_evict(FTL *d, uint32_t slot) {
+#ifdef TPC_ENTRY_RETAIN
+    retain_harvest(d, slot);
+#endif
+#ifdef TPC_MICRO_TLB
+    utlb_invalidate(d, d->tpc_tags[slot]);
+#endif
+#ifdef TPC_PREFETCH
+    if (d->tpc_flags[slot] & TPC_F_PREFETCHED)
+        memstats_add(&d->ms, &d->ms.pf_waste_cnt, 1);
+#endif
+#ifdef MAP_LINEAR_ELISION
+    uint64_t lin_base;
+    if ((d->tpc_flags[slot] & TPC_F_DIRTY) && lin_detect(tpc_slot_buf(d, slot), &lin_base)) {
+        // 线性页只记 base，省掉这次写盘
+        map_mark_allocated(d, d->tpc_tags[slot]);
+        lin_insert(d, d->tpc_tags[slot], lin_base);
+        map_discard_page(d, d->tpc_tags[slot]);
+        d->tpc_flags[slot] &= (uint8_t)~TPC_F_DIRTY;
+        memstats_add(&d->ms, &d->ms.lin_detect_cnt, 1);
+        return;
+    }
+#endif
+#ifdef TPC_ZCACHE
+    uint64_t mpn = d->tpc_tags[slot];
+    uint8_t dirty = (uint8_t)(d->tpc_flags[slot] & TPC_F_DIRTY);
+    // 未分配的干净页只是全0页，不必保留
+    if (!dirty && !map_page_allocated(d, mpn))
+        return;
+    // 写命中不会标记 GTD(只有写缺失才标记)，写盘时由 map_write_page 补标；
+    // 进压缩缓存的脏页也要补标，否则下次缺失会被当成未分配页，跳过 zc_take
+    if (dirty)
+        map_mark_allocated(d, mpn);
+    if (zc_put(d, mpn, tpc_slot_buf(d, slot), dirty)) {
+        d->tpc_flags[slot] &= (uint8_t)~TPC_F_DIRTY;
+        return;
+    }
+#endif
+    tpc_flush_slot(d, slot);
+}
+
+#ifndef DISABLE_TPC
+// 清空一个 slot 且不写回(页内容作废)，同时作废指向它的 last-hit / micro-TLB 缓存和访问位
+static void tpc_forget_slot(FTL *d, uint32_t slot)
+{
+#ifdef TPC_MICRO_TLB
+    utlb_invalidate(d, d->tpc_tags[slot]);
+#endif
+#ifdef TPC_ENTRY_RETAIN
+    memset(&d->tpc_acc[(size_t)slot * TPC_ACC_WORDS], 0, TPC_ACC_WORDS * sizeof(uint64_t));
+#endif
+    d->tpc_tags[slot] = MPN_SENTINEL;
+    d->tpc_flags[slot] = 0;
+#ifdef LAST_HIT_OPTIMIZE
+    if (d->last_slot == slot) {
+        d->last_mpn = MPN_SENTINEL;
+        d->last_slot = UINT32_MAX;
+        d->last_buf = NULL;
+    }
+#endif
+}
+#endif
+
+#if !defined(DISABLE_TPC) && defined(MAP_LINEAR_ELISION)
+// 淘汰并清空一个 slot(不装入新页)
+static void tpc_drop_slot(FTL *d, uint32_t slot)
+{
+    if (!CHECK_TPC_SLOT_VALID(d, slot))
+        return;
+    tpc_evict(d, slot);
+    tpc_forget_slot(d, slot);
+}
+#endif
+
+// mpn 整页已无映射(调用者已把它移出 TPC)：丢掉线性页记录和压缩缓存中的副本，回收盘上位置，清掉 GTD 位。
+// 原地存放时盘上副本要打洞，由调用者把相邻的页合并成一次，此时返回 true
+static bool map_page_release(FTL *d, uint64_t mpn)
+{
+    if (!map_page_allocated(d, mpn))
+        return false; // 线性页和压缩缓存中的页都已标记 GTD
+#ifdef MAP_LINEAR_ELISION
+    uint64_t lin_base;
+    lin_take(d, mpn, &lin_base);
+#endif
+#ifdef TPC_ZCACHE
+    zc_drop(d, mpn);
+#endif
+    memstats_add(&d->ms, &d->ms.trim_page_cnt, 1);
+#if defined(MAP_DISK_COMPRESS)
+    mloc_discard(d, mpn); // 槽位回到空闲栈，由之后的写回复用
+    map_clear_allocated(d, mpn);
+    return false;
+#elif defined(MAP_LOG_STRUCTURED)
+    log_invalidate(d, mpn); // 所在段的有效页减少，由回收腾出
+    map_clear_allocated(d, mpn);
+    return false;
+#else
+    map_clear_allocated(d, mpn);
+    return true;
+#endif
+}
+
+#ifdef TPC_PREFETCH
+static void pf_set_fadvise(FTL *d, int advice)
+{
+    if (d->pf_fadv == advice)
+        return;
+    posix_fadvise(d->fd_map, 0, 0, advice);
+    d->pf_fadv = advice;
+    memstats_add(&d->ms, &d->ms.pf_fadv_switch_cnt, 1);
+}
+
+static bool tpc_is_resident(FTL *d, uint64_t mpn)
+{
+    uint32_t set_idx = tpc_get_set_idx(d, mpn);
+    return tpc_set_find(&d->tpc_tags[set_idx * TPC_WAYS], mpn) >= 0;
+}
+
+// 为预取页挑选落点：只使用组内下一个 victim，且它必须空闲或干净，不能是刚访问的页。
+// 返回 slot 号，没有合适落点时返回 -1
+static int64_t pf_pick_way(FTL *d, uint64_t mpn)
+{
+    uint32_t set_idx = tpc_get_set_idx(d, mpn);
+    uint32_t slot = set_idx * TPC_WAYS + d->tpc_next_victim[set_idx];
+    if (CHECK_TPC_SLOT_VALID(d, slot) && (d->tpc_flags[slot] & TPC_F_DIRTY))
+        return -1;
+#ifdef LAST_HIT_OPTIMIZE
+    if (slot == d->last_slot)
+        return -1;
+#endif
+    return slot;
+}
+
+static void pf_install(FTL *d, uint32_t slot, uint64_t mpn)
+{
+    uint32_t set_idx = tpc_get_set_idx(d, mpn);
+    if (CHECK_TPC_SLOT_VALID(d, slot))
+        tpc_evict(d, slot); // pf_pick_way 保证是干净页，不会写盘
+    d->tpc_next_victim[set_idx] = (uint8_t)((d->tpc_next_victim[set_idx] + 1) & TPC_WAYS_MASK);
+    d->tpc_tags[slot] = mpn;
+    d->tpc_flags[slot] = TPC_F_PREFETCHED;
+    memstats_add(&d->ms, &d->ms.pf_issue_cnt, 1);
+}
+
+// 把连续的 [first, first+n) 映射页作为一批读进各自的 TPC slot(pread 后端合并为一次 preadv)。
+// 各 slot 须已由 pf_install 腾空并挂上新 tag：若先读后淘汰，被淘汰的旧页会带着新页的内容进入压缩缓存
+static void pf_load_run(FTL *d, uint64_t first, const uint32_t *slots, int n)
+{
+#ifdef MAP_DISK_COMPRESS
+    // 压缩格式下每页读出后还要解码，逐页读取
+    for (int i = 0; i < n; i++)
+        map_read_page(d, first + (uint64_t)i, tpc_slot_buf(d, slots[i]));
+#else
+    for (int i = 0; i < n; i++) {
+        uint64_t t = first + (uint64_t)i;
+#ifdef MAP_LOG_STRUCTURED
+        // 日志结构下相邻 mpn 在盘上不连续，各自按 GTD 中的位置读
+        if (!log_ppa_on_disk(d->gtd[t])) {
+            memset(tpc_slot_buf(d, slots[i]), 0, MAP_PAGE_BYTES);
+            continue;
+        }
+        off_t offset = (off_t)(d->gtd[t] - 1) * MAP_PAGE_BYTES;
+#else
+        off_t offset = (off_t)t * MAP_PAGE_BYTES;
+#endif
+        map_io_read(&d->mio, tpc_slot_buf(d, slots[i]), MAP_PAGE_BYTES, offset);
+    }
+    map_io_wait(&d->mio);
+#endif
+}
+
+// 按流预取：步长为 1 时把后续页批量读进 TPC 的空闲/干净 way，其余情况只提示 page cache
+static void pf_issue(FTL *d, uint64_t mpn, int64_t stride)
+{
+    uint32_t run[PF_DEPTH];
+    uint64_t run_first = 0;
+    int run_n = 0;
+
+    for (int k = 1; k <= PF_DEPTH; k++) {
+        uint64_t t = mpn + (uint64_t)(stride * k);
+        if (t >= d->total_mpns)
+            break;
+        int64_t slot = -1;
+        if (!map_page_allocated(d, t))
+            continue; // 未分配的页缺失时只需清零，无需预取
+        if (tpc_is_resident(d, t))
+            continue;
+#ifdef TPC_ZCACHE
+        if (zc_contains(d, t))
+            continue; // 压缩缓存中的版本可能比盘上新
+#endif
+#ifdef MAP_LINEAR_ELISION
+        uint64_t lin_base;
+        if (lin_lookup(d, t, &lin_base))
+            continue; // 线性页无需读盘，盘上副本也已过期
+#endif
+        if (stride == 1)
+            slot = pf_pick_way(d, t);
+        if (run_n > 0 && (slot < 0 || t != run_first + (uint64_t)run_n)) {
+            pf_load_run(d, run_first, run, run_n);
+            run_n = 0;
+        }
+        if (slot >= 0) {
+            // 立即占位：同一组里后续的预取页不会再挑中这个 slot
+            pf_install(d, (uint32_t)slot, t);
+            if (run_n == 0)
+                run_first = t;
+            run[run_n++] = (uint32_t)slot;
+            continue;
+        }
+        if (d->mio.direct)
+            continue; // 直接 I/O 不经过页缓存，预读提示只会多占一份内存
+#ifdef MAP_DISK_COMPRESS
+        const MapLoc *loc = mloc_find(d, t);
+        if (!loc || !loc->len)
+            continue;
+        posix_fadvise(d->fd_map, (off_t)loc->off * MLOC_UNIT, loc->len, POSIX_FADV_WILLNEED);
+#elif defined(MAP_LOG_STRUCTURED)
+        if (!log_ppa_on_disk(d->gtd[t]))
+            continue;
+        posix_fadvise(d->fd_map, (off_t)(d->gtd[t] - 1) * MAP_PAGE_BYTES, MAP_PAGE_BYTES, POSIX_FADV_WILLNEED);
+#else
+        posix_fadvise(d->fd_map, (off_t)t * MAP_PAGE_BYTES, MAP_PAGE_BYTES, POSIX_FADV_WILLNEED);
+#endif
+        memstats_add(&d->ms, &d->ms.pf_hint_cnt, 1);
+    }
+    if (run_n > 0)
+        pf_load_run(d, run_first, run, run_n);
+}
+
+// 流检测：每次需求缺失(或首次命中预取页)时调用
+static void pf_on_access(FTL *d, uint64_t mpn)
+{
+    PfStream *best = NULL;
+    PfStream *lru = &d->pf_streams[0];
+    d->pf_tick++;
+
+    for (int i = 0; i < PF_STREAMS; i++) {
+        PfStream *s = &d->pf_streams[i];
+        int64_t delta = (int64_t)(mpn - s->last_mpn);
+        if (s->last_mpn != MPN_SENTINEL && delta != 0 &&
+            delta <= PF_MAX_STRIDE && delta >= -PF_MAX_STRIDE) {
+            // 优先选择步长完全吻合的流
+            if (!best || delta == s->stride)
+                best = s;
+            if (delta == s->stride)
+                break;
+        }
+        if (s->lru < lru->lru)
+            lru = s;
+    }
+
+    if (!best) {
+        lru->last_mpn = mpn;
+        lru->stride = 0;
+        lru->conf = 0;
+        lru->lru = d->pf_tick;
+        if (++d->pf_unmatched >= PF_RANDOM_SWITCH)
+            pf_set_fadvise(d, POSIX_FADV_RANDOM);
+        return;
+    }
+
+    int64_t delta = (int64_t)(mpn - best->last_mpn);
+    if (delta == best->stride) {
+        best->conf++;
+    } else {
+        best->stride = delta;
+        best->conf = 1;
+    }
+    best->last_mpn = mpn;
+    best->lru = d->pf_tick;
+    d->pf_unmatched = 0;
+
+    if (best->conf >= PF_CONFIRM) {
+        pf_set_fadvise(d, (best->stride == 1) ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_NORMAL);
+        pf_issue(d, mpn, best->stride);
+    }
+}
+#endif
+
+// 只查 TPC：命中时返回页缓冲(写访问同时置脏)，未命中返回 NULL，由调用者决定是否 tpc_fill
+static inline uint8_t *tpc_lookup(FTL *d, uint64_t mpn, int is_write) {
+    memstats_add(&d->ms, &d->ms.tpc_query_cnt, 1);
+#ifdef TPC_MISS_CLASSIFY
+    bool shadow_hit = shadow_access(&d->shadow, mpn);
+#endif
+#ifdef LAST_HIT_OPTIMIZE
+    // 检查是否命中上一次访问的页
+    if (likely(d->last_mpn == mpn)) {
+        if (is_write) d->tpc_flags[d->last_slot] |= TPC_F_DIRTY;
+        memstats_add(&d->ms, &d->ms.tpc_hit_cnt, 1);
+        return d->last_buf;
+    }
+#endif
+#ifdef TPC_MICRO_TLB
+    memstats_add(&d->ms, &d->ms.utlb_query_cnt, 1);
+    int ui = tpc_tag_find(d->utlb_mpn, UTLB_ENTRIES, mpn);
+    if (ui >= 0) {
+        uint32_t slot = d->utlb_slot[ui];
+        if (is_write) d->tpc_flags[slot] |= TPC_F_DIRTY;
+        memstats_add(&d->ms, &d->ms.tpc_hit_cnt, 1);
+        memstats_add(&d->ms, &d->ms.utlb_hit_cnt, 1);
+        uint8_t *buf = tpc_slot_buf(d, slot);
+#ifdef LAST_HIT_OPTIMIZE
+        d->last_mpn = mpn;
+        d->last_slot = slot;
+        d->last_buf = buf;
+#endif
+        return buf;
+    }
+#endif
+    uint32_t set_idx = tpc_get_set_idx(d, mpn);
+    uint32_t base = set_idx * TPC_WAYS;
+
+    // 查找命中：整组 tag 一次比较
+    int way = tpc_set_find(&d->tpc_tags[base], mpn);
+    if (way >= 0) {
+        uint32_t slot = base + (uint32_t)way;
+        if (is_write) d->tpc_flags[slot] |= TPC_F_DIRTY;
+        memstats_add(&d->ms, &d->ms.tpc_hit_cnt, 1);
+        uint8_t *buf = tpc_slot_buf(d, slot);
+#ifdef LAST_HIT_OPTIMIZE
+        d->last_mpn = mpn;
+        d->last_slot = slot;
+        d->last_buf = buf;
+#endif
+#ifdef TPC_MICRO_TLB
+        utlb_insert(d, mpn, slot);
+#endif
+#ifdef TPC_PREFETCH
+        if (unlikely(d->tpc_flags[slot] & TPC_F_PREFETCHED)) {
+            // 首次命中预取页：计为有效预取，并让流继续向前推进
+            d->tpc_flags[slot] &= (uint8_t)~TPC_F_PREFETCHED;
+            memstats_add(&d->ms, &d->ms.pf_hit_cnt, 1);
+            pf_on_access(d, mpn);
+        }
+#endif
+        return buf;
+    }
+#ifdef TPC_MISS_CLASSIFY
+    memstats_add(&d->ms, shadow_hit ? &d->ms.tpc_conflict_miss_cnt : &d->ms.tpc_capacity_miss_cnt, 1);
+#endif
+    return NULL;
+}
+
+#define TPC_FILL_OVERWRITE 2 // tpc_fill 的 is_write 取该值时表示调用者马上覆盖整页：不读盘，线性页记录和压缩缓存中的副本照常取出作废
+
+// 未命中时装入：选 victim 并淘汰，再依次从 线性页记录 / 压缩缓存 / map.ssd 填充
+static uint8_t *tpc_fill(FTL *d, uint64_t mpn, int is_write) {
+    uint32_t set_idx = tpc_get_set_idx(d, mpn);
+    uint32_t base = set_idx * TPC_WAYS;
+    uint32_t slot = base + d->tpc_next_victim[set_idx];
+    d->tpc_next_victim[set_idx] = (uint8_t)((d->tpc_next_victim[set_idx] + 1) & TPC_WAYS_MASK);
+
+    if (CHECK_TPC_SLOT_VALID(d, slot)) {
+        tpc_evict(d, slot);
+    }
+
+    d->tpc_tags[slot] = mpn;
+    d->tpc_flags[slot] = is_write ? TPC_F_DIRTY : 0;
+
+    uint8_t *real_buffer = tpc_slot_buf(d, slot);
+#ifdef LAST_HIT_OPTIMIZE
+    d->last_mpn = mpn;
+    d->last_slot = slot;
+    d->last_buf = real_buffer;
+#endif
+#ifdef TPC_MICRO_TLB
+    utlb_insert(d, mpn, slot);
+#endif
+
+    // 查看 GTD 决定是否读盘
+#ifdef SMALL_GTD_ARRAY
+    if (gtd_is_allocated(d, mpn)) {
+#ifdef MAP_LINEAR_ELISION
+        uint64_t lin_base;
+        if (lin_take(d, mpn, &lin_base)) {
+            // 由 base 还原整页；盘上副本已过期，装入后即为脏页
+            lin_materialize(real_buffer, lin_base);
+            d->tpc_flags[slot] |= TPC_F_DIRTY;
+            memstats_add(&d->ms, &d->ms.lin_materialize_cnt, 1);
+        } else
+#endif
+#ifdef TPC_ZCACHE
+        if (zc_take(d, mpn, real_buffer, &d->tpc_flags[slot])) {
+            // 由压缩缓存满足，无需读盘
+        } else
+#endif
+        if (is_write == TPC_FILL_OVERWRITE) {
+            memset(real_buffer, 0, MAP_PAGE_BYTES);
+        } else {
+            memstats_add(&d->ms, &d->ms.tpc_miss_read_cnt, 1);
+            map_read_page(d, mpn, real_buffer);
+        }
+    } else {
+        if (is_write) gtd_mark_allocated(d, mpn);
+        memset(real_buffer, 0, MAP_PAGE_BYTES);
+    }
+#else
+    uint64_t ppa = d->gtd[mpn];
+    if (ppa == INVALID_PPA) {
+        if (is_write) {
+            map_mark_allocated(d, mpn);
+        }
+        memset(real_buffer, 0, MAP_PAGE_BYTES);
+    } else {
+#ifdef MAP_LINEAR_ELISION
+        uint64_t lin_base;
+        if (lin_take(d, mpn, &lin_base)) {
+            lin_materialize(real_buffer, lin_base);
+            d->tpc_flags[slot] |= TPC_F_DIRTY;
+            memstats_add(&d->ms, &d->ms.lin_materialize_cnt, 1);
+        } else
+#endif
+#ifdef TPC_ZCACHE
+        if (zc_take(d, mpn, real_buffer, &d->tpc_flags[slot])) {
+            // 由压缩缓存满足，无需读盘
+        } else
+#endif
+        if (is_write == TPC_FILL_OVERWRITE) {
+            memset(real_buffer, 0, MAP_PAGE_BYTES);
+        } else {
+            memstats_add(&d->ms, &d->ms.tpc_miss_read_cnt, 1);
+            map_read_page(d, mpn, real_buffer);
+        }
+    }
+#endif
+#ifdef TPC_PREFETCH
+    pf_on_access(d, mpn);
+#endif
+    return real_buffer;
+}
+
+static inline uint8_t *tpc_get_buffer(FTL *d, uint64_t mpn, int is_write) {
+    uint8_t *buf = tpc_lookup(d, mpn, is_write);
+    return likely(buf != NULL) ? buf : tpc_fill(d, mpn, is_write);
+}
+
+// ========== CMT 相关（保持原逻辑，默认 USE_CMT 未启用） ==========
+
+static uint64_t gtd_get_ppa_for_mpn(FTL *d, uint64_t mpn) {
+    if (mpn >= d->total_mpns) {
+        fprintf(stderr, "gtd_get_ppa_for_mpn: mpn out of range\n");
+        exit(1);
+    }
+#ifdef SMALL_GTD_ARRAY
+    if (!gtd_is_allocated(d, mpn)) {
+        return INVALID_PPA;
+    }
+    return mpn_to_ppa(mpn);
+#else
+    return d->gtd[mpn];
+#endif
+}
+
+#ifdef MAP_MMAP
+// ========== mmap 形式的 map.ssd ==========
+// 映射页就是共享映射中 mpn * 4KB 处的那一页，读写都是普通访存；缺页、预读和写回交给内核。
+// 只有已分配的 mpn 会被访问，而分配时已保证映射覆盖到它，因此不会越过文件末尾
+
+// 把文件和映射扩展到至少 need 字节
+static void mm_grow(FTL *d, uint64_t need)
+{
+    uint64_t len = d->mm_len ? d->mm_len : MMAP_INIT_BYTES;
+    while (len < need)
+        len *= 2;
+    if (unlikely(ftruncate(d->fd_map, (off_t)len) != 0)) {
+        perror("mmap: ftruncate map.ssd failed");
+        exit(1);
+    }
+    void *p = d->mm_base ? mremap(d->mm_base, d->mm_len, len, MREMAP_MAYMOVE)
+                         : mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, d->fd_map, 0);
+    if (unlikely(p == MAP_FAILED)) {
+        perror("mmap map.ssd failed");
+        exit(1);
+    }
+    madvise(p, len, MADV_RANDOM); // 随机访问下内核预读只会带进无用的页
+    d->mm_base = (uint8_t *)p;
+    d->mm_len = len;
+}
+
+static inline uint8_t *mm_page(FTL *d, uint64_t mpn)
+{
+    uint8_t *page = d->mm_base + mpn * MAP_PAGE_BYTES;
+    if (unlikely(mpn != d->mm_last_mpn)) {
+        // 顺序进入下一页时提示内核读入后面几页，弥补 MADV_RANDOM 关掉的预读
+        if (mpn == d->mm_last_mpn + 1 && (mpn + 1 + MMAP_WILLNEED_PAGES) * MAP_PAGE_BYTES <= d->mm_len)
+            madvise(page + MAP_PAGE_BYTES, (size_t)MMAP_WILLNEED_PAGES * MAP_PAGE_BYTES, MADV_WILLNEED);
+        d->mm_last_mpn = mpn;
+    }
+    return page;
+}
+
+// 映射区中当前驻留在页缓存里的字节数
+static uint64_t mm_resident_bytes(const FTL *d)
+{
+    if (!d || !d->mm_base)
+        return 0;
+    uint64_t pages = d->mm_len / MAP_PAGE_BYTES, resident = 0;
+    unsigned char vec[4096];
+    for (uint64_t i = 0; i < pages; i += sizeof(vec)) {
+        uint64_t n = pages - i < sizeof(vec) ? pages - i : sizeof(vec);
+        if (mincore(d->mm_base + i * MAP_PAGE_BYTES, n * MAP_PAGE_BYTES, vec) != 0)
+            return 0;
+        for (uint64_t k = 0; k < n; k++)
+            resident += vec[k] & 1u;
+    }
+    return resident * MAP_PAGE_BYTES;
+}
+#endif
+
+// 从TPC读取lpn对应ppn（未分配则返回UNMAPPED）
+static uint64_t read_ppn_from_map_with_gtd(FTL *d, uint64_t lpn)
+{
+    // 原实现：使用 tpc_page 结构及 LRU；现改为使用 tpc_get_buffer
+    uint64_t mpn = lpn_to_mpn(lpn);
+    uint32_t off = lpn_to_off(lpn);
+#ifdef DISABLE_TPC
+    // === 无 TPC 模式：直接读盘 ===
+    
+    // 1. 检查 GTD 是否已分配
+#ifdef FAST_CONSTANTS
+    // 与 TPC 路径一致：未分配的映射页按全0页处理
+    if (!map_page_allocated(d, mpn)) return 0;
+#else
+    if (!map_page_allocated(d, mpn)) return UNMAPPED_PPA;
+#endif
+
+#ifdef MAP_MMAP
+    // 2. 直接在映射区中读取，不经过临时 buffer
+    uint64_t v = entry_load_u64(mm_page(d, mpn), off);
+#else
+    // 2. 准备临时 buffer (4KB)
+    uint8_t buf[MAP_PAGE_BYTES] __attribute__((aligned(MAP_IO_ALIGN))); // 栈上分配，速度快；对齐以便直接 I/O
+
+    // 3. 计算偏移并读取 (注意强制转 uint64 防止溢出)
+    off_t offset = (off_t)((uint64_t)mpn * MAP_PAGE_BYTES);
+    
+    // 4. 直接读取 Flash
+    map_io_read_sync(&d->mio, buf, MAP_PAGE_BYTES, offset); // 读取失败得到全0，视为未映射
+
+    // 5. 提取数据
+    uint64_t v = entry_load_u64(buf, off);
+#endif
+#ifndef FAST_CONSTANTS
+    if (v == 0) return UNMAPPED_PPA;
+#endif
+    return v;
+#else
+    uint8_t *buf = tpc_lookup(d, mpn, 0);
+    if (unlikely(!buf)) {
+#ifdef TPC_ENTRY_RETAIN
+        EcSlot *rs = d->retain.cnt ? ec_find(&d->retain, lpn) : NULL;
+        if (rs) {
+            // 保留下来的条目：不装入整页
+            memstats_add(&d->ms, &d->ms.retain_hit_cnt, 1);
+#ifndef FAST_CONSTANTS
+            if (rs->val == 0) return UNMAPPED_PPA;
+#endif
+            return rs->val;
+        }
+#endif
+#ifdef MAP_LINEAR_ELISION
+        uint64_t lin_base;
+        if (lin_lookup(d, mpn, &lin_base)) {
+            // 线性页：不占 TPC，也不读盘
+            memstats_add(&d->ms, &d->ms.lin_read_cnt, 1);
+            uint64_t lv = lin_base + off;
+#ifndef FAST_CONSTANTS
+            if (lv == 0) return UNMAPPED_PPA;
+#endif
+            return lv;
+        }
+#endif
+        // 未分配(从未写过或已整页 TRIM)的页是全0页，不装入 TPC 也不读盘
+        if (!map_page_allocated(d, mpn)) {
+#ifdef FAST_CONSTANTS
+            return 0;
+#else
+            return UNMAPPED_PPA;
+#endif
+        }
+        buf = tpc_fill(d, mpn, 0);
+    }
+#ifdef TPC_ENTRY_RETAIN
+    tpc_touch_entry(d, buf, off);
+#endif
+#if defined(FAST_CONSTANTS) && ENTRY_BYTES == 8u
+    return ((const uint64_t *)buf)[off];
+#elif defined(FAST_CONSTANTS)
+    return entry_load_u64(buf, off);
+#else
+    uint64_t v = entry_load_u64(buf, off);
+    if (v == 0) return UNMAPPED_PPA;
+    return v;
+#endif
+#endif
+}
+
+#if !defined(USE_CMT) || !defined(DISABLE_TPC) || defined(MAP_MMAP)
+// 写入条目到TPC页，必要时分配映射页并在写回时统一刷盘(CMT + 无 TPC 时由 map_write_entries 整页读-改-写，不经过这里)
+static void write_ppn_to_map_with_gtd(FTL *d, uint64_t lpn, uint64_t ppn)
+{
+    // 原实现：获取 tpc_page，可能懒分配 buf；现在统一使用 tpc_get_buffer
+    uint64_t mpn = lpn_to_mpn(lpn);
+    uint32_t off = lpn_to_off(lpn);
+#if defined(MAP_MMAP)
+    // === mmap 模式：原地修改，写回由内核完成 ===
+    if (!map_page_allocated(d, mpn)) {
+        map_mark_allocated(d, mpn);
+        if ((mpn + 1) * MAP_PAGE_BYTES > d->mm_len)
+            mm_grow(d, (mpn + 1) * MAP_PAGE_BYTES);
+    }
+    entry_store_u64(mm_page(d, mpn), off, ppn);
+#elif defined(DISABLE_TPC)
+    // === 无 TPC 模式：读-改-写 ===
+    uint8_t buf[MAP_PAGE_BYTES] __attribute__((aligned(MAP_IO_ALIGN)));
+    off_t offset = (off_t)((uint64_t)mpn * MAP_PAGE_BYTES);
+    bool need_read = false;
+
+    // 1. 检查并标记 GTD
+#ifdef SMALL_GTD_ARRAY
+    if (gtd_is_allocated(d, mpn)) {
+        need_read = true;
+    } else {
+        gtd_mark_allocated(d, mpn);
+        need_read = false; // 新页，全0，不用读
+    }
+#else
+    if (d->gtd[mpn] != INVALID_PPA) {
+        need_read = true;
+    } else {
+        d->gtd[mpn] = mpn_to_ppa(mpn);
+        need_read = false;
+    }
+#endif
+
+    // 2. 如果是旧页，先读进来；如果是新页，清零
+    if (need_read) {
+        map_io_read_sync(&d->mio, buf, MAP_PAGE_BYTES, offset); // 读取失败当做新页处理(全0)
+    } else {
+        memset(buf, 0, MAP_PAGE_BYTES);
+    }
+
+    // 3. 修改数据
+    entry_store_u64(buf, off, ppn);
+
+    // 4. 直接写回 Flash(map_io_write 计入写入量统计)
+    map_io_write(&d->mio, buf, MAP_PAGE_BYTES, offset);
+    map_io_wait(&d->mio);
+
+#else
+#ifdef TPC_ENTRY_RETAIN
+    retain_update(d, lpn, ppn);
+#endif
+#ifdef MAP_LINEAR_ELISION
+    uint8_t *buf = tpc_lookup(d, mpn, 1);
+    if (unlikely(!buf)) {
+        uint64_t lin_base;
+        if (lin_lookup(d, mpn, &lin_base) && lin_base + off == ppn) {
+            // 写入值与线性预测一致：页保持线性，无需装入
+            memstats_add(&d->ms, &d->ms.lin_write_noop_cnt, 1);
+            return;
+        }
+        buf = tpc_fill(d, mpn, 1);
+    }
+#else
+    uint8_t *buf = tpc_get_buffer(d, mpn, 1);
+#endif
+    entry_store_u64(buf, off, ppn);
+#ifdef TPC_ENTRY_RETAIN
+    tpc_touch_entry(d, buf, off);
+#endif
+#endif
+}
+#endif
+
+#ifdef USE_CMT
+// ========== CMT：TPC 之前的条目级缓存 ==========
+// 读缺失时经 TPC 查出后装入；写只改 CMT 并置脏，写缺失不读旧值。淘汰的脏条目再写进它所在的映射页。
+// 缓存中的 ppn 以 0 表示未映射，与映射页中的约定一致
+
+static inline uint32_t *cmt_dirty_ctr(FTL *d, uint64_t mpn)
+{
+    return &d->cmt_dirty_cnt[(mpn * 0x9E3779B97F4A7C15ull) >> (64u - __builtin_ctz(CMT_DIRTY_BUCKETS))];
+}
+
+// 把同一映射页的 n 个条目作为一次页更新写入
+static void map_write_entries(FTL *d, uint64_t mpn, const uint32_t *offs, const uint64_t *ppns, uint32_t n)
+{
+#if defined(DISABLE_TPC) && !defined(MAP_MMAP)
+    // 无 TPC：一次读-改-写
+    uint8_t buf[MAP_PAGE_BYTES] __attribute__((aligned(MAP_IO_ALIGN)));
+    off_t offset = (off_t)(mpn * MAP_PAGE_BYTES);
+    if (map_page_allocated(d, mpn)) {
+        map_io_read_sync(&d->mio, buf, MAP_PAGE_BYTES, offset);
+    } else {
+        map_mark_allocated(d, mpn);
+        memset(buf, 0, MAP_PAGE_BYTES);
+    }
+    for (uint32_t i = 0; i < n; i++)
+        entry_store_u64(buf, offs[i], ppns[i]);
+    map_io_write(&d->mio, buf, MAP_PAGE_BYTES, offset);
+    map_io_wait(&d->mio);
+#else
+    // 第一条把映射页装入 TPC，其余都命中同一页
+    uint64_t first = mpn * (uint64_t)EPP;
+    for (uint32_t i = 0; i < n; i++)
+        write_ppn_to_map_with_gtd(d, first + offs[i], ppns[i]);
+#endif
+}
+
+// 写回一个已清掉脏标记(或已移出 CMT)的脏条目，同时收集 CMT 中同一映射页的其余脏条目一并写入(DFTL 批量更新)。
+// 计数器为 1 时该页没有别的脏条目，不必扫描；否则按页内偏移逐个查找，找齐计数器给出的上限即停
+static void cmt_writeback(FTL *d, uint64_t lpn, uint64_t ppn)
+{
+    uint32_t offs[EPP];
+    uint64_t ppns[EPP];
+    uint64_t mpn = lpn_to_mpn(lpn);
+    uint32_t *ctr = cmt_dirty_ctr(d, mpn);
+    uint32_t others = --*ctr; // 哈希冲突只会多算
+    uint32_t n = 0;
+    offs[n] = lpn_to_off(lpn);
+    ppns[n++] = ppn;
+    uint64_t first = mpn * (uint64_t)EPP;
+    for (uint32_t o = 0; o < EPP && others; o++) {
+        if (first + o == lpn)
+            continue;
+        EcSlot *s = ec_peek(&d->cmt, first + o);
+        if (s && (s->val & EC_DIRTY)) {
+            s->val &= ~EC_DIRTY;
+            offs[n] = o;
+            ppns[n++] = EC_PPN(s->val);
+            --*ctr;
+            others--;
+        }
+    }
+    map_write_entries(d, mpn, offs, ppns, n);
+    memstats_add(&d->ms, &d->ms.cmt_dirty_handle_cnt, n);
+    memstats_add(&d->ms, &d->ms.cmt_wb_page_cnt, 1);
+}
+
+// CMT 已满时按 CLOCK 淘汰一项
+static void cmt_make_room(FTL *d)
+{
+    if (likely(d->cmt.cnt < d->cmt.limit))
+        return;
+    EcSlot v;
+    ec_evict(&d->cmt, &v);
+    if (v.val & EC_DIRTY)
+        cmt_writeback(d, v.lpn, EC_PPN(v.val));
+}
+
+static uint64_t cmt_read(FTL *d, uint64_t lpn)
+{
+    memstats_add(&d->ms, &d->ms.cmt_query_cnt, 1);
+    EcSlot *s = ec_find(&d->cmt, lpn);
+    uint64_t ppn;
+    if (s) {
+        memstats_add(&d->ms, &d->ms.cmt_hit_cnt, 1);
+        ppn = EC_PPN(s->val);
+    } else {
+        ppn = read_ppn_from_map_with_gtd(d, lpn);
+        if (ppn == UNMAPPED_PPA)
+            ppn = 0;
+        cmt_make_room(d);
+        ec_insert(&d->cmt, lpn, ppn);
+    }
+#ifndef FAST_CONSTANTS
+    if (ppn == 0) return UNMAPPED_PPA;
+#endif
+    return ppn;
+}
+
+static void cmt_modify(FTL *d, uint64_t lpn, uint64_t ppn)
+{
+    memstats_add(&d->ms, &d->ms.cmt_query_cnt, 1);
+    EcSlot *s = ec_find(&d->cmt, lpn);
+    if (s) {
+        memstats_add(&d->ms, &d->ms.cmt_hit_cnt, 1);
+        if (!(s->val & EC_DIRTY))
+            ++*cmt_dirty_ctr(d, lpn_to_mpn(lpn));
+        s->val = ppn | EC_DIRTY;
+        return;
+    }
+    cmt_make_room(d);
+    ec_insert(&d->cmt, lpn, ppn | EC_DIRTY);
+    ++*cmt_dirty_ctr(d, lpn_to_mpn(lpn));
+}
+#endif
+
+// ========== 资源报告（保持原版，但补充线程内存统计） ==========
+
+static void PrintResourceReport(const char *title, FTL *d)
+{
+    fprintf(stdout, "\n================ Resource Report: %s ================\n", title);
+#ifdef DEBUG_FTL
+    fprintf(stdout, "Configures:\n");
+    fprintf(stdout, "  - Total(Max) LPNS:     %" PRIu64 " pages (= %.6f GB)\n", d->total_lpns, to_gb(d->total_lpns * 4096ull));
+    fprintf(stdout, "  - Max Cache Pages (Entries) in CMT:   %u entries ( %" PRIu64 " B per entry) (about %.6f GB)\n",
+            d->cmt.limit, (uint64_t)sizeof(EcSlot), to_gb((uint64_t)d->cmt.cap * sizeof(EcSlot)));
+    fprintf(stdout, "  - CMT Table Size:    %u slots (open addressing, CLOCK replacement)\n", d->cmt.cap);
+#if defined(SMALL_GTD_ARRAY) && defined(GTD_HIERARCHICAL)
+    fprintf(stdout, "  - GTD Size:     %" PRIu64 " entries, leaves used %" PRIu64 " / %" PRIu64 " (%" PRIu64 " B each), directory %" PRIu64 " B\n",
+            d->total_mpns, d->gtd_leaves_used, d->gtd_n_leaves, (uint64_t)GTD_LEAF_BYTES,
+            (uint64_t)(d->gtd_n_leaves * sizeof(uint64_t *) + GTD_SUMMARY_WORDS(d->gtd_n_leaves) * 8ull));
+#elif defined(SMALL_GTD_ARRAY)
+    fprintf(stdout, "  - GTD Size:     %" PRIu64 " entries (= %.6f GB)\n",
+            d->total_mpns, to_gb(d->total_mpns * sizeof(uint8_t)));
+#else
+    fprintf(stdout, "  - GTD Size:     %" PRIu64 " entries (= %.6f GB)\n",
+            d->total_mpns, to_gb(d->total_mpns * sizeof(uint64_t)));
+#endif
+    fprintf(stdout, "  - Map Entry:    %u B, %u entries per mapping page\n", (unsigned)ENTRY_BYTES, (unsigned)EPP);
+    if (d->cfg.mem_budget)
+        fprintf(stdout, "  - Memory budget:  %" PRIu64 " B -> TPC %u pages, input buffer %zu B, output buffer %zu B, %u batches (%zu B each)\n",
+                d->cfg.mem_budget, d->tpc_slots, d->in_buf_bytes, d->out_buf_bytes, d->batch_cnt, sizeof(TaskBatch));
+    fprintf(stdout, "  - TPC Sets:     %u, Ways per Set: %u, Total Pages: %u (= %.6f GB), Way Lookup: %s\n",
+            d->tpc_set_mask + 1u, (unsigned)TPC_WAYS, d->tpc_slots,
+            to_gb((uint64_t)d->tpc_slots * MAP_PAGE_BYTES), tpc_lookup_isa());
+
+    uint64_t total = d->ms.total_used;
+    fprintf(stdout, "Heap Memory (current / peak): %" PRIu64 " B (%.6f GB) / %" PRIu64 " B (%.6f GB)\n",
+            total, to_gb(total), d->ms.peak_used, to_gb(d->ms.peak_used));
+    fprintf(stdout, "  - Control structures and setvbuf(1MB):   %" PRIu64 " B (%.6f GB)\n",
+            d->ms.ctrl_used, to_gb(d->ms.ctrl_used));
+    fprintf(stdout, "  - CMT entries:      %" PRIu64 " B (%.6f GB)\n",
+            d->ms.cmt_entrys_used, to_gb(d->ms.cmt_entrys_used));
+    fprintf(stdout, "  - GTD uses:      %" PRIu64 " B (%.6f GB)\n",
+            d->ms.gtd_used, to_gb(d->ms.gtd_used));
+    fprintf(stdout, "  - CMT hash table:   %" PRIu64 " B (%.6f GB)\n",
+            d->ms.cmt_hash_used, to_gb(d->ms.cmt_hash_used));
+    fprintf(stdout, "  - free cmt entry cnt:     %u , %" PRIu64 " B (%.6f GB)\n",
+            d->cmt.limit - d->cmt.cnt,
+            (uint64_t)(d->cmt.limit - d->cmt.cnt) * sizeof(EcSlot),
+            to_gb((uint64_t)(d->cmt.limit - d->cmt.cnt) * sizeof(EcSlot)));
+    fprintf(stdout, "  - used cmt entry cnt:     %u , %" PRIu64 " B (%.6f GB)\n",
+            d->cmt.cnt,
+            (uint64_t)d->cmt.cnt * sizeof(EcSlot),
+            to_gb((uint64_t)d->cmt.cnt * sizeof(EcSlot)));
+    fprintf(stdout, "  - CMT hit ratio:     %.6f (%" PRIu64 " / %" PRIu64 ")\n",
+            d->ms.cmt_query_cnt ? (double)d->ms.cmt_hit_cnt / d->ms.cmt_query_cnt : 0.0,
+            d->ms.cmt_hit_cnt, d->ms.cmt_query_cnt);
+    fprintf(stdout, "  - TPC hit ratio:     %.6f (%" PRIu64 " / %" PRIu64 ")\n",
+            d->ms.tpc_query_cnt ? (double)d->ms.tpc_hit_cnt / d->ms.tpc_query_cnt : 0.0,
+            d->ms.tpc_hit_cnt, d->ms.tpc_query_cnt);
+#ifdef MAP_LINEAR_ELISION
+    fprintf(stdout, "  - Linear map pages:  %" PRIu64 " (table %" PRIu64 " B), detected at write-back %" PRIu64 ", materialized %" PRIu64 "\n",
+            d->lin_cnt, d->lin_cap * (uint64_t)sizeof(LinEntry),
+            d->ms.lin_detect_cnt, d->ms.lin_materialize_cnt);
+    fprintf(stdout, "  - Linear page reads: %" PRIu64 ", no-op writes: %" PRIu64 " (served without TPC or map I/O)\n",
+            d->ms.lin_read_cnt, d->ms.lin_write_noop_cnt);
+#endif
+#ifdef TPC_ENTRY_RETAIN
+    fprintf(stdout, "  - Retained entries:  %u / %u (table %" PRIu64 " B), %" PRIu64 " kept at eviction, %" PRIu64 " dense pages skipped, %" PRIu64 " TPC-miss reads served\n",
+            d->retain.cnt, d->retain.limit, (uint64_t)d->retain.cap * sizeof(EcSlot),
+            d->ms.retain_put_cnt, d->ms.retain_dense_cnt, d->ms.retain_hit_cnt);
+#endif
+#ifdef MAP_DURABLE
+    fprintf(stdout, "  - Durable mode:      window %u modifies, %" PRIu64 " group commits (%" PRIu64 " records, %" PRIu64 " B WAL)\n",
+            d->wal_window, d->ms.wal_group_cnt, d->ms.wal_rec_cnt, d->ms.wal_bytes);
+    fprintf(stdout, "  - Durable cost:      WAL write+fdatasync %.3f ms (%.1f us per group), %" PRIu64 " checkpoints %.3f ms, %" PRIu64 " records replayed at startup\n",
+            d->ms.wal_sync_ns / 1e6,
+            d->ms.wal_group_cnt ? d->ms.wal_sync_ns / 1e3 / (double)d->ms.wal_group_cnt : 0.0,
+            d->ms.durable_ckpt_cnt, d->ms.durable_ckpt_ns / 1e6, d->ms.wal_replay_cnt);
+#endif
+#ifdef MAP_WARM_RESTART
+    fprintf(stdout, "  - Warm restart:      %s, %" PRIu64 " hot pages preloaded into TPC\n",
+            d->ckpt_loaded ? "from checkpoint" : "cold", d->ms.warm_page_cnt);
+#endif
+#ifdef TPC_MICRO_TLB
+    fprintf(stdout, "  - micro-TLB hit ratio:   %.6f (%" PRIu64 " / %" PRIu64 " lookups past last-hit, %u entries), %.2f%% of TPC hits\n",
+            d->ms.utlb_query_cnt ? (double)d->ms.utlb_hit_cnt / d->ms.utlb_query_cnt : 0.0,
+            d->ms.utlb_hit_cnt, d->ms.utlb_query_cnt, (unsigned)UTLB_ENTRIES,
+            d->ms.tpc_hit_cnt ? 100.0 * d->ms.utlb_hit_cnt / d->ms.tpc_hit_cnt : 0.0);
+#endif
+#ifdef TPC_MISS_CLASSIFY
+    {
+        uint64_t misses = d->ms.tpc_conflict_miss_cnt + d->ms.tpc_capacity_miss_cnt;
+        fprintf(stdout, "  - TPC conflict miss ratio:   %.6f (%" PRIu64 " / %" PRIu64 " queries), %.2f%% of misses\n",
+                d->ms.tpc_query_cnt ? (double)d->ms.tpc_conflict_miss_cnt / d->ms.tpc_query_cnt : 0.0,
+                d->ms.tpc_conflict_miss_cnt, d->ms.tpc_query_cnt,
+                misses ? 100.0 * d->ms.tpc_conflict_miss_cnt / misses : 0.0);
+        fprintf(stdout, "  - TPC capacity miss ratio:   %.6f (%" PRIu64 " / %" PRIu64 " queries, incl. compulsory)\n",
+                d->ms.tpc_query_cnt ? (double)d->ms.tpc_capacity_miss_cnt / d->ms.tpc_query_cnt : 0.0,
+                d->ms.tpc_capacity_miss_cnt, d->ms.tpc_query_cnt);
+        fprintf(stdout, "  - TPC set index:     %s\n",
+#ifdef TPC_HASH_SET_INDEX
+                "xor-folded mpn"
+#else
+                "mpn low bits"
+#endif
+                );
+    }
+#endif
+#ifdef TPC_PREFETCH
+    fprintf(stdout, "  - TPC prefetch accuracy:     %.6f (%" PRIu64 " used / %" PRIu64 " issued, %" PRIu64 " wasted)\n",
+            d->ms.pf_issue_cnt ? (double)d->ms.pf_hit_cnt / d->ms.pf_issue_cnt : 0.0,
+            d->ms.pf_hit_cnt, d->ms.pf_issue_cnt, d->ms.pf_waste_cnt);
+    fprintf(stdout, "  - TPC prefetch coverage:     %.6f (%" PRIu64 " used / %" PRIu64 " demand reads + used)\n",
+            (d->ms.pf_hit_cnt + d->ms.tpc_miss_read_cnt) ?
+                (double)d->ms.pf_hit_cnt / (d->ms.pf_hit_cnt + d->ms.tpc_miss_read_cnt) : 0.0,
+            d->ms.pf_hit_cnt, d->ms.tpc_miss_read_cnt);
+    fprintf(stdout, "  - TPC prefetch page cache hints: %" PRIu64 ", fadvise switches: %" PRIu64 "\n",
+            d->ms.pf_hint_cnt, d->ms.pf_fadv_switch_cnt);
+#endif
+    fprintf(stdout, "  - CMT dirty entry handle cnt (not including FTLDestory):     %" PRIu64 " in %" PRIu64 " page updates (%.2f entries per page)\n",
+            d->ms.cmt_dirty_handle_cnt, d->ms.cmt_wb_page_cnt,
+            d->ms.cmt_wb_page_cnt ? (double)d->ms.cmt_dirty_handle_cnt / (double)d->ms.cmt_wb_page_cnt : 0.0);
+    fprintf(stdout, "  - TPC dirty entry handle cnt (not including FTLDestory):     %" PRIu64 "\n",
+            d->ms.tpc_dirty_handle_cnt);
+    fprintf(stdout, "  - TPC control+hash uses:      %" PRIu64 " B (%.6f GB)\n",
+            d->ms.tpc_used, to_gb(d->ms.tpc_used));
+    fprintf(stdout, "  - TPC pages (page_pool_base): %" PRIu64 " B (%.6f GB)\n",
+            d->ms.tpc_page_used, to_gb(d->ms.tpc_page_used));
+    fprintf(stdout, "  - Threads/pipeline memory:    %" PRIu64 " B (%.6f GB)\n",
+            d->ms.threads_used, to_gb(d->ms.threads_used));
+#ifdef TPC_ZCACHE
+    fprintf(stdout, "  - Compressed cache (arena+index): %" PRIu64 " B (%.6f GB), budget %" PRIu64 " B (arena %u B, index %u pages)\n",
+            d->ms.zcache_used, to_gb(d->ms.zcache_used), d->zc_budget, d->zc_arena_bytes, d->zc_max_pages);
+    fprintf(stdout, "  - Compressed cache pages:     %u resident (TPC+ZC = %u pages), avg %.1f B/page\n",
+            (unsigned)d->zc_valid_cnt, d->tpc_slots + (unsigned)d->zc_valid_cnt,
+            d->ms.zc_put_cnt ? (double)d->ms.zc_put_bytes / d->ms.zc_put_cnt : 0.0);
+    fprintf(stdout, "  - Compressed cache hits:     %" PRIu64 ", puts: %" PRIu64 ", rejected: %" PRIu64
+            ", evicted: %" PRIu64 " (%" PRIu64 " dirty written back)\n",
+            d->ms.zc_hit_cnt, d->ms.zc_put_cnt, d->ms.zc_reject_cnt,
+            d->ms.zc_evict_cnt, d->ms.zc_dirty_writeback_cnt);
+#endif
+
+    uint64_t minflt_now = 0, majflt_now = 0;
+    memstats_sample_faults(&minflt_now, &majflt_now);
+    fprintf(stdout, "  - Page faults in FTLInit:     %" PRIu64 " minor\n", d->ms.minflt_init);
+    fprintf(stdout, "  - Page faults after FTLInit:  %" PRIu64 " minor, %" PRIu64 " major\n",
+            minflt_now - d->ms.minflt_base, majflt_now - d->ms.majflt_base);
+    uint64_t rss_anon, rss_file, rss_shmem;
+    memstats_sample_rss(&rss_anon, &rss_file, &rss_shmem);
+    fprintf(stdout, "  - Process RSS:     anon %" PRIu64 " B, file-backed %" PRIu64 " B, shmem %" PRIu64 " B\n",
+            rss_anon, rss_file, rss_shmem);
+    FTLMemUsage mu;
+    if (FTLMemSamplerPeek(&mu)) {
+        fprintf(stdout, "  - Sampled peak (%" PRIu64 " samples):     RSS %" PRIu64 " KB, PSS %" PRIu64 " KB (anon %" PRIu64 " KB, file %" PRIu64 " KB, shmem %" PRIu64 " KB)\n",
+                mu.samples, mu.rss_kb, mu.pss_kb, mu.pss_anon_kb, mu.pss_file_kb, mu.pss_shmem_kb);
+        // 与上面 MemStats 分类对照：分配了多少 vs 实际驻留过多少(所有实例相加)；其余分类只有进程级峰值
+        fprintf(stdout, "  - Sampled peak resident by component:     TPC pages %" PRIu64 " KB (class %" PRIu64 " B), pipeline %" PRIu64 " KB (class %" PRIu64 " B), I/O buffers %" PRIu64 " KB (%zu B)\n",
+                mu.comp_rss_kb[FTL_MEM_TPC_PAGES], d->ms.tpc_page_used, mu.comp_rss_kb[FTL_MEM_PIPELINE],
+                d->ms.threads_used, mu.comp_rss_kb[FTL_MEM_IO_BUFFERS], d->in_buf_bytes + d->out_buf_bytes);
+        fprintf(stdout, "  - GTD, CMT, tables and libc are scattered heap allocations and only covered by the process-wide peak\n");
+        if (d->cfg.mem_budget && mu.rss_kb * 1024ull > d->cfg.mem_budget)
+            fprintf(stdout, "  - Peak RSS exceeds memory budget by %" PRIu64 " KB (GTD, linear table, libc and thread stacks are outside the budget)\n",
+                    (uint64_t)(mu.rss_kb - d->cfg.mem_budget / 1024ull));
+    }
+#ifdef MAP_MMAP
+    fprintf(stdout, "  - map.ssd mapping:     %" PRIu64 " B mapped, %" PRIu64 " B resident in page cache (counted as file-backed RSS once touched)\n",
+            d ? d->mm_len : 0, mm_resident_bytes(d));
+#endif
+#ifdef HUGEPAGE_BACKING
+    fprintf(stdout, "  - Huge page backed:     %" PRIu64 " B hugetlb, %" PRIu64 " B THP (madvise)\n",
+            d->ms.huge_tlb_used, d->ms.huge_thp_used);
+#endif
+
+    fprintf(stdout, "SSD Usage (from filesystem stat):\n");
+    fprintf(stdout, "  - map.ssd size:   %" PRIu64 " B (%.6f GB), blocks: %" PRIu64 " B (%.6f GB)\n",
+            d->ss.map_st_size, to_gb(d->ss.map_st_size),
+            d->ss.map_st_blocks, to_gb(d->ss.map_st_blocks));
+
+    fprintf(stdout, "SSD Logical write accounting (program-side):\n");
+    fprintf(stdout, "  - map pages written:     %" PRIu64 " B (%.6f GB)\n",
+            d->ss.map_pages_written_bytes, to_gb(d->ss.map_pages_written_bytes));
+    fprintf(stdout, "  - map pages written cnt:     %" PRIu64 " \n", d->ss.map_pages_written_cnt);
+    fprintf(stdout, "  - map pages read cnt:     %" PRIu64 " \n", d->ss.map_pages_read_cnt);
+    fprintf(stdout, "  - map max end offset:    %" PRIu64 " B (%.6f GB)\n",
+            d->ss.map_max_off, to_gb(d->ss.map_max_off));
+    fprintf(stdout, "  - map bytes read:     %" PRIu64 " B (%.6f GB)\n",
+            d->ss.map_bytes_read, to_gb(d->ss.map_bytes_read));
+#ifdef MAP_DISK_COMPRESS
+    fprintf(stdout, "  - map page format:     compressed, %" PRIu64 " pages located, %" PRIu64 " B in live slots, slot space end %" PRIu64 " B\n",
+            d ? d->mloc_cnt : 0, d->ss.map_slot_bytes, d->ss.map_slot_end);
+    fprintf(stdout, "  - map compression ratio:     %.2fx (%" PRIu64 " B logical / %" PRIu64 " B written)\n",
+            d->ss.map_pages_written_bytes ? (double)d->ss.map_logical_bytes_written / (double)d->ss.map_pages_written_bytes : 0.0,
+            d->ss.map_logical_bytes_written, d->ss.map_pages_written_bytes);
+#endif
+#ifdef MAP_LOG_STRUCTURED
+    {
+        uint64_t moved = d->ss.map_gc_pages_moved;
+        uint64_t host = d->ss.map_pages_written_cnt - moved;
+        uint32_t nsegs = d ? d->log_nsegs : 0;
+        uint64_t valid = d ? d->log_valid : 0;
+        fprintf(stdout, "  - map page format:     log-structured, %u segments x %u pages (%u free), %" PRIu64 " valid pages (%.1f%% utilized)\n",
+                nsegs, LOG_SEG_PAGES, d ? d->log_free_cnt : 0, valid,
+                nsegs ? 100.0 * (double)valid / ((double)nsegs * LOG_SEG_PAGES) : 0.0);
+        fprintf(stdout, "  - map write amplification:     %.3f (%" PRIu64 " host page writes + %" PRIu64 " GC moves)\n",
+                host ? (double)(host + moved) / (double)host : 0.0, host, moved);
+        fprintf(stdout, "  - map GC cost:     %" PRIu64 " segments reclaimed, %.3f ms\n",
+                d->ss.map_gc_runs, (double)d->ss.map_gc_ns / 1e6);
+    }
+#endif
+    if (d->ms.trim_lpn_cnt)
+        fprintf(stdout, "  - TRIM:     %" PRIu64 " LBAs, %" PRIu64 " map pages released, %" PRIu64 " B punched (%" PRIu64 " punch failures)\n",
+                d->ms.trim_lpn_cnt, d->ms.trim_page_cnt, d->ss.map_punch_bytes, d->ss.map_punch_fail_cnt);
+    fprintf(stdout, "  - map I/O backend:     %s%s, %" PRIu64 " batches, %.2f requests per batch",
+            d && d->mio.ops ? d->mio.ops->name : "-", d && d->mio.direct ? " (O_DIRECT)" : "", d->ms.mapio_batch_cnt,
+            d->ms.mapio_batch_cnt ? (double)d->ms.mapio_req_cnt / (double)d->ms.mapio_batch_cnt : 0.0);
+    if (d->ms.map_mem_used)
+        fprintf(stdout, ", %" PRIu64 " B held in memory", d->ms.map_mem_used);
+    fprintf(stdout, "\n");
+    if (d->nand.enabled) {
+        const NandSim *n = &d->nand;
+        uint64_t dev_ns = nand_sim_device_ns(&d->nand);
+        uint64_t die_ns = 0, ch_ns = 0;
+        for (uint32_t i = 0; i < n->n_dies; i++)
+            die_ns += n->die_busy_ns[i];
+        for (uint32_t i = 0; i < n->cfg.channels; i++)
+            ch_ns += n->ch_busy_ns[i];
+        fprintf(stdout, "NAND simulation (map I/O):\n");
+        fprintf(stdout, "  - geometry:     %u ch x %u dies x %u planes x %u blocks x %u pages, tR %u ns, tPROG %u ns, tBERS %u ns, xfer %u ns\n",
+                n->cfg.channels, n->cfg.dies_per_channel, n->cfg.planes_per_die, n->cfg.blocks_per_plane,
+                n->cfg.pages_per_block, n->cfg.t_read_ns, n->cfg.t_prog_ns, n->cfg.t_erase_ns, n->cfg.t_xfer_ns);
+        fprintf(stdout, "  - operations:     %" PRIu64 " reads, %" PRIu64 " programs, %" PRIu64 " erases, %" PRIu64 " pages wrapped\n",
+                n->read_cnt, n->prog_cnt, n->erase_cnt, n->wrap_cnt);
+        fprintf(stdout, "  - device time:     %.3f ms (read stall %.3f ms)\n",
+                (double)dev_ns / 1e6, (double)n->read_stall_ns / 1e6);
+        fprintf(stdout, "  - utilization:     die %.2f%%, channel %.2f%%\n",
+                dev_ns ? 100.0 * (double)die_ns / ((double)dev_ns * n->n_dies) : 0.0,
+                dev_ns ? 100.0 * (double)ch_ns / ((double)dev_ns * n->cfg.channels) : 0.0);
+    }
+#else
+    fprintf(stdout, "Resource report is disabled. Compile with DEBUG_FTL to enable it.\n");
+#endif
+#ifdef TIME_TEST
+    fprintf(stdout, "\nTime Statistics:\n");
+    fprintf(stdout, "  - total_io_parse time:    %.6f seconds\n", total_io_parse);
+    fprintf(stdout, "  - total_consumer_wait time:   %.6f seconds\n", total_consumer_wait);
+#endif
+    fprintf(stdout, "=====================================================\n");
+}
+
+static inline void ftl_apply_modify(FTL *d, uint64_t lba, uint64_t ppn)
+{
+#ifdef USE_CMT
+    cmt_modify(d, lba, ppn);
+#else
+    write_ppn_to_map_with_gtd(d, lba, ppn);
+#endif
+}
+
+// 把所有脏映射页(CMT、TPC、压缩缓存)写回 map.ssd
+static void ftl_flush_all(FTL *d)
+{
+#ifdef USE_CMT
+    // 按映射页成批写回：遇到的第一条脏条目带出同一页的其余脏条目
+    for (uint32_t i = 0; i < d->cmt.cap; i++) {
+        EcSlot *s = &d->cmt.slots[i];
+        if (s->lpn != EC_EMPTY && (s->val & EC_DIRTY)) {
+            s->val &= ~EC_DIRTY;
+            cmt_writeback(d, s->lpn, s->val);
+        }
+    }
+#endif
+#ifndef DISABLE_TPC
+    for (uint32_t i = 0; i < d->tpc_slots; i++) {
+#ifdef MAP_LINEAR_ELISION
+        // 线性的脏页直接按淘汰处理：只记 base，不写盘(否则写回后变成干净页，之后淘汰时不再检测线性)
+        uint64_t lin_base;
+        if (CHECK_TPC_SLOT_VALID(d, i) && (d->tpc_flags[i] & TPC_F_DIRTY) &&
+            lin_detect(tpc_slot_buf(d, i), &lin_base)) {
+            tpc_drop_slot(d, i);
+            continue;
+        }
+#endif
+        // 全部脏页排成批写回，最后一次等齐
+        if (CHECK_TPC_SLOT_VALID(d, i) && (d->tpc_flags[i] & TPC_F_DIRTY)) {
+            map_write_page_submit(d, d->tpc_tags[i], tpc_slot_buf(d, i));
+            d->tpc_flags[i] &= (uint8_t)~TPC_F_DIRTY;
+            memstats_add(&d->ms, &d->ms.tpc_dirty_handle_cnt, 1);
+        }
+    }
+    map_io_wait(&d->mio);
+#else
+    (void)d; // 无 TPC 且无 CMT 时没有需要写回的缓存
+#endif
+#ifdef TPC_ZCACHE
+    // 压缩缓存中的脏页同样需要写回
+    while (d->zc_q_count > 0)
+        zc_pop_oldest(d);
+    map_io_wait(&d->mio);
+#endif
+}
+
+#ifdef MAP_WARM_RESTART
+// ========== 热重启检查点 ==========
+// 退出时先把所有脏映射页写回并 fdatasync，再把 GTD(按 CKPT_CHUNK_MPNS 分块，只存非空块)、TPC 中的热页 mpn、
+// 线性页表和压缩定位表写入 map.ssd.ckpt(先写临时文件再 rename)。启动时校验通过就恢复这些状态并预读热页，
+// 随后删除检查点：运行中 map.ssd 会被原地改写，旧检查点不再可信
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t entry_bytes;
+    uint32_t layout;     // CKPT_LAYOUT_* 位
+    uint32_t tpc_slots;
+    uint64_t total_mpns;
+    uint64_t map_size;   // 写检查点时 map.ssd 的大小
+    uint64_t n_chunks;   // 非空 GTD 块数
+    uint64_t n_hot;
+    uint64_t n_lin;
+    uint64_t n_loc;
+    uint64_t payload_bytes;
+    uint64_t wal_lsn;    // 持久模式：检查点已包含 lsn 小于该值的全部修改
+    uint64_t sum;        // 负载的 FNV-1a 校验和
+} CkptHdr;
+
+typedef struct {
+    FILE *fp;
+    uint64_t bytes;
+    uint64_t sum;
+    bool ok;
+} CkptWriter;
+
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+} CkptReader;
+
+static inline uint64_t ckpt_fnv(uint64_t h, const void *p, size_t n)
 {
-    fprintf(stdout, "\n================ Resource Report: %s ================\n", title);
-#ifdef DEBUG_FTL
-    fprintf(stdout, "Configures:\n");
-    fprintf(stdout, "  - Total(Max) LPNS:     %" PRIu64 " pages (= %.6f GB)\n", d->total_lpns, to_gb(d->total_lpns * 4096ull));
-    fprintf(stdout, "  - Max Cache Pages (Entries) in CMT:   %" PRIu64 " entries ( %" PRIu64 " B per entry) (about %.6f GB)\n",
-            d->tt_entries, (uint64_t)sizeof(cmt_entry), to_gb(d->tt_entries * sizeof(cmt_entry)));
-    fprintf(stdout, "  - CMT Hash Table Size:    %" PRIu64 " buckets\n", (uint64_t)CMT_HASH_SIZE);
+    const uint8_t *b = (const uint8_t *)p;
+    for (size_t i = 0; i < n; i++)
+        h = (h ^ b[i]) * 0x100000001B3ull;
+    return h;
+}
+
+static inline uint32_t ckpt_layout(void)
+{
+    uint32_t l = 0;
 #ifdef SMALL_GTD_ARRAY
-    fprintf(stdout, "  - GTD Size:     %" PRIu64 " entries (= %.6f GB)\n",
-            d->total_mpns, to_gb(d->total_mpns * sizeof(uint8_t)));
+    l |= CKPT_LAYOUT_SMALL_GTD;
+#endif
+#ifdef MAP_LINEAR_ELISION
+    l |= CKPT_LAYOUT_LINEAR;
+#endif
+#ifdef MAP_DISK_COMPRESS
+    l |= CKPT_LAYOUT_COMPRESS;
+#endif
+    return l;
+}
+
+static void ckpt_put(CkptWriter *w, const void *p, size_t n)
+{
+    if (w->ok && fwrite(p, 1, n, w->fp) != n)
+        w->ok = false;
+    w->sum = ckpt_fnv(w->sum, p, n);
+    w->bytes += n;
+}
+
+static bool ckpt_get(CkptReader *r, void *p, size_t n)
+{
+    if ((size_t)(r->end - r->p) < n)
+        return false;
+    memcpy(p, r->p, n);
+    r->p += n;
+    return true;
+}
+
+// 取出第 ci 个 GTD 块的位图(CKPT_CHUNK_WORDS 个字)，块内无已分配页时返回 false
+static bool gtd_chunk_get(const FTL *d, uint64_t ci, uint64_t *bits)
+{
+#if defined(SMALL_GTD_ARRAY) && defined(GTD_HIERARCHICAL)
+    if (!((d->gtd_summary[ci >> 6] >> (ci & 63u)) & 1u))
+        return false;
+    memcpy(bits, d->gtd_dir[ci], GTD_LEAF_BYTES);
+#elif defined(SMALL_GTD_ARRAY)
+    uint64_t lo = ci * (CKPT_CHUNK_MPNS / 8u);
+    uint64_t n = GTD_BITMAP_BYTES(d->total_mpns) - lo;
+    memset(bits, 0, CKPT_CHUNK_MPNS / 8u);
+    memcpy(bits, d->gtd + lo, n < CKPT_CHUNK_MPNS / 8u ? n : CKPT_CHUNK_MPNS / 8u);
 #else
-    fprintf(stdout, "  - GTD Size:     %" PRIu64 " entries (= %.6f GB)\n",
-            d->total_mpns, to_gb(d->total_mpns * sizeof(uint64_t)));
+    memset(bits, 0, CKPT_CHUNK_MPNS / 8u);
+    uint64_t first = ci * CKPT_CHUNK_MPNS;
+    for (uint64_t i = 0; i < CKPT_CHUNK_MPNS && first + i < d->total_mpns; i++) {
+        if (d->gtd[first + i] != INVALID_PPA)
+            bits[i >> 6] |= 1ull << (i & 63u);
+    }
 #endif
-    fprintf(stdout, "  - TPC Sets:     %u, Ways per Set: %u, Total Pages: %u (= %.6f GB)\n",
-            (unsigned)TPC_SETS, (unsigned)TPC_WAYS,
-            (unsigned)(TPC_SETS * TPC_WAYS),
-            to_gb((uint64_t)TPC_SETS * TPC_WAYS * MAP_PAGE_BYTES));
+    for (uint32_t w = 0; w < CKPT_CHUNK_WORDS; w++) {
+        if (bits[w])
+            return true;
+    }
+    return false;
+}
 
-    uint64_t total = g_memstats.total_used;
-    fprintf(stdout, "Heap Memory (current / peak): %" PRIu64 " B (%.6f GB) / %" PRIu64 " B (%.6f GB)\n",
-            total, to_gb(total), g_memstats.peak_used, to_gb(g_memstats.peak_used));
-    fprintf(stdout, "  - Control structures and setvbuf(1MB):   %" PRIu64 " B (%.6f GB)\n",
-            g_memstats.ctrl_used, to_gb(g_memstats.ctrl_used));
-    fprintf(stdout, "  - CMT entries:      %" PRIu64 " B (%.6f GB)\n",
-            g_memstats.cmt_entrys_used, to_gb(g_memstats.cmt_entrys_used));
-    fprintf(stdout, "  - GTD uses:      %" PRIu64 " B (%.6f GB)\n",
-            g_memstats.gtd_used, to_gb(g_memstats.gtd_used));
-    fprintf(stdout, "  - CMT hash table:   %" PRIu64 " B (%.6f GB)\n",
-            g_memstats.cmt_hash_used, to_gb(g_memstats.cmt_hash_used));
-    fprintf(stdout, "  - free cmt entry cnt:     %" PRIu64 " , %" PRIu64 " B (%.6f GB)\n",
-            d->free_cmt_entry_cnt,
-            d->free_cmt_entry_cnt * (uint64_t)sizeof(cmt_entry),
-            to_gb(d->free_cmt_entry_cnt * (uint64_t)sizeof(cmt_entry)));
-    fprintf(stdout, "  - used cmt entry cnt:     %" PRIu64 " , %" PRIu64 " B (%.6f GB)\n",
-            d->used_cmt_entry_cnt,
-            d->used_cmt_entry_cnt * (uint64_t)sizeof(cmt_entry),
-            to_gb(d->used_cmt_entry_cnt * (uint64_t)sizeof(cmt_entry)));
-    fprintf(stdout, "  - CMT hit ratio:     %.6f (%" PRIu64 " / %" PRIu64 ")\n",
-            g_memstats.cmt_query_cnt ? (double)g_memstats.cmt_hit_cnt / g_memstats.cmt_query_cnt : 0.0,
-            g_memstats.cmt_hit_cnt, g_memstats.cmt_query_cnt);
-    fprintf(stdout, "  - TPC hit ratio:     %.6f (%" PRIu64 " / %" PRIu64 ")\n",
-            g_memstats.tpc_query_cnt ? (double)g_memstats.tpc_hit_cnt / g_memstats.tpc_query_cnt : 0.0,
-            g_memstats.tpc_hit_cnt, g_memstats.tpc_query_cnt);
-    fprintf(stdout, "  - CMT dirty entry handle cnt (not including FTLDestory):     %" PRIu64 "\n",
-            g_memstats.cmt_dirty_handle_cnt);
-    fprintf(stdout, "  - TPC dirty entry handle cnt (not including FTLDestory):     %" PRIu64 "\n",
-            g_memstats.tpc_dirty_handle_cnt);
-    fprintf(stdout, "  - TPC control+hash uses:      %" PRIu64 " B (%.6f GB)\n",
-            g_memstats.tpc_used, to_gb(g_memstats.tpc_used));
-    fprintf(stdout, "  - TPC pages (page_pool_base): %" PRIu64 " B (%.6f GB)\n",
-            g_memstats.tpc_page_used, to_gb(g_memstats.tpc_page_used));
-    fprintf(stdout, "  - Threads/pipeline memory:    %" PRIu64 " B (%.6f GB)\n",
-            g_memstats.threads_used, to_gb(g_memstats.threads_used));
+static void gtd_chunk_put(FTL *d, uint64_t ci, const uint64_t *bits)
+{
+#if defined(SMALL_GTD_ARRAY) && defined(GTD_HIERARCHICAL)
+    uint64_t *leaf = d->gtd_dir[ci];
+    if (leaf == g_gtd_zero_leaf)
+        leaf = gtd_leaf_alloc(d, ci);
+    for (uint32_t w = 0; w < CKPT_CHUNK_WORDS; w++)
+        leaf[w] |= bits[w];
+#else
+    uint64_t first = ci * CKPT_CHUNK_MPNS;
+    for (uint32_t w = 0; w < CKPT_CHUNK_WORDS; w++) {
+        for (uint64_t m = bits[w]; m; m &= m - 1) {
+            uint64_t mpn = first + w * 64u + (uint64_t)__builtin_ctzll(m);
+            if (mpn < d->total_mpns)
+                map_mark_allocated(d, mpn);
+        }
+    }
+#endif
+}
 
-    fprintf(stdout, "SSD Usage (from filesystem stat):\n");
-    fprintf(stdout, "  - map.ssd size:   %" PRIu64 " B (%.6f GB), blocks: %" PRIu64 " B (%.6f GB)\n",
-            g_ssdstats.map_st_size, to_gb(g_ssdstats.map_st_size),
-            g_ssdstats.map_st_blocks, to_gb(g_ssdstats.map_st_blocks));
+static bool ckpt_save(FTL *d, bool verbose)
+{
+    // 1. 脏页全部落盘，map.ssd 与内存状态一致后再记录
+    ftl_flush_all(d);
+    if (map_io_flush(&d->mio) != 0) {
+        perror("checkpoint: fdatasync map.ssd failed");
+        return false;
+    }
+    struct stat st;
+    if (fstat(d->fd_map, &st) != 0) {
+        perror("checkpoint: fstat map.ssd failed");
+        return false;
+    }
+
+    FILE *fp = fopen(d->ckpt_tmp_path, "wb");
+    if (!fp) {
+        perror(d->ckpt_tmp_path);
+        return false;
+    }
+    CkptHdr h;
+    memset(&h, 0, sizeof(h));
+    CkptWriter w = {fp, 0, 0xCBF29CE484222325ull, true};
+    if (fwrite(&h, 1, sizeof(h), fp) != sizeof(h))
+        w.ok = false;
+
+    // 2. GTD 非空块：块号 + 位图
+    uint64_t *bits = (uint64_t *)FTL_MALLOC_CTRL(&d->ms, CKPT_CHUNK_MPNS / 8u);
+    uint64_t n_chunks = (d->total_mpns + CKPT_CHUNK_MPNS - 1) / CKPT_CHUNK_MPNS;
+    for (uint64_t ci = 0; ci < n_chunks; ci++) {
+        if (!gtd_chunk_get(d, ci, bits))
+            continue;
+        ckpt_put(&w, &ci, sizeof(ci));
+        ckpt_put(&w, bits, CKPT_CHUNK_MPNS / 8u);
+        h.n_chunks++;
+    }
+    FTL_FREE_CTRL(&d->ms, bits, CKPT_CHUNK_MPNS / 8u);
+
+    // 3. 热页：TPC 中已分配的页，按 slot 顺序
+    for (uint32_t s = 0; s < d->tpc_slots; s++) {
+        uint64_t mpn = d->tpc_tags[s];
+        if (mpn == MPN_SENTINEL || !map_page_allocated(d, mpn))
+            continue;
+        ckpt_put(&w, &mpn, sizeof(mpn));
+        h.n_hot++;
+    }
+
+#ifdef MAP_LINEAR_ELISION
+    // 4. 线性页没有盘上副本，只能靠检查点恢复
+    for (uint64_t i = 0; i < d->lin_cap; i++) {
+        if (d->lin_tab[i].mpn == MPN_SENTINEL)
+            continue;
+        ckpt_put(&w, &d->lin_tab[i], sizeof(LinEntry));
+        h.n_lin++;
+    }
+#endif
+#ifdef MAP_DISK_COMPRESS
+    // 5. 压缩定位表和槽位分配器
+    for (uint64_t i = 0; i < d->mloc_cap; i++) {
+        if (d->mloc_tab[i].mpn == MPN_SENTINEL || !d->mloc_tab[i].len)
+            continue;
+        ckpt_put(&w, &d->mloc_tab[i], sizeof(MapLoc));
+        h.n_loc++;
+    }
+    ckpt_put(&w, &d->mloc_end, sizeof(d->mloc_end));
+    ckpt_put(&w, d->mloc_carve_off, sizeof(d->mloc_carve_off));
+    ckpt_put(&w, d->mloc_carve_left, sizeof(d->mloc_carve_left));
+    ckpt_put(&w, d->mloc_free_cnt, sizeof(d->mloc_free_cnt));
+    for (uint32_t c = 0; c < MLOC_CLASSES; c++)
+        ckpt_put(&w, d->mloc_free[c], (size_t)d->mloc_free_cnt[c] * sizeof(uint32_t));
+#endif
+
+    h.magic = CKPT_MAGIC;
+    h.version = CKPT_VERSION;
+    h.entry_bytes = ENTRY_BYTES;
+    h.layout = ckpt_layout();
+    h.tpc_slots = d->tpc_slots;
+    h.total_mpns = d->total_mpns;
+    h.map_size = (uint64_t)st.st_size;
+    h.payload_bytes = w.bytes;
+#ifdef MAP_DURABLE
+    h.wal_lsn = d->wal_lsn;
+#endif
+    h.sum = w.sum;
+    if (w.ok && (fseek(fp, 0, SEEK_SET) != 0 || fwrite(&h, 1, sizeof(h), fp) != sizeof(h)))
+        w.ok = false;
+    if (w.ok && (fflush(fp) != 0 || fsync(fileno(fp)) != 0))
+        w.ok = false;
+    fclose(fp);
+    if (!w.ok || rename(d->ckpt_tmp_path, d->ckpt_path) != 0) {
+        fprintf(stderr, "checkpoint: write %s failed: %s\n", d->ckpt_path, strerror(errno));
+        unlink(d->ckpt_tmp_path);
+        return false;
+    }
+#ifdef DEBUG_FTL
+    if (verbose)
+        fprintf(stdout, "Checkpoint: %" PRIu64 " GTD chunks, %" PRIu64 " hot pages, %" PRIu64 " linear pages, %" PRIu64 " located pages -> %s (%" PRIu64 " B)\n",
+                h.n_chunks, h.n_hot, h.n_lin, h.n_loc, d->ckpt_path, (uint64_t)sizeof(h) + h.payload_bytes);
+#else
+    (void)verbose;
+#endif
+    return true;
+}
+
+// 把热页装进 TPC：只放进组内空闲的 way，装不下的直接跳过(它只是提示)
+static void ckpt_warm_page(FTL *d, uint64_t mpn)
+{
+    if (mpn >= d->total_mpns || !map_page_allocated(d, mpn))
+        return;
+#ifdef MAP_LINEAR_ELISION
+    uint64_t lin_base;
+    if (lin_lookup(d, mpn, &lin_base))
+        return;
+#endif
+    uint32_t set_idx = tpc_get_set_idx(d, mpn);
+    const uint64_t *tags = &d->tpc_tags[set_idx * TPC_WAYS];
+    if (tpc_set_find(tags, mpn) >= 0)
+        return;
+    int way = tpc_set_find(tags, MPN_SENTINEL);
+    if (way < 0)
+        return;
+    uint32_t slot = set_idx * TPC_WAYS + (uint32_t)way;
+    map_read_page(d, mpn, tpc_slot_buf(d, slot));
+    d->tpc_tags[slot] = mpn;
+    d->tpc_flags[slot] = 0;
+    memstats_add(&d->ms, &d->ms.warm_page_cnt, 1);
+}
+
+// 校验并恢复检查点。头部和校验和在改动任何状态之前检查，失败时保持冷启动状态(map.ssd 的旧内容一律不用)；
+// 校验和通过后各段只会因写入方的缺陷而解析失败，此时已恢复的部分仍与 map.ssd 一致
+static const char *ckpt_load_parse(FTL *d, const uint8_t *buf, size_t size)
+{
+    CkptHdr h;
+    if (size < sizeof(h))
+        return "truncated header";
+    memcpy(&h, buf, sizeof(h));
+    if (h.magic != CKPT_MAGIC || h.version != CKPT_VERSION)
+        return "bad magic or version";
+    if (h.entry_bytes != ENTRY_BYTES || h.layout != ckpt_layout() || h.total_mpns != d->total_mpns)
+        return "built with a different map layout or capacity";
+    if (h.payload_bytes != size - sizeof(h) || ckpt_fnv(0xCBF29CE484222325ull, buf + sizeof(h), h.payload_bytes) != h.sum)
+        return "checksum mismatch";
+    struct stat st;
+#ifdef MAP_DURABLE
+    // 持久模式下检查点之后 map.ssd 仍会被写，改动由 WAL 重放覆盖，只要求文件没有变短
+    if (fstat(d->fd_map, &st) != 0 || (uint64_t)st.st_size < h.map_size)
+        return "map.ssd truncated since the checkpoint";
+#else
+    if (fstat(d->fd_map, &st) != 0 || (uint64_t)st.st_size != h.map_size)
+        return "map.ssd changed since the checkpoint";
+#endif
+
+    CkptReader r = {buf + sizeof(h), buf + size};
+    uint64_t *bits = (uint64_t *)FTL_MALLOC_CTRL(&d->ms, CKPT_CHUNK_MPNS / 8u);
+    uint64_t n_chunks = (d->total_mpns + CKPT_CHUNK_MPNS - 1) / CKPT_CHUNK_MPNS;
+    bool ok = true;
+    for (uint64_t i = 0; ok && i < h.n_chunks; i++) {
+        uint64_t ci;
+        ok = ckpt_get(&r, &ci, sizeof(ci)) && ckpt_get(&r, bits, CKPT_CHUNK_MPNS / 8u) && ci < n_chunks;
+        if (ok)
+            gtd_chunk_put(d, ci, bits);
+    }
+    FTL_FREE_CTRL(&d->ms, bits, CKPT_CHUNK_MPNS / 8u);
+    if (!ok)
+        return "corrupt GTD section";
+
+    // 热页要等线性页表和定位表恢复后才能读，先记下位置
+    const uint8_t *hot = r.p;
+    if ((uint64_t)(r.end - r.p) / sizeof(uint64_t) < h.n_hot)
+        return "corrupt hot page section";
+    r.p += h.n_hot * sizeof(uint64_t);
+
+#ifdef MAP_LINEAR_ELISION
+    for (uint64_t i = 0; i < h.n_lin; i++) {
+        LinEntry e;
+        if (!ckpt_get(&r, &e, sizeof(e)))
+            return "corrupt linear page section";
+        lin_insert(d, e.mpn, e.base);
+    }
+#endif
+#ifdef MAP_DISK_COMPRESS
+    uint64_t live_bytes = 0;
+    for (uint64_t i = 0; i < h.n_loc; i++) {
+        MapLoc e;
+        if (!ckpt_get(&r, &e, sizeof(e)))
+            return "corrupt locator section";
+        *mloc_get(d, e.mpn) = e;
+        live_bytes += (uint64_t)MLOC_UNIT << e.cls;
+    }
+    uint32_t free_cnt[MLOC_CLASSES];
+    if (!ckpt_get(&r, &d->mloc_end, sizeof(d->mloc_end)) ||
+        !ckpt_get(&r, d->mloc_carve_off, sizeof(d->mloc_carve_off)) ||
+        !ckpt_get(&r, d->mloc_carve_left, sizeof(d->mloc_carve_left)) ||
+        !ckpt_get(&r, free_cnt, sizeof(free_cnt)))
+        return "corrupt slot allocator section";
+#ifdef DEBUG_FTL
+    d->ss.map_slot_end = (uint64_t)d->mloc_end * MLOC_UNIT;
+#endif
+    for (uint32_t c = 0; c < MLOC_CLASSES; c++) {
+        for (uint32_t i = 0; i < free_cnt[c]; i++) {
+            uint32_t off;
+            if (!ckpt_get(&r, &off, sizeof(off)))
+                return "corrupt slot allocator section";
+            mloc_slot_free(d, c, off);
+        }
+    }
+#ifdef DEBUG_FTL
+    d->ss.map_slot_bytes = live_bytes; // mloc_slot_free 会扣减该值，恢复完空闲栈后重新赋值
+#endif
+#endif
+
+    d->ckpt_loaded = true;
+    d->ckpt_wal_lsn = h.wal_lsn;
+    for (uint64_t i = 0; i < h.n_hot; i++) {
+        uint64_t mpn;
+        memcpy(&mpn, hot + i * sizeof(uint64_t), sizeof(mpn));
+        ckpt_warm_page(d, mpn);
+    }
+#ifdef DEBUG_FTL
+    fprintf(stdout, "Warm restart: %" PRIu64 " GTD chunks, %" PRIu64 " linear pages, %" PRIu64 " located pages, %" PRIu64 " / %" PRIu64 " hot pages preloaded\n",
+            h.n_chunks, h.n_lin, h.n_loc, d->ms.warm_page_cnt, h.n_hot);
+#endif
+    return NULL;
+}
+
+static void ckpt_load(FTL *d)
+{
+    int fd = open(d->ckpt_path, O_RDONLY);
+    if (fd < 0)
+        return; // 没有检查点：冷启动
+    struct stat st;
+    const char *err = NULL;
+    if (fstat(fd, &st) != 0) {
+        err = "cannot stat";
+    } else {
+        size_t size = (size_t)st.st_size;
+        uint8_t *buf = (uint8_t *)FTL_MALLOC_CTRL(&d->ms, size ? size : 1u);
+        size_t n = 0;
+        while (n < size) {
+            ssize_t rr = read(fd, buf + n, size - n);
+            if (rr < 0 && errno == EINTR)
+                continue;
+            if (rr <= 0)
+                break;
+            n += (size_t)rr;
+        }
+        err = (n == size) ? ckpt_load_parse(d, buf, size) : "short read";
+        FTL_FREE_CTRL(&d->ms, buf, size ? size : 1u);
+    }
+    close(fd);
+#ifdef MAP_DURABLE
+    // 持久模式下检查点 + WAL 才是完整状态，成功时保留，由下一次检查点原子替换
+    if (err)
+        unlink(d->ckpt_path);
+#else
+    // 无论是否成功都删除：成功时运行中会改写 map.ssd，失败时它本身就不可用
+    unlink(d->ckpt_path);
+#endif
+    if (err)
+        fprintf(stderr, "Warm restart: ignoring %s (%s), cold start\n", d->ckpt_path, err);
+}
+#endif
+
+#ifdef MAP_DURABLE
+// ========== 持久模式：意图日志 + 成组提交 ==========
+// 每次修改先追加到内存中的 wal_buf，攒满一个窗口(或退出时)整组写入 map.wal 并 fdatasync 一次，
+// 之后这一组修改即为持久。map.ssd 的写回本身不 sync：WAL 超过 WAL_CKPT_BYTES 时做一次检查点
+// (刷全部脏页 + fdatasync map.ssd + 写 map.ssd.ckpt，记下已包含的 lsn)，然后截断 WAL。
+// 恢复 = 加载检查点 + 按序重放 lsn 不小于检查点 lsn 的各组；检查点 rename 后、截断前崩溃留下的旧组按 lsn 跳过
+
+static void ftl_trim(FTL *d, uint64_t lba, uint64_t end);
+
+static uint64_t wal_group_sum(const WalGroupHdr *h, const WalRec *recs)
+{
+    WalGroupHdr tmp = *h;
+    tmp.sum = 0;
+    uint64_t s = ckpt_fnv(0xCBF29CE484222325ull, &tmp, sizeof(tmp));
+    return ckpt_fnv(s, recs, (size_t)h->n * sizeof(WalRec));
+}
+
+static void durable_checkpoint(FTL *d)
+{
+    uint64_t t0 = ftl_now_ns();
+    if (!ckpt_save(d, false))
+        return; // 检查点失败时保留 WAL，恢复仍可从上一个检查点开始
+    if (ftruncate(d->fd_wal, 0) != 0 || fdatasync(d->fd_wal) != 0) {
+        fprintf(stderr, "durable: truncate %s failed: %s\n", d->wal_path, strerror(errno));
+        exit(1);
+    }
+    d->wal_off = 0;
+    memstats_add(&d->ms, &d->ms.durable_ckpt_cnt, 1);
+    memstats_add(&d->ms, &d->ms.durable_ckpt_ns, ftl_now_ns() - t0);
+}
+
+// 把当前窗口内的修改作为一组写入 WAL 并 fdatasync
+static void wal_commit(FTL *d)
+{
+    if (d->wal_n == 0)
+        return;
+    uint64_t t0 = ftl_now_ns();
+    WalGroupHdr h;
+    memset(&h, 0, sizeof(h));
+    h.magic = WAL_MAGIC;
+    h.lsn_first = d->wal_lsn - d->wal_n;
+    h.n = d->wal_n;
+    h.sum = wal_group_sum(&h, d->wal_buf);
+    struct iovec iov[2] = {
+        {&h, sizeof(h)},
+        {d->wal_buf, (size_t)d->wal_n * sizeof(WalRec)},
+    };
+    size_t len = iov[0].iov_len + iov[1].iov_len;
+    if (pwritev(d->fd_wal, iov, 2, (off_t)d->wal_off) != (ssize_t)len || fdatasync(d->fd_wal) != 0) {
+        fprintf(stderr, "durable: write %s failed: %s\n", d->wal_path, strerror(errno));
+        exit(1);
+    }
+    d->wal_off += len;
+    d->wal_n = 0;
+    memstats_add(&d->ms, &d->ms.wal_group_cnt, 1);
+    memstats_add(&d->ms, &d->ms.wal_bytes, len);
+    memstats_add(&d->ms, &d->ms.wal_sync_ns, ftl_now_ns() - t0);
+    if (d->wal_off >= WAL_CKPT_BYTES)
+        durable_checkpoint(d);
+}
+
+static inline void wal_append(FTL *d, uint64_t lba, uint64_t ppn)
+{
+    d->wal_buf[d->wal_n].lba = lba;
+    d->wal_buf[d->wal_n].ppn = ppn;
+    d->wal_n++;
+    d->wal_lsn++;
+    memstats_add(&d->ms, &d->ms.wal_rec_cnt, 1);
+    if (unlikely(d->wal_n == d->wal_window))
+        wal_commit(d);
+}
+
+// 启动时重放 WAL：逐组校验，遇到不完整或校验失败的组即停止(崩溃时未提交完的尾部)，并截掉它
+static void wal_replay(FTL *d)
+{
+    uint64_t off = 0;
+    uint64_t expect = d->ckpt_wal_lsn;
+    bool first = true;
+    WalRec *recs = NULL;
+    uint32_t cap = 0;
+    for (;;) {
+        WalGroupHdr h;
+        if (pread(d->fd_wal, &h, sizeof(h), (off_t)off) != (ssize_t)sizeof(h))
+            break;
+        if (h.magic != WAL_MAGIC || h.n == 0 || h.n > WAL_MAX_WINDOW)
+            break;
+        if (h.n > cap) {
+            if (recs)
+                FTL_FREE_CTRL(&d->ms, recs, (size_t)cap * sizeof(WalRec));
+            cap = h.n;
+            recs = (WalRec *)FTL_MALLOC_CTRL(&d->ms, (size_t)cap * sizeof(WalRec));
+        }
+        size_t len = (size_t)h.n * sizeof(WalRec);
+        if (pread(d->fd_wal, recs, len, (off_t)(off + sizeof(h))) != (ssize_t)len || wal_group_sum(&h, recs) != h.sum)
+            break;
+        if (first && h.lsn_first > expect) {
+            // WAL 起点晚于检查点：中间的修改已丢失(检查点缺失或损坏)，只能冷启动
+            fprintf(stderr, "Durable: %s starts at lsn %" PRIu64 " but the checkpoint covers only %" PRIu64 ", discarding the log\n",
+                    d->wal_path, h.lsn_first, expect);
+            break;
+        }
+        if (!first && h.lsn_first != expect)
+            break;
+        for (uint32_t i = 0; i < h.n; i++) {
+            if (h.lsn_first + i >= expect) {
+                if (recs[i].ppn & WAL_TRIM)
+                    ftl_trim(d, recs[i].lba, recs[i].lba + (recs[i].ppn & ~WAL_TRIM));
+                else
+                    ftl_apply_modify(d, recs[i].lba, recs[i].ppn);
+                memstats_add(&d->ms, &d->ms.wal_replay_cnt, 1);
+            }
+        }
+        if (h.lsn_first + h.n > expect)
+            expect = h.lsn_first + h.n;
+        first = false;
+        off += sizeof(h) + len;
+    }
+    if (recs)
+        FTL_FREE_CTRL(&d->ms, recs, (size_t)cap * sizeof(WalRec));
+    if (first)
+        off = 0;
+    if (ftruncate(d->fd_wal, (off_t)off) != 0) {
+        fprintf(stderr, "durable: truncate %s failed: %s\n", d->wal_path, strerror(errno));
+        exit(1);
+    }
+    d->wal_off = off;
+    d->wal_lsn = expect;
+#ifdef DEBUG_FTL
+    if (d->ms.wal_replay_cnt)
+        fprintf(stdout, "Durable: replayed %" PRIu64 " modifications from %s (lsn %" PRIu64 " .. %" PRIu64 ")\n",
+                d->ms.wal_replay_cnt, d->wal_path, d->ckpt_wal_lsn, expect);
+#endif
+}
+#endif
+
+// ========== FTL 接口：Init / Destroy / Read / Modify ==========
+
+FTLHandle *FTLHandleOpen(const FTLConfig *cfg)
+{
+#ifdef DEBUG_FTL
+    uint64_t minflt_start = 0, majflt_start = 0;
+    memstats_sample_faults(&minflt_start, &majflt_start);
+#endif
+    // 控制块按 cache line 对齐：不同实例(通常在不同线程上)不会落在同一 cache line 上
+    FTL *d = NULL;
+    if (posix_memalign((void **)&d, 64, sizeof(FTL)) != 0) {
+        perror("posix_memalign FTL failed");
+        exit(1);
+    }
+    memset(d, 0, sizeof(FTL));
+    memstats_add(&d->ms, &d->ms.ctrl_used, sizeof(FTL));
+    if (cfg)
+        d->cfg = *cfg;
+    else
+        FTLConfigDefault(&d->cfg);
+    ftl_config_normalize(&d->cfg);
+    ftl_budget_plan(d);
+    d->map_path = ftl_path_derive(d, d->cfg.map_path, NULL, "");
+    d->wal_path = ftl_path_derive(d, d->map_path, ".ssd", ".wal");
+    d->ckpt_path = ftl_path_derive(d, d->map_path, NULL, ".ckpt");
+    d->ckpt_tmp_path = ftl_path_derive(d, d->ckpt_path, NULL, ".tmp");
+    d->cfg.map_path = d->map_path;
+
+    const uint64_t entries_per_page = (uint64_t)EPP;
+    uint64_t total_lpns = d->cfg.lba_count;
+    uint64_t total_mpns = (total_lpns + entries_per_page - 1ull) / entries_per_page;
+    d->total_lpns = total_lpns;
+    d->total_mpns = total_mpns;
+
+#if defined(SMALL_GTD_ARRAY) && defined(GTD_HIERARCHICAL)
+    d->gtd_n_leaves = GTD_LEAVES(d->total_mpns);
+    d->gtd_dir = (uint64_t **)FTL_MALLOC_GTD_DIR(&d->ms, d->gtd_n_leaves);
+    d->gtd_summary = (uint64_t *)FTL_MALLOC_GTD_SUMMARY(&d->ms, d->gtd_n_leaves);
+    if (unlikely(!d->gtd_dir || !d->gtd_summary)) { perror("malloc gtd failed"); exit(1); }
+    for (uint64_t i = 0; i < d->gtd_n_leaves; i++)
+        d->gtd_dir[i] = g_gtd_zero_leaf;
+    d->gtd_leaves_used = 0;
+#elif defined(SMALL_GTD_ARRAY)
+    d->gtd = (uint8_t *)FTL_MALLOC_GTD(&d->ms, d->total_mpns);
+#else
+    d->gtd = (uint64_t *)FTL_MALLOC_GTD(&d->ms, d->total_mpns);
+#endif
+
+#ifdef USE_CMT
+    ec_init(&d->cmt, CMT_ENTRIES, MEM_CLASS_ENTRIES, &d->ms);
+    d->cmt_dirty_cnt = (uint32_t *)FTLCallocEx(&d->ms, CMT_DIRTY_BUCKETS, sizeof(uint32_t), MEM_CLASS_ENTRIES);
+#endif
+
+#ifndef DISABLE_TPC
+    // 原 tpc_init(g->tpc, TPC_MAX_PAGES); 已不用
+    // --- 新增：TPC 预分配 page_pool_base，slot i 固定使用第 i 页 ---
+#if defined(HUGEPAGE_BACKING)
+    // 大页映射天然按 2MB 对齐，同样满足 ZERO_COPY_DMA 的 4096 对齐要求
+    d->page_pool_base = (uint8_t *)FTLMapHugeEx(&d->ms, (size_t)d->tpc_slots * MAP_PAGE_BYTES, true,
+                                                MEM_CLASS_TPC_PAGE);
+#elif !defined(ZERO_COPY_DMA)
+    size_t total_pages = (size_t)d->tpc_slots;
+    d->page_pool_base = (uint8_t *)FTL_MALLOC_TPC_PAGE(&d->ms, total_pages);
+#else
+    size_t total_bytes = (size_t)d->tpc_slots * MAP_PAGE_BYTES;
+    // 使用 posix_memalign 替代 malloc，强制 4096 字节对齐
+    if (posix_memalign((void **)&d->page_pool_base, 4096, total_bytes) != 0) {
+        perror("posix_memalign failed");
+        exit(1);
+    }
+    memset(d->page_pool_base, 0, total_bytes);
+    
+    memstats_add(&d->ms, &d->ms.tpc_page_used, total_bytes);
+#endif
+    if (unlikely(!d->page_pool_base)) { perror("malloc pool failed"); exit(1); }
+    mem_track(d->page_pool_base, (size_t)d->tpc_slots * MAP_PAGE_BYTES, FTL_MEM_TPC_PAGES);
+    // 这里将 page_pool_base 记入 tpc_page_used
+    // FTL_MALLOC_TPC_PAGE 内已经统计 tpc_page_used，无需重复计数
+
+    d->tpc_tags = (uint64_t *)FTL_MALLOC_TPC_TAGS(&d->ms, d->tpc_slots);
+    d->tpc_flags = (uint8_t *)FTLCallocEx(&d->ms, d->tpc_slots, 1u, MEM_CLASS_TPC);
+    d->tpc_next_victim = (uint8_t *)FTLCallocEx(&d->ms, d->tpc_set_mask + 1u, 1u, MEM_CLASS_TPC);
+    if (unlikely(!d->tpc_tags || !d->tpc_flags || !d->tpc_next_victim)) { perror("malloc tpc failed"); exit(1); }
+    for (uint32_t i = 0; i < d->tpc_slots; i++)
+        d->tpc_tags[i] = MPN_SENTINEL;
+#ifdef TPC_ENTRY_RETAIN
+    d->tpc_acc = (uint64_t *)FTLCallocEx(&d->ms, (size_t)d->tpc_slots * TPC_ACC_WORDS, sizeof(uint64_t), MEM_CLASS_TPC);
+    ec_init(&d->retain, RETAIN_ENTRIES, MEM_CLASS_TPC, &d->ms);
+#endif
+#ifdef MAP_LINEAR_ELISION
+    lin_alloc_table(d, LIN_INIT_CAP);
+    d->lin_cnt = 0;
+#endif
+#ifdef MAP_DISK_COMPRESS
+    // 定位表只在内存中，上次运行留在 map.ssd 里的内容一律视为无效，槽位从文件头开始分配
+    mloc_alloc_table(d, MLOC_INIT_CAP);
+    d->mloc_cnt = 0;
+    for (uint32_t c = 0; c < MLOC_CLASSES; c++) {
+        d->mloc_free[c] = NULL;
+        d->mloc_free_cnt[c] = 0;
+        d->mloc_free_cap[c] = 0;
+        d->mloc_carve_left[c] = 0;
+    }
+    d->mloc_end = 0;
+    d->mloc_buf = (uint8_t *)FTL_MALLOC_CTRL(&d->ms, MAP_PAGE_BYTES + sizeof(MpageHdr) + 8u);
+#endif
+#ifdef MAP_LOG_STRUCTURED
+    // GTD 只在内存中，上次运行留在 map.ssd 里的内容一律视为无效，日志从文件头开始
+    d->log_seg_cap = 0;
+    log_grow_segs(d, LOG_INIT_SEGS);
+    d->log_free_cnt = 0;
+    d->log_nsegs = 0;
+    d->log_valid = 0;
+    d->log_active = LOG_SEG_NONE;
+    d->log_active_off = 0;
+    d->log_gc_seg = LOG_SEG_NONE;
+    d->log_gc_off = 0;
+    d->log_buf = (uint8_t *)FTLAllocAlignedEx(&d->ms, MAP_PAGE_BYTES, MAP_IO_ALIGN, MEM_CLASS_CTRL);
+#endif
+#ifdef TPC_MICRO_TLB
+    for (int i = 0; i < UTLB_ENTRIES; i++)
+        d->utlb_mpn[i] = MPN_SENTINEL;
+    d->utlb_next = 0;
+#endif
+#endif
+
+#ifdef TPC_MISS_CLASSIFY
+    d->shadow.cap = d->tpc_slots;
+    d->shadow.hash_mask = d->tpc_slots * 4u - 1u;
+    d->shadow.mpn = (uint64_t *)FTL_MALLOC_CTRL(&d->ms, (size_t)d->shadow.cap * sizeof(uint64_t));
+    d->shadow.prev = (uint32_t *)FTL_MALLOC_CTRL(&d->ms, (size_t)d->shadow.cap * sizeof(uint32_t));
+    d->shadow.next = (uint32_t *)FTL_MALLOC_CTRL(&d->ms, (size_t)d->shadow.cap * sizeof(uint32_t));
+    d->shadow.hash = (int32_t *)FTL_MALLOC_CTRL(&d->ms, (size_t)d->shadow.cap * 4u * sizeof(int32_t));
+    memset(d->shadow.hash, 0xff, (size_t)d->shadow.cap * 4u * sizeof(int32_t));
+    d->shadow.used = 0;
+    d->shadow.head = SHADOW_NIL;
+    d->shadow.tail = SHADOW_NIL;
+#endif
+
+#ifdef TPC_ZCACHE
+    d->zc_arena = (uint8_t *)FTL_MALLOC_ZCACHE(&d->ms, d->zc_arena_bytes);
+    d->zc_ent = (ZcEntry *)FTL_MALLOC_ZCACHE(&d->ms, (size_t)d->zc_max_pages * sizeof(ZcEntry));
+    d->zc_hash = (int32_t *)FTL_MALLOC_ZCACHE(&d->ms, ((size_t)d->zc_hash_mask + 1u) * sizeof(int32_t));
+    d->zc_enc = (uint8_t *)FTL_MALLOC_ZCACHE(&d->ms, MAP_PAGE_BYTES + sizeof(MpageHdr) + 8u);
+    d->zc_page = (uint8_t *)FTLAllocAlignedEx(&d->ms, MAP_PAGE_BYTES, MAP_IO_ALIGN, MEM_CLASS_ZCACHE);
+    memset(d->zc_hash, 0xff, ((size_t)d->zc_hash_mask + 1u) * sizeof(int32_t));
+    d->zc_arena_head = 0;
+    d->zc_q_first = 0;
+    d->zc_q_count = 0;
+    d->zc_valid_cnt = 0;
+#endif
+
+    d->fd_map = open_file(d->map_path, true);
+    if (unlikely(d->fd_map < 0)) { perror("open map.ssd failed"); exit(1); }
+#ifdef MAP_WARM_RESTART
+    if (d->cfg.map_backend == FTL_MAP_BACKEND_MEM) {
+        fprintf(stderr, "FTLInit: memory map backend cannot persist a checkpoint, using pread\n");
+        d->cfg.map_backend = FTL_MAP_BACKEND_PREAD;
+    }
+#endif
+    map_io_open(&d->mio, d->fd_map, d->cfg.map_backend, &d->ms, &d->ss, &d->nand);
+#ifdef MAP_MMAP
+    // 上次运行留在 map.ssd 里的内容一律视为无效：清空后按需扩展，新分配的页天然为全0
+    if (ftruncate(d->fd_map, 0) != 0) { perror("mmap: ftruncate map.ssd failed"); exit(1); }
+    d->mm_base = NULL;
+    d->mm_len = 0;
+    d->mm_last_mpn = MPN_SENTINEL;
+    mm_grow(d, MMAP_INIT_BYTES);
+#endif
+    if (d->cfg.nand_sim)
+        nand_sim_init(&d->nand, &d->cfg.nand, &d->ms);
+
+#ifdef LAST_HIT_OPTIMIZE
+    d->last_mpn = MPN_SENTINEL; 
+    d->last_slot = UINT32_MAX;
+    d->last_buf = NULL;
+#endif
+
+    #ifndef NO_PIPELINE
+    memset(&d->pl, 0, sizeof(d->pl));
+
+    // 初始化队列与 batch pool
+    int total_batches = (int)d->batch_cnt;
+#ifdef HUGEPAGE_BACKING
+    d->pl.batch_pool = (TaskBatch *)FTLMapHugeEx(&d->ms, (size_t)total_batches * sizeof(TaskBatch), true,
+                                                MEM_CLASS_PIPELINE);
+    for (int i = 0; i < total_batches; i++) {
+        d->pl.free_batches[i] = &d->pl.batch_pool[i];
+    }
+    mem_track(d->pl.batch_pool, (size_t)total_batches * sizeof(TaskBatch), FTL_MEM_PIPELINE);
+#else
+    for (int i = 0; i < total_batches; i++) {
+        d->pl.free_batches[i] = (TaskBatch *)FTL_MALLOC_PIPELINE(&d->ms, sizeof(TaskBatch));
+        mem_track(d->pl.free_batches[i], sizeof(TaskBatch), FTL_MEM_PIPELINE);
+    }
+#endif
+    d->pl.free_count = total_batches;
+    d->pl.head = 0;
+    d->pl.tail = 0;
+    d->pl.finished = 0;
+    pthread_mutex_init(&d->pl.mutex, NULL);
+    pthread_cond_init(&d->pl.not_empty, NULL);
+    pthread_cond_init(&d->pl.not_full, NULL);
+    pthread_cond_init(&d->pl.cq_ready, NULL);
+    #endif
+
+    // 可选优化：提示内核随机访问
+#if defined(POSIX_FADV_RANDOM)
+    posix_fadvise(d->fd_map, 0, 0, POSIX_FADV_RANDOM);
+#endif
+#ifdef TPC_PREFETCH
+    // 初始为随机访问提示，识别到流后由 pf_set_fadvise 切换
+    d->pf_fadv = POSIX_FADV_RANDOM;
+    for (int i = 0; i < PF_STREAMS; i++) {
+        d->pf_streams[i].last_mpn = MPN_SENTINEL;
+        d->pf_streams[i].stride = 0;
+        d->pf_streams[i].conf = 0;
+        d->pf_streams[i].lru = 0;
+    }
+#endif
+#ifdef MAP_WARM_RESTART
+    ckpt_load(d);
+#endif
+#ifdef MAP_DURABLE
+    d->wal_window = d->cfg.durable_window ? d->cfg.durable_window : WAL_DEFAULT_WINDOW;
+    if (d->wal_window > WAL_MAX_WINDOW)
+        d->wal_window = WAL_MAX_WINDOW;
+    d->wal_buf = (WalRec *)FTL_MALLOC_CTRL(&d->ms, (size_t)d->wal_window * sizeof(WalRec));
+    d->wal_n = 0;
+    d->fd_wal = open_file(d->wal_path, true);
+    wal_replay(d);
+#endif
+#ifdef DEBUG_FTL
+    // 之后的缺页都发生在计时阶段
+    memstats_sample_faults(&d->ms.minflt_base, &d->ms.majflt_base);
+    d->ms.minflt_init = d->ms.minflt_base - minflt_start;
+#endif
+    return d;
+}
+
+static void ftl_async_stop(FTL *d);
+
+// fast 为 true 时只做检查点，不刷脏页也不释放：仅供进程退出前的 FTLDestroy 使用
+static void ftl_close(FTL *d, bool fast)
+{
+    if (!d)
+        return;
+    ftl_async_stop(d); // 先做完已提交的异步请求，之后的检查点才包含它们
+#ifdef MAP_DURABLE
+    // 提交最后一组修改，再做检查点并截断 WAL
+    wal_commit(d);
+    durable_checkpoint(d);
+    close(d->fd_wal);
+    d->fd_wal = -1;
+#elif defined(MAP_WARM_RESTART)
+    // 检查点在 fast 时也要做：其中会先刷脏页
+    ckpt_save(d, true);
+#endif
+    if (fast)
+        return;
+
+    // === 刷新所有脏页到文件 ===
+    ftl_flush_all(d);
+
+    map_io_close(&d->mio);
+#ifdef MAP_MMAP
+    munmap(d->mm_base, d->mm_len); // MAP_SHARED 的脏页由内核写回，不会丢失
+    d->mm_base = NULL;
+#endif
+    if (d->fd_map >= 0) {
+        close(d->fd_map);
+        d->fd_map = -1;
+    }
+    nand_sim_free(&d->nand, &d->ms);
+#ifdef USE_CMT
+    ec_destroy(&d->cmt);
+    FTLFreeEx(&d->ms, d->cmt_dirty_cnt, CMT_DIRTY_BUCKETS * sizeof(uint32_t), MEM_CLASS_ENTRIES);
+    d->cmt_dirty_cnt = NULL;
+#endif
+#if defined(SMALL_GTD_ARRAY) && defined(GTD_HIERARCHICAL)
+    for (uint64_t i = 0; i < d->gtd_n_leaves; i++) {
+        if (d->gtd_dir[i] != g_gtd_zero_leaf)
+            FTL_FREE_GTD_LEAF(&d->ms, d->gtd_dir[i]);
+    }
+    FTL_FREE_GTD_DIR(&d->ms, d->gtd_dir, d->gtd_n_leaves);
+    FTL_FREE_GTD_SUMMARY(&d->ms, d->gtd_summary, d->gtd_n_leaves);
+    d->gtd_dir = NULL;
+    d->gtd_summary = NULL;
+#else
+    FTL_FREE_GTD(&d->ms, d->gtd, d->total_mpns);
+    d->gtd = NULL;
+#endif
+    if (d->page_pool_base) {
+        size_t total_pages = (size_t)d->tpc_slots;
+        mem_untrack(d->page_pool_base);
+#ifdef HUGEPAGE_BACKING
+        FTLUnmapHugeEx(&d->ms, d->page_pool_base, total_pages * MAP_PAGE_BYTES, MEM_CLASS_TPC_PAGE);
+#else
+        FTLFreeEx(&d->ms, d->page_pool_base, total_pages * MAP_PAGE_BYTES, MEM_CLASS_TPC_PAGE);
+#endif
+        d->page_pool_base = NULL;
+    }
+    if (d->tpc_tags) {
+        FTL_FREE_TPC_TAGS(&d->ms, d->tpc_tags, d->tpc_slots);
+        FTLFreeEx(&d->ms, d->tpc_flags, d->tpc_slots, MEM_CLASS_TPC);
+        FTLFreeEx(&d->ms, d->tpc_next_victim, d->tpc_set_mask + 1u, MEM_CLASS_TPC);
+        d->tpc_tags = NULL;
+        d->tpc_flags = NULL;
+        d->tpc_next_victim = NULL;
+    }
+#ifdef TPC_ENTRY_RETAIN
+    FTLFreeEx(&d->ms, d->tpc_acc, (size_t)d->tpc_slots * TPC_ACC_WORDS * sizeof(uint64_t), MEM_CLASS_TPC);
+    d->tpc_acc = NULL;
+    ec_destroy(&d->retain);
+#endif
+#ifdef TPC_MISS_CLASSIFY
+    FTL_FREE_CTRL(&d->ms, d->shadow.mpn, (size_t)d->shadow.cap * sizeof(uint64_t));
+    FTL_FREE_CTRL(&d->ms, d->shadow.prev, (size_t)d->shadow.cap * sizeof(uint32_t));
+    FTL_FREE_CTRL(&d->ms, d->shadow.next, (size_t)d->shadow.cap * sizeof(uint32_t));
+    FTL_FREE_CTRL(&d->ms, d->shadow.hash, (size_t)d->shadow.cap * 4u * sizeof(int32_t));
+#endif
+#ifdef MAP_LINEAR_ELISION
+    FTL_FREE_LIN(&d->ms, d->lin_tab, d->lin_cap);
+    d->lin_tab = NULL;
+#endif
+#ifdef MAP_DISK_COMPRESS
+    FTL_FREE_MLOC(&d->ms, d->mloc_tab, d->mloc_cap);
+    d->mloc_tab = NULL;
+    for (uint32_t c = 0; c < MLOC_CLASSES; c++)
+        FTL_FREE_MLOC_FREE(&d->ms, d->mloc_free[c], d->mloc_free_cap[c]);
+    FTL_FREE_CTRL(&d->ms, d->mloc_buf, MAP_PAGE_BYTES + sizeof(MpageHdr) + 8u);
+#endif
+#ifdef MAP_LOG_STRUCTURED
+    FTL_FREE_LOG_SEGS(&d->ms, d->log_seg_valid, d->log_seg_cap);
+    FTL_FREE_LOG_OWNER(&d->ms, d->log_owner, d->log_seg_cap);
+    FTL_FREE_CTRL(&d->ms, d->log_buf, MAP_PAGE_BYTES);
+    d->log_owner = NULL;
+    d->log_seg_valid = NULL;
+#endif
+#ifdef TPC_ZCACHE
+    FTL_FREE_ZCACHE(&d->ms, d->zc_arena, d->zc_arena_bytes);
+    FTL_FREE_ZCACHE(&d->ms, d->zc_ent, (size_t)d->zc_max_pages * sizeof(ZcEntry));
+    FTL_FREE_ZCACHE(&d->ms, d->zc_hash, ((size_t)d->zc_hash_mask + 1u) * sizeof(int32_t));
+    FTL_FREE_ZCACHE(&d->ms, d->zc_enc, MAP_PAGE_BYTES + sizeof(MpageHdr) + 8u);
+    FTL_FREE_ZCACHE(&d->ms, d->zc_page, MAP_PAGE_BYTES);
+#endif
+#ifndef NO_PIPELINE
+#ifdef HUGEPAGE_BACKING
+    mem_untrack(d->pl.batch_pool);
+    FTLUnmapHugeEx(&d->ms, d->pl.batch_pool, (size_t)d->batch_cnt * sizeof(TaskBatch), MEM_CLASS_PIPELINE);
+#else
+    for (int i = 0; i < d->pl.free_count; i++) {
+        mem_untrack(d->pl.free_batches[i]);
+        FTL_FREE_PIPELINE(&d->ms, d->pl.free_batches[i], sizeof(TaskBatch));
+    }
+#endif
+    pthread_mutex_destroy(&d->pl.mutex);
+    pthread_cond_destroy(&d->pl.not_empty);
+    pthread_cond_destroy(&d->pl.not_full);
+    pthread_cond_destroy(&d->pl.cq_ready);
+#endif
+    if (d->pl.cq) {
+        mem_untrack(d->pl.cq);
+        FTL_FREE_PIPELINE(&d->ms, d->pl.cq, (size_t)FTL_ASYNC_DEPTH * sizeof(FTLCqe));
+    }
+    ftl_path_free(d, d->map_path);
+    ftl_path_free(d, d->wal_path);
+    ftl_path_free(d, d->ckpt_path);
+    ftl_path_free(d, d->ckpt_tmp_path);
+    free(d); // 统计就在控制块里，不再更新
+}
 
-    fprintf(stdout, "SSD Logical write accounting (program-side):\n");
-    fprintf(stdout, "  - map pages written:     %" PRIu64 " B (%.6f GB)\n",
-            g_ssdstats.map_pages_written_bytes, to_gb(g_ssdstats.map_pages_written_bytes));
-    fprintf(stdout, "  - map pages written cnt:     %" PRIu64 " \n", g_ssdstats.map_pages_written_cnt);
-    fprintf(stdout, "  - map pages read cnt:     %" PRIu64 " \n", g_ssdstats.map_pages_read_cnt);
-    fprintf(stdout, "  - map max end offset:    %" PRIu64 " B (%.6f GB)\n",
-            g_ssdstats.map_max_off, to_gb(g_ssdstats.map_max_off));
+void FTLHandleClose(FTLHandle *d)
+{
+    ftl_close(d, false);
+}
+
+uint64_t FTLHandleRead(FTLHandle *d, uint64_t lba)
+{
+    if (unlikely(lba >= d->total_lpns))
+        return UNMAPPED_PPA; // 超出配置容量的 LBA 视为未映射
+#ifdef USE_CMT
+    return cmt_read(d, lba);
 #else
-    fprintf(stdout, "Resource report is disabled. Compile with DEBUG_FTL to enable it.\n");
+    uint64_t ppn = read_ppn_from_map_with_gtd(d, lba);
+    return ppn;
 #endif
-#ifdef TIME_TEST
-    fprintf(stdout, "\nTime Statistics:\n");
-    fprintf(stdout, "  - total_io_parse time:    %.6f seconds\n", total_io_parse);
-    fprintf(stdout, "  - total_consumer_wait time:   %.6f seconds\n", total_consumer_wait);
+}
+
+bool FTLHandleModify(FTLHandle *d, uint64_t lba, uint64_t ppn)
+{
+    if (unlikely(lba >= d->total_lpns))
+        return false;
+    ftl_apply_modify(d, lba, ppn);
+#ifdef MAP_DURABLE
+    wal_append(d, lba, ppn);
 #endif
-    fprintf(stdout, "=====================================================\n");
+    return true;
 }
 
-// ========== FTL 接口：Init / Destroy / Read / Modify ==========
+// ========== 批量与区间接口 ==========
+// 落在同一映射页上的一段请求只做一次 TPC 查找(缺失时一次 GTD 检查和一次装入)，条目成段拷贝。
+// 批量接口把输入中相邻且属于同一页的请求合成一段；区间接口按页切段，覆盖整页的写不读旧页。
+// 开启 CMT 或没有 TPC 时逐条走单条接口
 
-void FTLInit(uint64_t len)
+#if !defined(USE_CMT) && !defined(DISABLE_TPC)
+// 为读取 mpn 上的一段条目取得该页：返回 TPC 中的页；线性页返回 NULL 并置 *linear；否则(未分配)返回 NULL，条目全为 0
+static const uint8_t *ftl_read_page(FTL *d, uint64_t mpn, bool *linear, uint64_t *lin_base)
 {
-    if (g)
-        return;
-    g = (FTL *)FTL_MALLOC_CTRL(sizeof(FTL));
-    memset(g, 0, sizeof(FTL));
+    *linear = false;
+    uint8_t *buf = tpc_lookup(d, mpn, 0);
+    if (likely(buf != NULL))
+        return buf;
+#ifdef MAP_LINEAR_ELISION
+    if (lin_lookup(d, mpn, lin_base)) {
+        memstats_add(&d->ms, &d->ms.lin_read_cnt, 1);
+        *linear = true;
+        return NULL;
+    }
+#else
+    (void)lin_base;
+#endif
+    // TPC 中没有的页，GTD 未标记就一定是全0页(写缺失时标记，进压缩缓存和线性页表前也会补标)
+    if (!map_page_allocated(d, mpn))
+        return NULL;
+    return tpc_fill(d, mpn, 0);
+}
 
-    const uint64_t entries_per_page = (uint64_t)EPP;
-    uint64_t total_lpns = LBA_MAX_PLUS1;
-    uint64_t total_mpns = (total_lpns + entries_per_page - 1ull) / entries_per_page;
-    g->total_lpns = total_lpns;
-    g->total_mpns = total_mpns;
+static inline uint64_t ftl_out_ppn(uint64_t v)
+{
+#ifndef FAST_CONSTANTS
+    if (v == 0) return UNMAPPED_PPA;
+#endif
+    return v;
+}
 
-#ifdef SMALL_GTD_ARRAY
-    g->gtd = (uint8_t *)FTL_MALLOC_GTD(g->total_mpns);
+// 读同一页上 [off, off + n) 的条目
+static void ftl_read_run(FTL *d, uint64_t mpn, uint32_t off, uint32_t n, uint64_t *out)
+{
+    bool linear;
+    uint64_t lin_base;
+    const uint8_t *buf = ftl_read_page(d, mpn, &linear, &lin_base);
+    if (!buf) {
+        for (uint32_t i = 0; i < n; i++)
+            out[i] = ftl_out_ppn(linear ? lin_base + off + i : 0);
+        return;
+    }
+#if ENTRY_BYTES == 8u
+    memcpy(out, (const uint64_t *)buf + off, (size_t)n * sizeof(uint64_t));
+#ifndef FAST_CONSTANTS
+    for (uint32_t i = 0; i < n; i++)
+        out[i] = ftl_out_ppn(out[i]);
+#endif
 #else
-    g->gtd = (uint64_t *)FTL_MALLOC_GTD(g->total_mpns);
+    for (uint32_t i = 0; i < n; i++)
+        out[i] = ftl_out_ppn(entry_load_u64(buf, off + i));
 #endif
+#ifdef TPC_ENTRY_RETAIN
+    for (uint32_t i = 0; i < n; i++)
+        tpc_touch_entry(d, buf, off + i);
+#endif
+}
 
-#ifdef USE_CMT
-    g->tt_entries = MCACHE_PAGES;
-    g->cmt_entries = (cmt_entry *)FTL_MALLOC_ENTRIES(g->tt_entries);
-    g->free_cmt_entry_cnt = 0;
-    g->used_cmt_entry_cnt = 0;
-    QTAILQ_INIT(&g->free_cmt_entry_list);
-    QTAILQ_INIT(&g->cmt_entry_list);
-
-    struct cmt_entry *cmt_entry;
-    for (int i = 0; i < MCACHE_PAGES; i++) {
-        cmt_entry = &g->cmt_entries[i];
-        cmt_entry->dirty = CLEAN;
-        cmt_entry->lpn = INVALID_LPN;
-        cmt_entry->ppn = UNMAPPED_PPA;
-        cmt_entry->hnext = NULL;
-        QTAILQ_INSERT_TAIL(&g->free_cmt_entry_list, cmt_entry, entry);
-        g->free_cmt_entry_cnt++;
-    }
-    if(g->free_cmt_entry_cnt != g->tt_entries){
-        perror("FTLInit: free_cmt_entry_cnt != tt_entries");
-        exit(EXIT_FAILURE);
+// 写同一页上 [off, off + n) 的条目为 ppn_base + i
+static void ftl_modify_run(FTL *d, uint64_t mpn, uint32_t off, uint32_t n, uint64_t ppn_base)
+{
+#ifdef TPC_ENTRY_RETAIN
+    if (d->retain.cnt)
+        for (uint32_t i = 0; i < n; i++)
+            retain_update(d, mpn * (uint64_t)EPP + off + i, ppn_base + i);
+#endif
+    uint8_t *buf = tpc_lookup(d, mpn, 1);
+    if (!buf) {
+#ifdef MAP_LINEAR_ELISION
+        uint64_t lin_base;
+        if (lin_lookup(d, mpn, &lin_base) && lin_base + off == ppn_base) {
+            memstats_add(&d->ms, &d->ms.lin_write_noop_cnt, 1);
+            return;
+        }
+#endif
+        buf = tpc_fill(d, mpn, n == EPP ? TPC_FILL_OVERWRITE : 1);
     }
-    cachehash_init(&g->cmt_hash, CMT_HASH_SIZE);
+#if ENTRY_BYTES == 8u
+    uint64_t *e = (uint64_t *)buf + off;
+    for (uint32_t i = 0; i < n; i++)
+        e[i] = ppn_base + i;
+#else
+    for (uint32_t i = 0; i < n; i++)
+        entry_store_u64(buf, off + i, ppn_base + i);
+#endif
+#ifdef TPC_ENTRY_RETAIN
+    for (uint32_t i = 0; i < n; i++)
+        tpc_touch_entry(d, buf, off + i);
+#endif
+}
 #endif
 
-#ifndef DISABLE_TPC
-    // 原 tpc_init(g->tpc, TPC_MAX_PAGES); 已不用
-    // --- 新增：TPC 预分配 page_pool_base 并绑定到每个 TpcEntry ---
-#ifndef ZERO_COPY_DMA
-    size_t total_pages = (size_t)TPC_SETS * TPC_WAYS;
-    g->page_pool_base = (uint8_t *)FTL_MALLOC_TPC_PAGE(total_pages);
+void FTLHandleReadBatch(FTLHandle *d, const uint64_t *lbas, uint64_t *out, uint64_t n)
+{
+#if defined(USE_CMT) || defined(DISABLE_TPC)
+    for (uint64_t i = 0; i < n; i++)
+        out[i] = FTLHandleRead(d, lbas[i]);
 #else
-    size_t total_bytes = (size_t)TPC_SETS * TPC_WAYS * MAP_PAGE_BYTES;
-    // 使用 posix_memalign 替代 malloc，强制 4096 字节对齐
-    if (posix_memalign((void **)&g->page_pool_base, 4096, total_bytes) != 0) {
-        perror("posix_memalign failed");
-        exit(1);
+    uint64_t i = 0;
+    while (i < n) {
+        if (unlikely(lbas[i] >= d->total_lpns)) {
+            out[i++] = UNMAPPED_PPA;
+            continue;
+        }
+        uint64_t mpn = lpn_to_mpn(lbas[i]);
+        uint64_t j = i + 1;
+        while (j < n && lbas[j] < d->total_lpns && lpn_to_mpn(lbas[j]) == mpn)
+            j++;
+        bool linear;
+        uint64_t lin_base;
+        const uint8_t *buf = ftl_read_page(d, mpn, &linear, &lin_base);
+        for (uint64_t k = i; k < j; k++) {
+            uint32_t off = lpn_to_off(lbas[k]);
+            out[k] = ftl_out_ppn(buf ? entry_load_u64(buf, off) : linear ? lin_base + off : 0);
+#ifdef TPC_ENTRY_RETAIN
+            if (buf)
+                tpc_touch_entry(d, buf, off);
+#endif
+        }
+        i = j;
     }
-    memset(g->page_pool_base, 0, total_bytes);
-    
-    memstats_add(&g_memstats.tpc_page_used, total_bytes);
 #endif
-    if (unlikely(!g->page_pool_base)) { perror("malloc pool failed"); exit(1); }
-    // 这里将 page_pool_base 记入 tpc_page_used
-    // FTL_MALLOC_TPC_PAGE 内已经统计 tpc_page_used，无需重复计数
+}
 
-    for (int i = 0; i < TPC_SETS; i++) {
-        g->tpc_sets[i].next_victim = 0;
-        for (int j = 0; j < TPC_WAYS; j++) {
-            g->tpc_sets[i].ways[j].dirty = 0;
-            g->tpc_sets[i].ways[j].mpn   = MPN_SENTINEL;
-#ifndef CACHE_LINE_OPTIMIZE
-            g->tpc_sets[i].ways[j].buffer = g->page_pool_base +
-                ((size_t)(i * TPC_WAYS + j) * MAP_PAGE_BYTES);
+bool FTLHandleModifyBatch(FTLHandle *d, const uint64_t *lbas, const uint64_t *ppns, uint64_t n)
+{
+    bool ok = true;
+#if defined(USE_CMT) || defined(DISABLE_TPC)
+    for (uint64_t i = 0; i < n; i++)
+        ok &= FTLHandleModify(d, lbas[i], ppns[i]);
 #else
-            g->tpc_sets[i].ways[j].buf_idx = (uint32_t)(i * TPC_WAYS + j);
+    uint64_t i = 0;
+    while (i < n) {
+        if (unlikely(lbas[i] >= d->total_lpns)) {
+            ok = false;
+            i++;
+            continue;
+        }
+        uint64_t mpn = lpn_to_mpn(lbas[i]);
+        uint64_t j = i + 1;
+        while (j < n && lbas[j] < d->total_lpns && lpn_to_mpn(lbas[j]) == mpn)
+            j++;
+        if (j - i == 1) {
+            ftl_apply_modify(d, lbas[i], ppns[i]);
+        } else {
+#ifdef TPC_ENTRY_RETAIN
+            for (uint64_t k = i; k < j; k++)
+                retain_update(d, lbas[k], ppns[k]);
+#endif
+            uint8_t *buf = tpc_get_buffer(d, mpn, 1);
+            for (uint64_t k = i; k < j; k++) {
+                entry_store_u64(buf, lpn_to_off(lbas[k]), ppns[k]);
+#ifdef TPC_ENTRY_RETAIN
+                tpc_touch_entry(d, buf, lpn_to_off(lbas[k]));
 #endif
+            }
         }
+#ifdef MAP_DURABLE
+        for (uint64_t k = i; k < j; k++)
+            wal_append(d, lbas[k], ppns[k]);
+#endif
+        i = j;
     }
 #endif
+    return ok;
+}
 
-    g->fd_map = open_file("map.ssd", true);
-    if (unlikely(g->fd_map < 0)) { perror("open map.ssd failed"); exit(1); }
-
-#ifdef LAST_HIT_OPTIMIZE
-    g->last_mpn = MPN_SENTINEL; 
-    g->last_entry = NULL;
+void FTLHandleReadRange(FTLHandle *d, uint64_t lba, uint64_t n, uint64_t *out)
+{
+#if defined(USE_CMT) || defined(DISABLE_TPC)
+    for (uint64_t i = 0; i < n; i++)
+        out[i] = FTLHandleRead(d, lba + i);
+#else
+    uint64_t i = 0;
+    while (i < n && lba + i < d->total_lpns) {
+        uint64_t mpn = lpn_to_mpn(lba + i);
+        uint32_t off = lpn_to_off(lba + i);
+        uint32_t cnt = EPP - off;
+        if (cnt > n - i)
+            cnt = (uint32_t)(n - i);
+        if (cnt > d->total_lpns - (lba + i))
+            cnt = (uint32_t)(d->total_lpns - (lba + i));
+        ftl_read_run(d, mpn, off, cnt, out + i);
+        i += cnt;
+    }
+    for (; i < n; i++)
+        out[i] = UNMAPPED_PPA; // 超出配置容量
 #endif
+}
 
-    #ifndef NO_PIPELINE
-    memset(&g_pl, 0, sizeof(g_pl));
-
-    // 初始化队列与 batch pool
-    int total_batches = QUEUE_DEPTH + 2;
-    for (int i = 0; i < total_batches; i++) {
-        g_pl.free_batches[i] = (TaskBatch *)FTL_MALLOC_PIPELINE(sizeof(TaskBatch));
-    }
-    g_pl.free_count = total_batches;
-    g_pl.head = 0;
-    g_pl.tail = 0;
-    g_pl.finished = 0;
-    pthread_mutex_init(&g_pl.mutex, NULL);
-    pthread_cond_init(&g_pl.not_empty, NULL);
-    pthread_cond_init(&g_pl.not_full, NULL);
-    #endif
-
-    // 可选优化：提示内核随机访问
-#if defined(POSIX_FADV_RANDOM)
-    posix_fadvise(g->fd_map, 0, 0, POSIX_FADV_RANDOM);
+bool FTLHandleModifyRange(FTLHandle *d, uint64_t lba, uint64_t n, uint64_t ppn_base)
+{
+#if defined(USE_CMT) || defined(DISABLE_TPC)
+    bool ok = true;
+    for (uint64_t i = 0; i < n; i++)
+        ok &= FTLHandleModify(d, lba + i, ppn_base + i);
+    return ok;
+#else
+    uint64_t i = 0;
+    while (i < n && lba + i < d->total_lpns) {
+        uint64_t mpn = lpn_to_mpn(lba + i);
+        uint32_t off = lpn_to_off(lba + i);
+        uint32_t cnt = EPP - off;
+        if (cnt > n - i)
+            cnt = (uint32_t)(n - i);
+        if (cnt > d->total_lpns - (lba + i))
+            cnt = (uint32_t)(d->total_lpns - (lba + i));
+        ftl_modify_run(d, mpn, off, cnt, ppn_base + i);
+#ifdef MAP_DURABLE
+        for (uint32_t k = 0; k < cnt; k++)
+            wal_append(d, lba + i + k, ppn_base + i + k);
+#endif
+        i += cnt;
+    }
+    return i == n;
 #endif
 }
 
-void FTLDestroy()
+// ========== TRIM ==========
+// 被 TRIM 的条目清为 0(未映射)。整页都没有映射的页移出 TPC 和各级缓存、清掉 GTD 位并回收盘上空间：
+// 原地存放时在 map.ssd 中打洞(相邻页合并成一次 fallocate)，压缩/日志结构存放时交还槽位或作废所在段中的页。
+// 之后对这些页的读由 GTD 直接判定为未映射，不占 TPC 也不读盘
+
+static bool mpage_is_zero(const uint8_t *page)
 {
-#ifdef FAST_DESTROY
-    // 原逻辑：直接 return，跳过刷脏页和释放。若要严格销毁，可注释掉 FAST_DESTROY 宏。
-    return;
-#else
-    if (!g) return;
+    const uint64_t *w = (const uint64_t *)page;
+    uint64_t acc = 0;
+    for (uint32_t i = 0; i < MAP_PAGE_BYTES / sizeof(uint64_t); i++)
+        acc |= w[i];
+    return acc == 0;
+}
+
 #ifdef USE_CMT
-    for (uint64_t i = 0; i < g->tt_entries; ++i) {
-        cmt_entry *n = &g->cmt_entries[i];
-        if (n->lpn != INVALID_LPN && n->dirty) {
-            write_ppn_to_map_with_gtd(g, n->lpn, n->ppn);
-            n->dirty = CLEAN;
+// 删除 CMT 中落在 [lba, end) 的条目：脏条目直接丢弃，同时从所在页的脏计数中扣除
+static void cmt_trim(FTL *d, uint64_t lba, uint64_t end)
+{
+    if (d->cmt.cnt == 0)
+        return;
+    if (end - lba < d->cmt.cap) {
+        for (uint64_t lpn = lba; lpn < end; lpn++) {
+            EcSlot *s = ec_peek(&d->cmt, lpn);
+            if (!s)
+                continue;
+            if (s->val & EC_DIRTY)
+                --*cmt_dirty_ctr(d, lpn_to_mpn(lpn));
+            ec_remove_at(&d->cmt, (uint32_t)(s - d->cmt.slots));
         }
-        n->lpn = INVALID_LPN;
-        n->ppn = UNMAPPED_PPA;
-        n->hnext = NULL;
+        return;
+    }
+    // 区间比表还大：扫一遍表。删除会把后面的条目移到当前槽，所以删除后原地再看一次
+    uint32_t i = 0;
+    while (i < d->cmt.cap) {
+        EcSlot *s = &d->cmt.slots[i];
+        if (s->lpn == EC_EMPTY || s->lpn < lba || s->lpn >= end) {
+            i++;
+            continue;
+        }
+        if (s->val & EC_DIRTY)
+            --*cmt_dirty_ctr(d, lpn_to_mpn(s->lpn));
+        ec_remove_at(&d->cmt, i);
     }
+}
 #endif
 
-    // === 新 TPC：刷新所有脏页到文件 ===
-    for (int i = 0; i < TPC_SETS; i++) {
-        for (int j = 0; j < TPC_WAYS; j++) {
-            if (g->tpc_sets[i].ways[j].mpn != MPN_SENTINEL) {
-                tpc_flush_entry(g, &g->tpc_sets[i].ways[j]);
-            }
+// 清掉同一页上 [off, off + n) 的条目；返回 true 表示整页已释放且盘上副本需要打洞
+static bool ftl_trim_run(FTL *d, uint64_t mpn, uint32_t off, uint32_t n)
+{
+#if defined(MAP_MMAP)
+    if (!map_page_allocated(d, mpn))
+        return false;
+    if (n < EPP) {
+        uint8_t *page = mm_page(d, mpn);
+        for (uint32_t i = 0; i < n; i++)
+            entry_store_u64(page, off + i, 0);
+        if (!mpage_is_zero(page))
+            return false;
+    }
+    return map_page_release(d, mpn);
+#elif defined(DISABLE_TPC)
+    if (!map_page_allocated(d, mpn))
+        return false;
+    if (n < EPP) {
+        // 读-改-写；清完变成全0页时不写回，直接释放
+        uint8_t buf[MAP_PAGE_BYTES] __attribute__((aligned(MAP_IO_ALIGN)));
+        off_t offset = (off_t)(mpn * MAP_PAGE_BYTES);
+        map_io_read_sync(&d->mio, buf, MAP_PAGE_BYTES, offset);
+        for (uint32_t i = 0; i < n; i++)
+            entry_store_u64(buf, off + i, 0);
+        if (!mpage_is_zero(buf)) {
+            map_io_write(&d->mio, buf, MAP_PAGE_BYTES, offset);
+            map_io_wait(&d->mio);
+            return false;
         }
     }
-
-    if (g->fd_map >= 0) {
-        close(g->fd_map);
-        g->fd_map = -1;
+    return map_page_release(d, mpn);
+#else
+#ifdef TPC_ENTRY_RETAIN
+    if (d->retain.cnt)
+        for (uint32_t i = 0; i < n; i++)
+            retain_update(d, mpn * (uint64_t)EPP + off + i, 0);
+#endif
+    uint32_t base = tpc_get_set_idx(d, mpn) * TPC_WAYS;
+    int way = tpc_set_find(&d->tpc_tags[base], mpn);
+    if (n < EPP) {
+        uint8_t *buf;
+        if (way >= 0) {
+            buf = tpc_slot_buf(d, base + (uint32_t)way);
+            d->tpc_flags[base + (uint32_t)way] |= TPC_F_DIRTY;
+        } else if (map_page_allocated(d, mpn)) {
+            buf = tpc_fill(d, mpn, 1); // 线性页在这里还原，压缩缓存中的页在这里取出
+        } else {
+            return false; // 全0页，无事可做
+        }
+#if ENTRY_BYTES == 8u
+        memset((uint64_t *)buf + off, 0, (size_t)n * sizeof(uint64_t));
+#else
+        for (uint32_t i = 0; i < n; i++)
+            entry_store_u64(buf, off + i, 0);
+#endif
+        if (!mpage_is_zero(buf))
+            return false;
+        tpc_forget_slot(d, (uint32_t)((size_t)(buf - d->page_pool_base) / MAP_PAGE_BYTES));
+    } else if (way >= 0) {
+        tpc_forget_slot(d, base + (uint32_t)way);
     }
-#ifdef USE_CMT
-    cachehash_destroy(&g->cmt_hash);
-    FTL_FREE_ENTRIES(g->cmt_entries, g->tt_entries);
-    g->cmt_entries = NULL;
-#endif
-    FTL_FREE_GTD(g->gtd, g->total_mpns);
-    g->gtd = NULL;
-    if (g->page_pool_base) {
-        size_t total_pages = (size_t)TPC_SETS * TPC_WAYS;
-        FTLFreeEx(g->page_pool_base, total_pages * MAP_PAGE_BYTES, MEM_CLASS_TPC_PAGE);
-        g->page_pool_base = NULL;
-    }
-    FTL_FREE_CTRL(g, sizeof(FTL));
-    g = NULL;
+    return map_page_release(d, mpn);
 #endif
 }
 
-uint64_t FTLRead(uint64_t lba) {
-#ifdef USE_CMT
-    cmt_entry *n = cache_get_entry(g, lba);
-    return n->ppn;
-#else
-    uint64_t ppn = read_ppn_from_map_with_gtd(g, lba);
-    return ppn;
+// 为 [first, first + cnt) 这几页在 map.ssd 中打洞。失败时旧内容留在盘上，但 GTD 已清，不会再被读到
+static void ftl_punch(FTL *d, uint64_t first, uint64_t cnt)
+{
+    if (map_io_discard(&d->mio, (off_t)(first * MAP_PAGE_BYTES), cnt * MAP_PAGE_BYTES))
+        return;
+#ifdef MAP_MMAP
+    // 映射区中的页重新分配时不清零，旧内容必须在这里清掉
+    memset(d->mm_base + first * MAP_PAGE_BYTES, 0, cnt * MAP_PAGE_BYTES);
 #endif
 }
 
-bool FTLModify(uint64_t lba, uint64_t ppn) {
+// 清掉 [lba, end) 的映射，end 不超过容量
+static void ftl_trim(FTL *d, uint64_t lba, uint64_t end)
+{
 #ifdef USE_CMT
-    cmt_entry *n = cache_get_entry(g, lba);
-    n->ppn = ppn;
-    n->dirty = DIRTY;
-#else
-    write_ppn_to_map_with_gtd(g, lba, ppn);
+    cmt_trim(d, lba, end);
 #endif
-    return true;
+    uint64_t punch_first = 0, punch_cnt = 0;
+    uint64_t i = lba;
+    while (i < end) {
+        uint64_t mpn = lpn_to_mpn(i);
+        uint32_t off = lpn_to_off(i);
+        uint32_t cnt = EPP - off;
+        if (cnt > end - i)
+            cnt = (uint32_t)(end - i);
+        if (ftl_trim_run(d, mpn, off, cnt)) {
+            if (punch_cnt && punch_first + punch_cnt == mpn) {
+                punch_cnt++;
+            } else {
+                if (punch_cnt)
+                    ftl_punch(d, punch_first, punch_cnt);
+                punch_first = mpn;
+                punch_cnt = 1;
+            }
+        }
+        i += cnt;
+    }
+    if (punch_cnt)
+        ftl_punch(d, punch_first, punch_cnt);
+    memstats_add(&d->ms, &d->ms.trim_lpn_cnt, end - lba);
+}
+
+bool FTLHandleTrim(FTLHandle *d, uint64_t lba, uint64_t n)
+{
+    if (unlikely(lba >= d->total_lpns))
+        return n == 0;
+    uint64_t end = n < d->total_lpns - lba ? lba + n : d->total_lpns;
+    ftl_trim(d, lba, end);
+#ifdef MAP_DURABLE
+    wal_append(d, lba, WAL_TRIM | (end - lba));
+#endif
+    return end == lba + n;
 }
 
 // ========== 下面是多线程部分 ==========
 
+// 执行一个异步请求并填写它的完成项(tag 已在提交时写好)
+static void ftl_exec_cqe(FTL *d, const TaskSimple *t, FTLCqe *c)
+{
+    bool ok;
+    c->result = 0;
+    switch (t->type) {
+    case IO_READ:
+        ok = t->lba < d->total_lpns;
+        if (ok)
+            c->result = FTLHandleRead(d, t->lba);
+        break;
+    case IO_WRITE:
+        ok = FTLHandleModify(d, t->lba, t->ppn);
+        break;
+    case IO_TRIM:
+        ok = FTLHandleTrim(d, t->lba, t->ppn);
+        break;
+    default:
+        ok = false;
+        break;
+    }
+    c->status = ok ? 0 : -EINVAL;
+}
+
+// 从空闲池取一个 batch，池空时等 worker 还回来
+static TaskBatch *pl_take_free(FTL *d)
+{
+    pthread_mutex_lock(&d->pl.mutex);
+    while (d->pl.free_count == 0)
+        pthread_cond_wait(&d->pl.not_full, &d->pl.mutex);
+    TaskBatch *b = d->pl.free_batches[--d->pl.free_count];
+    pthread_mutex_unlock(&d->pl.mutex);
+    b->count = 0;
+    b->to_cq = false;
+    return b;
+}
+
+// 把 batch 排进 worker 的队列，队列满时等待
+static void pl_enqueue(FTL *d, TaskBatch *b)
+{
+    pthread_mutex_lock(&d->pl.mutex);
+    while ((d->pl.tail + 1) % QUEUE_DEPTH == d->pl.head)
+        pthread_cond_wait(&d->pl.not_full, &d->pl.mutex);
+    d->pl.batch_queue[d->pl.tail] = b;
+    d->pl.tail = (d->pl.tail + 1) % QUEUE_DEPTH;
+    pthread_cond_signal(&d->pl.not_empty);
+    pthread_mutex_unlock(&d->pl.mutex);
+}
+
+#ifndef NO_PIPELINE
 static void *WorkerThread(void *arg) {
+    FTL *d = (FTL *)arg;
     TaskBatch *batch;
     while (1) {
-        pthread_mutex_lock(&g_pl.mutex);
+        pthread_mutex_lock(&d->pl.mutex);
         #ifdef TIME_TEST
         struct timespec t_start;
         TIMER_START(t_start);
         #endif
-        while (g_pl.head == g_pl.tail && !g_pl.finished) {
-            pthread_cond_wait(&g_pl.not_empty, &g_pl.mutex);
+        while (d->pl.head == d->pl.tail && !d->pl.finished) {
+            pthread_cond_wait(&d->pl.not_empty, &d->pl.mutex);
         }
         #ifdef TIME_TEST
         TIMER_END_ADD(t_start, total_consumer_wait);
         #endif
-        if (g_pl.head == g_pl.tail && g_pl.finished) {
-            pthread_mutex_unlock(&g_pl.mutex);
+        if (d->pl.head == d->pl.tail && d->pl.finished) {
+            pthread_mutex_unlock(&d->pl.mutex);
             break;
         }
 
-        batch = g_pl.batch_queue[g_pl.head];
-        g_pl.head = (g_pl.head + 1) % QUEUE_DEPTH;
-        pthread_mutex_unlock(&g_pl.mutex);
-
-        for (int i = 0; i < batch->count; i++) {
-            if (batch->tasks[i].type == IO_READ) {
-                uint64_t res = FTLRead(batch->tasks[i].lba);
-                fprintf(g_pl.output_file, "%" PRIu64 "\n", res);
-            } else {
-                FTLModify(batch->tasks[i].lba, batch->tasks[i].ppn);
+        batch = d->pl.batch_queue[d->pl.head];
+        d->pl.head = (d->pl.head + 1) % QUEUE_DEPTH;
+        pthread_mutex_unlock(&d->pl.mutex);
+
+        bool to_cq = batch->to_cq;
+        if (to_cq) {
+            // 异步批：按提交顺序填完成项，整批做完后一次发布
+            for (int i = 0; i < batch->count; i++)
+                ftl_exec_cqe(d, &batch->tasks[i], &d->pl.cq[(d->pl.cq_fill + (uint64_t)i) & ASYNC_CQ_MASK]);
+            d->pl.cq_fill += (uint64_t)batch->count;
+            __atomic_store_n(&d->pl.cq_tail, d->pl.cq_fill, __ATOMIC_RELEASE);
+        } else {
+            for (int i = 0; i < batch->count; i++) {
+                if (batch->tasks[i].type == IO_READ) {
+                    uint64_t res = FTLHandleRead(d, batch->tasks[i].lba);
+                    fprintf(d->pl.output_file, "%" PRIu64 "\n", res);
+                } else if (batch->tasks[i].type == IO_TRIM) {
+                    FTLHandleTrim(d, batch->tasks[i].lba, batch->tasks[i].ppn); // TRIM 的第三列是条目数
+                } else {
+                    FTLHandleModify(d, batch->tasks[i].lba, batch->tasks[i].ppn);
+                }
             }
         }
 
-        pthread_mutex_lock(&g_pl.mutex);
-        g_pl.free_batches[g_pl.free_count++] = batch;
-        pthread_cond_signal(&g_pl.not_full);
-        pthread_mutex_unlock(&g_pl.mutex);
+        pthread_mutex_lock(&d->pl.mutex);
+        d->pl.free_batches[d->pl.free_count++] = batch;
+        pthread_cond_signal(&d->pl.not_full);
+        if (to_cq)
+            pthread_cond_broadcast(&d->pl.cq_ready);
+        pthread_mutex_unlock(&d->pl.mutex);
     }
     return NULL;
 }
+#endif
 
 // ========== 进度打印函数，保持原样 ==========
 
@@ -1278,7 +6152,7 @@ void PercentageBasedProgress(uint64_t current, uint64_t total, int* lastPercent)
 
 // ========== AlgorithmRun：融合多线程流水线，保持接口与输出兼容 ==========
 
-uint32_t AlgorithmRun(IOVector *ioVector, const char *outputFile) {
+uint32_t FTLHandleRun(FTLHandle *d, IOVector *ioVector, const char *outputFile) {
     uint64_t ret;
     int lastPercent = -1;
 
@@ -1287,14 +6161,25 @@ uint32_t AlgorithmRun(IOVector *ioVector, const char *outputFile) {
         perror("Failed to open outputFile");
         exit(EXIT_FAILURE);
     }
-    
-    // FTL 初始化
-    FTLInit(ioVector->len);
-    g_pl.output_file = output;
+    // 配置了内存预算时输出缓冲也按预算，否则用 stdio 默认大小
+    char *output_buffer = NULL;
+    if (d->out_buf_bytes) {
+        output_buffer = (char *)FTL_MALLOC_CTRL(&d->ms, d->out_buf_bytes);
+        if (output_buffer) {
+            setvbuf(output, output_buffer, _IOFBF, d->out_buf_bytes);
+            mem_track(output_buffer, d->out_buf_bytes, FTL_MEM_IO_BUFFERS);
+        }
+    }
+
+    d->pl.output_file = output;
+    ftl_async_stop(d); // 异步接口的 worker 先退出，完成项仍可收割
 
     #ifndef NO_PIPELINE
     // 启动单 worker 线程（FTLRead/FTLModify 在其中执行）
-    pthread_create(&g_pl.worker_tid, NULL, WorkerThread, NULL);
+    d->pl.head = 0;
+    d->pl.tail = 0;
+    d->pl.finished = 0;
+    pthread_create(&d->pl.worker_tid, NULL, WorkerThread, d);
     #endif
 
     FILE *input = fopen(ioVector->inputFile, "r");
@@ -1304,10 +6189,11 @@ uint32_t AlgorithmRun(IOVector *ioVector, const char *outputFile) {
         exit(EXIT_FAILURE);
     }
 #ifdef SETVBUF
-    // [新增] 设置 1MB 的输入缓冲区
-    char *input_buffer = (char *)FTL_MALLOC_CTRL(1024 * 1024);
+    // [新增] 设置输入缓冲区(默认 1MB，配置了内存预算时按预算)
+    char *input_buffer = (char *)FTL_MALLOC_CTRL(&d->ms, d->in_buf_bytes);
     if (input_buffer) {
-        setvbuf(input, input_buffer, _IOFBF, 1024 * 1024);
+        setvbuf(input, input_buffer, _IOFBF, d->in_buf_bytes);
+        mem_track(input_buffer, d->in_buf_bytes, FTL_MEM_IO_BUFFERS);
     }
 #endif
     char line[256];
@@ -1326,10 +6212,12 @@ uint32_t AlgorithmRun(IOVector *ioVector, const char *outputFile) {
                    &ioVector->ioUnit.lba,
                    &ioVector->ioUnit.ppn);
             if (ioVector->ioUnit.type == IO_READ) {
-                ret = FTLRead(ioVector->ioUnit.lba);
-                fprintf(output, "%llu\n", ret);
+                ret = FTLHandleRead(d, ioVector->ioUnit.lba);
+                fprintf(output, "%" PRIu64 "\n", ret);
+            } else if (ioVector->ioUnit.type == IO_TRIM) {
+                FTLHandleTrim(d, ioVector->ioUnit.lba, ioVector->ioUnit.ppn);
             } else {
-                FTLModify(ioVector->ioUnit.lba, ioVector->ioUnit.ppn);
+                FTLHandleModify(d, ioVector->ioUnit.lba, ioVector->ioUnit.ppn);
             }
             PercentageBasedProgress(i, ioVector->len, &lastPercent);
         }
@@ -1337,14 +6225,8 @@ uint32_t AlgorithmRun(IOVector *ioVector, const char *outputFile) {
 #endif
         // ======= 新：多线程流水线（基于 TaskBatch 方案） =======
         
-        TaskBatch *current_batch = NULL;
-
         // 先取一个空 batch
-        pthread_mutex_lock(&g_pl.mutex);
-        while (g_pl.free_count == 0) pthread_cond_wait(&g_pl.not_full, &g_pl.mutex);
-        current_batch = g_pl.free_batches[--g_pl.free_count];
-        pthread_mutex_unlock(&g_pl.mutex);
-        current_batch->count = 0;
+        TaskBatch *current_batch = pl_take_free(d);
 
         for (uint64_t i = 0; i < ioVector->len; ++i) {
             #ifdef TIME_TEST
@@ -1360,60 +6242,243 @@ uint32_t AlgorithmRun(IOVector *ioVector, const char *outputFile) {
             current_batch->tasks[current_batch->count++] = t;
 
             if (unlikely(current_batch->count == BATCH_SIZE)) {
-                pthread_mutex_lock(&g_pl.mutex);
-                while ((g_pl.tail + 1) % QUEUE_DEPTH == g_pl.head) {
-                    pthread_cond_wait(&g_pl.not_full, &g_pl.mutex);
-                }
-                g_pl.batch_queue[g_pl.tail] = current_batch;
-                g_pl.tail = (g_pl.tail + 1) % QUEUE_DEPTH;
-                pthread_cond_signal(&g_pl.not_empty);
-
-                while (g_pl.free_count == 0) {
-                    pthread_cond_wait(&g_pl.not_full, &g_pl.mutex);
-                }
-                current_batch = g_pl.free_batches[--g_pl.free_count];
-                pthread_mutex_unlock(&g_pl.mutex);
-                current_batch->count = 0;
+                pl_enqueue(d, current_batch);
+                current_batch = pl_take_free(d);
             }
             PercentageBasedProgress(i, ioVector->len, &lastPercent);
         }
 
         if (current_batch->count > 0) {
-            pthread_mutex_lock(&g_pl.mutex);
-            while ((g_pl.tail + 1) % QUEUE_DEPTH == g_pl.head) {
-                pthread_cond_wait(&g_pl.not_full, &g_pl.mutex);
-            }
-            g_pl.batch_queue[g_pl.tail] = current_batch;
-            g_pl.tail = (g_pl.tail + 1) % QUEUE_DEPTH;
-            pthread_cond_signal(&g_pl.not_empty);
-            pthread_mutex_unlock(&g_pl.mutex);
+            pl_enqueue(d, current_batch);
+        } else {
+            pthread_mutex_lock(&d->pl.mutex);
+            d->pl.free_batches[d->pl.free_count++] = current_batch; // 留在空闲池里，由 FTLHandleClose 释放
+            pthread_mutex_unlock(&d->pl.mutex);
         }
 
-        pthread_mutex_lock(&g_pl.mutex);
-        g_pl.finished = 1;
-        pthread_cond_broadcast(&g_pl.not_empty);
-        pthread_mutex_unlock(&g_pl.mutex);
+        pthread_mutex_lock(&d->pl.mutex);
+        d->pl.finished = 1;
+        pthread_cond_broadcast(&d->pl.not_empty);
+        pthread_mutex_unlock(&d->pl.mutex);
 
-        pthread_join(g_pl.worker_tid, NULL);
+        pthread_join(d->pl.worker_tid, NULL);
 
-        // 释放流水线资源并计入线程内存统计（FTL_MALLOC_PIPELINE 已经统计）
-        // for (int i = 0; i < ioVector->len; i++) FTL_FREE_PIPELINE(g_pl.free_batches[i], sizeof(TaskBatch));
-        pthread_mutex_destroy(&g_pl.mutex);
-        pthread_cond_destroy(&g_pl.not_empty);
-        pthread_cond_destroy(&g_pl.not_full);
+        // 流水线的 batch 和锁留给本实例的下一次回放，在 FTLHandleClose 中释放
 #if defined SMALL_INPUT_MODE || defined NO_PIPELINE
     }
 #endif
 
-    ssdstats_refresh_from_fs(g->fd_map);
-    PrintResourceReport("AlgorithmRun summary", g);
+    map_io_wait(&d->mio); // 淘汰写回可能还在批中，等齐后文件大小才准确
+    ssdstats_refresh_from_fs(&d->ss, d->fd_map);
+    PrintResourceReport("AlgorithmRun summary", d);
 
-    FTLDestroy();
-#ifdef SETVBUF
-    free(input_buffer);
-#endif
     fclose(output);
     fclose(input);
+#ifdef SETVBUF
+    mem_untrack(input_buffer);
+    FTL_FREE_CTRL(&d->ms, input_buffer, d->in_buf_bytes); // 关闭 input 之后才能释放它的缓冲区
+#endif
+    if (output_buffer) {
+        mem_untrack(output_buffer);
+        FTL_FREE_CTRL(&d->ms, output_buffer, d->out_buf_bytes);
+    }
 
     return RETURN_OK;
 }
+
+// ========== 异步提交 / 完成接口 ==========
+// 复用回放流水线：提交攒进一个 TaskBatch(to_cq 置位)，攒满或按门铃时排进 batch_queue，由同一个 WorkerThread 执行。
+// worker 在第一次提交时启动，FTLHandleClose / FTLHandleRun 前停止。未收割的请求不超过完成队列容量，
+// 所以 worker 写完成项时不会追上调用者，也就从不需要等待调用者。NO_PIPELINE 下提交即同步执行
+
+// 第一次提交时分配完成队列并启动 worker
+static void ftl_async_start(FTL *d)
+{
+    if (!d->pl.cq) {
+        d->pl.cq = (FTLCqe *)FTL_MALLOC_PIPELINE(&d->ms, (size_t)FTL_ASYNC_DEPTH * sizeof(FTLCqe));
+        if (unlikely(!d->pl.cq)) { perror("malloc completion queue failed"); exit(1); }
+        mem_track(d->pl.cq, (size_t)FTL_ASYNC_DEPTH * sizeof(FTLCqe), FTL_MEM_PIPELINE);
+    }
+#ifndef NO_PIPELINE
+    if (d->pl.async_running)
+        return;
+    d->pl.head = 0;
+    d->pl.tail = 0;
+    d->pl.finished = 0;
+    d->pl.cq_fill = d->pl.sq_seq;
+    pthread_create(&d->pl.worker_tid, NULL, WorkerThread, d);
+    d->pl.async_running = true;
+#endif
+}
+
+// 交出未按门铃的请求，等 worker 全部做完后退出
+static void ftl_async_stop(FTL *d)
+{
+#ifndef NO_PIPELINE
+    if (!d->pl.async_running)
+        return;
+    FTLHandleDoorbell(d);
+    pthread_mutex_lock(&d->pl.mutex);
+    d->pl.finished = 1;
+    pthread_cond_broadcast(&d->pl.not_empty);
+    pthread_mutex_unlock(&d->pl.mutex);
+    pthread_join(d->pl.worker_tid, NULL);
+    d->pl.async_running = false;
+#else
+    (void)d;
+#endif
+}
+
+bool FTLHandleSubmit(FTLHandle *d, const FTLSqe *sqe)
+{
+    if (unlikely(d->pl.sq_seq - d->pl.cq_head >= FTL_ASYNC_DEPTH))
+        return false; // 完成队列已满，先收割
+    if (unlikely(!d->pl.cq || !d->pl.async_running))
+        ftl_async_start(d);
+    TaskSimple t = {sqe->opcode, sqe->lba, sqe->arg};
+    FTLCqe *c = &d->pl.cq[d->pl.sq_seq & ASYNC_CQ_MASK];
+    c->tag = sqe->tag;
+#ifdef NO_PIPELINE
+    ftl_exec_cqe(d, &t, c);
+    d->pl.sq_seq++;
+    d->pl.cq_tail = d->pl.sq_seq;
+#else
+    if (!d->pl.sq_batch) {
+        d->pl.sq_batch = pl_take_free(d);
+        d->pl.sq_batch->to_cq = true;
+    }
+    d->pl.sq_batch->tasks[d->pl.sq_batch->count++] = t;
+    d->pl.sq_seq++;
+    if (d->pl.sq_batch->count == BATCH_SIZE)
+        FTLHandleDoorbell(d);
+#endif
+    return true;
+}
+
+void FTLHandleDoorbell(FTLHandle *d)
+{
+#ifndef NO_PIPELINE
+    TaskBatch *b = d->pl.sq_batch;
+    if (!b)
+        return;
+    d->pl.sq_batch = NULL;
+    pl_enqueue(d, b);
+#else
+    (void)d;
+#endif
+}
+
+uint32_t FTLHandlePollCompletions(FTLHandle *d, FTLCqe *cqe, uint32_t max)
+{
+    uint64_t tail = __atomic_load_n(&d->pl.cq_tail, __ATOMIC_ACQUIRE);
+    if (tail == d->pl.cq_head) {
+        FTLHandleDoorbell(d); // 调用者在等结果：攒着的请求不能再等下去
+        return 0;
+    }
+    uint32_t n = 0;
+    while (n < max && d->pl.cq_head < tail)
+        cqe[n++] = d->pl.cq[d->pl.cq_head++ & ASYNC_CQ_MASK];
+    return n;
+}
+
+uint32_t FTLHandleWaitCompletions(FTLHandle *d, FTLCqe *cqe, uint32_t min, uint32_t max)
+{
+    uint64_t inflight = d->pl.sq_seq - d->pl.cq_head;
+    if (min > max)
+        min = max;
+    if (min > inflight)
+        min = (uint32_t)inflight;
+#ifndef NO_PIPELINE
+    FTLHandleDoorbell(d);
+    if (__atomic_load_n(&d->pl.cq_tail, __ATOMIC_ACQUIRE) - d->pl.cq_head < min) {
+        pthread_mutex_lock(&d->pl.mutex);
+        while (__atomic_load_n(&d->pl.cq_tail, __ATOMIC_ACQUIRE) - d->pl.cq_head < min)
+            pthread_cond_wait(&d->pl.cq_ready, &d->pl.mutex);
+        pthread_mutex_unlock(&d->pl.mutex);
+    }
+#endif
+    return FTLHandlePollCompletions(d, cqe, max);
+}
+
+// ========== 旧接口：全部转到默认实例 g ==========
+
+void FTLInit(uint64_t len)
+{
+    (void)len;
+    if (g)
+        return;
+    g = FTLHandleOpen(&g_cfg);
+}
+
+void FTLDestroy()
+{
+#ifdef FAST_DESTROY
+    ftl_close(g, true); // 进程随即退出，内存和 fd 交给操作系统回收
+#else
+    ftl_close(g, false);
+#endif
+    g = NULL;
+}
+
+uint64_t FTLRead(uint64_t lba)
+{
+    return FTLHandleRead(g, lba);
+}
+
+bool FTLModify(uint64_t lba, uint64_t ppn)
+{
+    return FTLHandleModify(g, lba, ppn);
+}
+
+void FTLReadBatch(const uint64_t *lbas, uint64_t *out, uint64_t n)
+{
+    FTLHandleReadBatch(g, lbas, out, n);
+}
+
+bool FTLModifyBatch(const uint64_t *lbas, const uint64_t *ppns, uint64_t n)
+{
+    return FTLHandleModifyBatch(g, lbas, ppns, n);
+}
+
+void FTLReadRange(uint64_t lba, uint64_t n, uint64_t *out)
+{
+    FTLHandleReadRange(g, lba, n, out);
+}
+
+bool FTLModifyRange(uint64_t lba, uint64_t n, uint64_t ppn_base)
+{
+    return FTLHandleModifyRange(g, lba, n, ppn_base);
+}
+
+bool FTLTrim(uint64_t lba, uint64_t n)
+{
+    return FTLHandleTrim(g, lba, n);
+}
+
+bool FTLSubmit(const FTLSqe *sqe)
+{
+    return FTLHandleSubmit(g, sqe);
+}
+
+void FTLDoorbell()
+{
+    FTLHandleDoorbell(g);
+}
+
+uint32_t FTLPollCompletions(FTLCqe *cqe, uint32_t max)
+{
+    return FTLHandlePollCompletions(g, cqe, max);
+}
+
+uint32_t FTLWaitCompletions(FTLCqe *cqe, uint32_t min, uint32_t max)
+{
+    return FTLHandleWaitCompletions(g, cqe, min, max);
+}
+
+uint32_t AlgorithmRun(IOVector *ioVector, const char *outputFile)
+{
+    FTLInit(ioVector->len);
+    uint32_t ret = FTLHandleRun(g, ioVector, outputFile);
+    FTLDestroy();
+    return ret;
+}
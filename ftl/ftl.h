@@ -13,10 +13,128 @@
 extern "C" {
 #endif
 
+// 映射 I/O 后端，在 FTLInit 时选定
+typedef enum {
+    FTL_MAP_BACKEND_PREAD = 0, // 同步 pread/pwrite 读写 map.ssd，同一批中地址相邻的请求合并为一次 preadv/pwritev
+    FTL_MAP_BACKEND_IO_URING,  // 一批请求一次 io_uring_enter 提交并收割；内核不支持时退回 pread
+    FTL_MAP_BACKEND_MEM,       // 映射页只存在内存中，不读写 map.ssd(用于基准测试)
+} FTLMapBackend;
+
+// NAND 几何与时序，各字段为 0 时取默认值(8 通道 x 4 die x 2 plane x 1024 块 x 256 页；tR 50us、tPROG 600us、tBERS 3ms、4KB 传输 5us)
+typedef struct {
+    uint32_t channels;
+    uint32_t dies_per_channel;
+    uint32_t planes_per_die;
+    uint32_t blocks_per_plane;
+    uint32_t pages_per_block; // 页大小固定为映射页大小 4KB
+    uint32_t t_read_ns;
+    uint32_t t_prog_ns;
+    uint32_t t_erase_ns;
+    uint32_t t_xfer_ns;       // 一页在通道上的传输时间
+} FTLNandConfig;
+
+// 运行期配置：在 FTLInit 之前调用 FTLConfigure 生效，未调用时等同于 FTLConfigDefault
+typedef struct {
+    uint64_t lba_count; // 逻辑空间大小(LBA 个数)，0 表示默认的 2^36
+    uint32_t durable_window; // 持久模式(MAP_DURABLE)下每多少次修改成组 fdatasync 一次，0 表示默认 4096
+    uint32_t map_backend; // FTLMapBackend
+    bool nand_sim;        // 映射 I/O 另按 NAND 时序模型计算设备时间和利用率(与后端无关)
+    FTLNandConfig nand;   // nand_sim 时使用
+    const char *map_path; // 映射页文件，NULL 表示 "map.ssd"；WAL 与检查点放在同目录(去掉 .ssd 后缀加 .wal / 加 .ckpt)
+    uint64_t mem_budget;  // 内存预算(字节)，按它确定 TPC 页数、输入/输出缓冲和 batch 池大小；0 表示用编译期默认值
+} FTLConfig;
+
+void FTLConfigDefault(FTLConfig *cfg);
+void FTLConfigure(const FTLConfig *cfg);
+
+// 多实例接口：每个实例有自己的配置、映射文件、统计和回放流水线，实例之间不共享可写状态，
+// 可以每个线程各用一个实例并行运行(map_path 必须互不相同)。同一实例不能被多个线程同时调用
+typedef struct FTLHandle FTLHandle;
+
+FTLHandle *FTLHandleOpen(const FTLConfig *cfg); // cfg 为 NULL 时取 FTLConfigDefault
+void FTLHandleClose(FTLHandle *h);
+uint64_t FTLHandleRead(FTLHandle *h, uint64_t lba);
+bool FTLHandleModify(FTLHandle *h, uint64_t lba, uint64_t ppn);
+void FTLHandleReadBatch(FTLHandle *h, const uint64_t *lbas, uint64_t *out, uint64_t n);
+bool FTLHandleModifyBatch(FTLHandle *h, const uint64_t *lbas, const uint64_t *ppns, uint64_t n);
+void FTLHandleReadRange(FTLHandle *h, uint64_t lba, uint64_t n, uint64_t *out);
+bool FTLHandleModifyRange(FTLHandle *h, uint64_t lba, uint64_t n, uint64_t ppn_base);
+bool FTLHandleTrim(FTLHandle *h, uint64_t lba, uint64_t n);
+// 用本实例的流水线回放 ioVector 指定的 trace，读结果写入 outputFile，最后打印本实例的资源报告
+uint32_t FTLHandleRun(FTLHandle *h, IOVector *ioVector, const char *outputFile);
+
+// 异步接口(仿 NVMe 的提交/完成队列)：请求先攒在提交队列里，攒满一批或按门铃时整批交给本实例的 worker 线程执行，
+// 完成项按提交顺序进入完成队列，调用者按 tag 对应。未收割的请求至多 FTL_ASYNC_DEPTH 个，满了以后提交返回 false，
+// 需先收割。异步请求与同步接口、FTLHandleRun 不能交叉使用；FTLHandleClose 会先等未完成的请求做完
+#define FTL_ASYNC_DEPTH 16384u
+
+typedef struct {
+    uint32_t opcode; // IOType
+    uint32_t rsvd;
+    uint64_t lba;
+    uint64_t arg;    // IO_WRITE 为 ppn，IO_TRIM 为条目数，IO_READ 不用
+    uint64_t tag;    // 原样带回完成项
+} FTLSqe;
+
+typedef struct {
+    uint64_t tag;
+    uint64_t result; // IO_READ 读出的 ppn(未映射的约定与 FTLRead 相同)，其余为 0
+    int32_t status;  // 0 成功；-EINVAL 表示 LBA 超出容量或未知操作
+    uint32_t rsvd;
+} FTLCqe;
+
+bool FTLHandleSubmit(FTLHandle *h, const FTLSqe *sqe);
+void FTLHandleDoorbell(FTLHandle *h); // 把提交队列中未满一批的请求交给 worker
+// 不等待，取出至多 max 个完成项；没有完成项时顺带按一次门铃(单核上应改用 Wait，避免空转占住 worker)
+uint32_t FTLHandlePollCompletions(FTLHandle *h, FTLCqe *cqe, uint32_t max);
+// 先按门铃，等到至少 min 个完成项(不超过未收割的请求数)后取出至多 max 个
+uint32_t FTLHandleWaitCompletions(FTLHandle *h, FTLCqe *cqe, uint32_t min, uint32_t max);
+
+// 进程内存采样：后台线程每 period_ms 毫秒(0 表示默认 20ms)读一次 /proc/self/smaps_rollup，各项分别记录峰值。
+// 内核不提供 smaps_rollup 时只有 RSS(取自 /proc/self/status)，PSS 各项为 0。采样器是进程级的，与实例无关
+// 下面几个组件是大段连续分配，同时用 mincore 逐页统计其中已驻留的部分；GTD、CMT 和各种小表零散分配在堆里，
+// 无法按页归属，只体现在进程级数字和资源报告的 MemStats 分类里
+typedef enum {
+    FTL_MEM_TPC_PAGES,  // TPC 页池
+    FTL_MEM_PIPELINE,   // TaskBatch 池和异步完成队列
+    FTL_MEM_IO_BUFFERS, // 回放输入/输出文件的 stdio 缓冲
+    FTL_MEM_COMPONENTS
+} FTLMemComponent;
+
+typedef struct {
+    uint64_t rss_kb;       // Stop 时还与内核记录的 VmHWM 取最大
+    uint64_t pss_kb;
+    uint64_t pss_anon_kb;  // 堆、线程栈、TPC 页池等匿名页
+    uint64_t pss_file_kb;  // 可执行文件、共享库、mmap 的 map.ssd
+    uint64_t pss_shmem_kb;
+    uint64_t comp_rss_kb[FTL_MEM_COMPONENTS]; // 各组件驻留量的峰值，所有实例相加
+    uint64_t samples;
+} FTLMemUsage;
+
+void FTLMemSamplerStart(uint32_t period_ms); // 已在运行时不做任何事
+void FTLMemSamplerStop(FTLMemUsage *out);    // 停止前再采一次；out 可为 NULL
+bool FTLMemSamplerPeek(FTLMemUsage *out);    // 取目前的峰值，返回采样器是否在运行
+
+// 单实例接口：作用于 FTLInit 创建的默认实例，FTLConfigure 设置它的配置
+
 void FTLInit(uint64_t len);
 void FTLDestroy();
 uint64_t FTLRead(uint64_t lba);
 bool FTLModify(uint64_t lba, uint64_t ppn);
+// 批量接口：按输入顺序执行，与逐条调用 FTLRead / FTLModify 的结果相同；
+// 输入中相邻且落在同一映射页的请求只查一次页。超出容量的 LBA 读出未映射值，写则跳过并使返回值为 false
+void FTLReadBatch(const uint64_t *lbas, uint64_t *out, uint64_t n);
+bool FTLModifyBatch(const uint64_t *lbas, const uint64_t *ppns, uint64_t n);
+// 区间接口：[lba, lba + n) 依次读出到 out，或依次映射到 ppn_base, ppn_base + 1, ...；覆盖整张映射页的写不读旧页
+void FTLReadRange(uint64_t lba, uint64_t n, uint64_t *out);
+bool FTLModifyRange(uint64_t lba, uint64_t n, uint64_t ppn_base);
+// TRIM：[lba, lba + n) 之后读出未映射值；变为全空的映射页不再占用 TPC、GTD 和 map.ssd 的空间。
+// 区间超出容量时只处理容量以内的部分并返回 false
+bool FTLTrim(uint64_t lba, uint64_t n);
+bool FTLSubmit(const FTLSqe *sqe);
+void FTLDoorbell();
+uint32_t FTLPollCompletions(FTLCqe *cqe, uint32_t max);
+uint32_t FTLWaitCompletions(FTLCqe *cqe, uint32_t min, uint32_t max);
 uint32_t AlgorithmRun(IOVector *ioVector, const char *filename);
 
 // 链表相关宏 (空闲链表和LRU均使用)
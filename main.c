@@ -157,9 +157,11 @@ int main(int argc, char *argv[])
     char *outputFile = NULL;
     char *validateFile = NULL;
     int ret;
+    FTLConfig ftlConfig;
+    FTLConfigDefault(&ftlConfig);
 
     /* 解析命令行参数 */
-    while ((opt = getopt(argc, argv, "i:o:v:")) != -1) {
+    while ((opt = getopt(argc, argv, "i:o:v:c:w:nb:m:")) != -1) {
         switch (opt) {
             case 'i':
                 inputFile = optarg;
@@ -170,8 +172,33 @@ int main(int argc, char *argv[])
             case 'v':
                 validateFile = optarg;
                 break;
+            case 'c':
+                /* 可选：逻辑空间大小(LBA 个数)，默认 2^36 */
+                ftlConfig.lba_count = strtoull(optarg, NULL, 0);
+                break;
+            case 'w':
+                /* 可选：持久模式的成组提交窗口(修改次数)，仅 MAP_DURABLE 编译时生效 */
+                ftlConfig.durable_window = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                /* 可选：映射 I/O 另走 NAND 时序模拟(默认几何)，报告中给出设备时间与利用率 */
+                ftlConfig.nand_sim = true;
+                break;
+            case 'b':
+                /* 可选：映射 I/O 后端 pread(默认) / uring / mem */
+                if (strcmp(optarg, "uring") == 0)
+                    ftlConfig.map_backend = FTL_MAP_BACKEND_IO_URING;
+                else if (strcmp(optarg, "mem") == 0)
+                    ftlConfig.map_backend = FTL_MAP_BACKEND_MEM;
+                else
+                    ftlConfig.map_backend = FTL_MAP_BACKEND_PREAD;
+                break;
+            case 'm':
+                /* 可选：内存预算(MB)，按它确定 TPC 页数、输入/输出缓冲和 batch 池大小 */
+                ftlConfig.mem_budget = strtoull(optarg, NULL, 0) << 20;
+                break;
             default:
-                fprintf(stderr, "Usage: %s -i inputFile -v valFile -o outputFile. [example: ./main -i ./dataset/input_1.txt -o ./dataset/output_1.txt -v ./dataset/val_1.txt] \n", argv[0]);
+                fprintf(stderr, "Usage: %s -i inputFile -v valFile -o outputFile [-c lbaCount] [-w durableWindow] [-n] [-b pread|uring|mem] [-m memBudgetMB]. [example: ./main -i ./dataset/input_1.txt -o ./dataset/output_1.txt -v ./dataset/val_1.txt] \n", argv[0]);
                 exit(EXIT_FAILURE);
         }
     }
@@ -203,9 +230,13 @@ int main(int argc, char *argv[])
 
     /* FTL算法执行 */
     printf("Start AlgorithmRun\n");
+    FTLConfigure(&ftlConfig);
+    FTLMemSamplerStart(0);
     AlgorithmRun(ioVector, outputFile);
 
     gettimeofday(&end, NULL);  // 记录结束时间
+    FTLMemUsage memUsage;
+    FTLMemSamplerStop(&memUsage); /* 停止采样不计入运行时间 */
     long seconds, useconds;    // 秒数和微秒数
     seconds = end.tv_sec - start.tv_sec;
     useconds = end.tv_usec - start.tv_usec;
@@ -220,7 +251,7 @@ int main(int argc, char *argv[])
         metrics.accuracy = CompareFiles(validateFile, outputFile);
     }
     metrics.algorithmRunningDuration = ((seconds) * 1000000 + useconds) / 1000.0;
-    metrics.memoryUse = 0;
+    metrics.memoryUse = (long)memUsage.rss_kb; /* 峰值 RSS，与 pmap / time -v 的口径一致 */
 
     PrintMetrics(&metrics);
     /* 保存指标数据到文件 */
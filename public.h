@@ -17,7 +17,8 @@ extern "C" {
 /* IO 类型 */
 typedef enum {
     IO_READ,
-    IO_WRITE
+    IO_WRITE,
+    IO_TRIM     // 第三列为条目数：[lba, lba + ppn) 解除映射
 } IOType;
 
 /* IO 结构体 */
@@ -0,0 +1,48 @@
+#!/bin/bash
+
+# 检查内存预算增大时 TPC 命中率不下降(预算决定 TPC 组数，组索引宽度一直到 TPC_MAX_SET_BITS)
+# 用法: ./check-tpc-budget.sh ./build/project_hw [预算MB ...]
+# 默认预算覆盖 TPC 从最少到最多组数；命中率比上一个预算低出 TOLERANCE 以上即失败
+
+# ⚠️ 关键：请确认你的输入文件名和路径是否正确！
+PROG_ARGS="-i ./trace.txt -o ./output.txt -v ./read_result.txt"
+# PROG_ARGS="-i ./trace2.txt -o ./output2.txt -v ./read_result2.txt"
+
+TOLERANCE=0.002
+
+EXE_PATH=$1
+shift
+BUDGETS=${*:-"4 16 64 150 300 600 1200"}
+
+if [ ! -f "$EXE_PATH" ]; then
+    echo "❌ Error: Executable not found at $EXE_PATH"
+    echo "👉 Usage: $0 <project_hw> [budget_mb ...]"
+    exit 1
+fi
+
+PREV=""
+STATUS=0
+for MB in $BUDGETS; do
+    # 每次运行前清理 map.ssd，保证起点一致
+    rm -f map.ssd
+
+    OUT=$($EXE_PATH -m $MB ${PROG_ARGS} 2>&1)
+    RATIO=$(echo "$OUT" | grep -a "TPC hit ratio" | tail -1 | awk '{print $5}')
+    PAGES=$(echo "$OUT" | grep -a "Memory budget" | tail -1 | sed -n 's/.*TPC \([0-9]*\) pages.*/\1/p')
+    if ! [[ "$RATIO" =~ ^[0-9.]+$ ]]; then
+        echo "❌ Error: no TPC hit ratio in output for -m $MB"
+        exit 1
+    fi
+    echo "📊 -m ${MB}MB: TPC ${PAGES} pages, hit ratio ${RATIO}"
+
+    if [ -n "$PREV" ] && awk -v p="$PREV" -v r="$RATIO" -v t="$TOLERANCE" 'BEGIN { exit !(r < p - t) }'; then
+        echo "❌ Hit ratio dropped from ${PREV} to ${RATIO} when the budget grew to ${MB}MB"
+        STATUS=1
+    fi
+    PREV=$RATIO
+done
+
+if [ $STATUS -eq 0 ]; then
+    echo "✅ Done! 命中率随预算单调不降"
+fi
+exit $STATUS
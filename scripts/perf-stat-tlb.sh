@@ -0,0 +1,33 @@
+#!/bin/bash
+
+# 对比 dTLB 缺失和缺页次数（用于评估 HUGEPAGE_BACKING 前后的效果）
+# 用法: ./perf-stat-tlb.sh ./build/project_hw [./build_hugepage/project_hw ...]
+
+# ⚠️ 关键：请确认你的输入文件名和路径是否正确！
+PROG_ARGS="-i ./trace.txt -o ./output.txt -v ./read_result.txt"
+# PROG_ARGS="-i ./trace2.txt -o ./output2.txt -v ./read_result2.txt"
+
+EVENTS="dTLB-loads,dTLB-load-misses,dTLB-stores,dTLB-store-misses,page-faults,minor-faults,major-faults"
+
+if [ $# -eq 0 ]; then
+    echo "❌ Error: no executable given"
+    echo "👉 Usage: $0 <project_hw> [<project_hw_hugepage> ...]"
+    exit 1
+fi
+
+for EXE_PATH in "$@"; do
+    if [ ! -f "$EXE_PATH" ]; then
+        echo "❌ Error: Executable not found at $EXE_PATH"
+        exit 1
+    fi
+
+    # 每次运行前清理 map.ssd，保证起点一致
+    rm -f map.ssd
+
+    echo "📊 perf stat: $EXE_PATH ${PROG_ARGS}"
+    sudo perf stat -e $EVENTS -- $EXE_PATH ${PROG_ARGS} 2>&1 \
+        | grep -E "dTLB|faults|seconds time elapsed|Page faults|Huge page"
+    echo ""
+done
+
+echo "✅ Done! 程序自身的资源报告中也会打印 FTLInit 期间/之后的缺页数，可直接对比。"